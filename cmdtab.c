@@ -0,0 +1,110 @@
+/*!
+ * @file cmdtab.c
+ *
+ * @brief Command name lookup.
+ *
+ * Kept apart from command.c, with no dependencies on the rest of the application,
+ * so that the host benchmark can build it as is.
+ */
+
+#include "cmdtab.h"
+
+/* C defines blank as space, \f, \n, \r, and \t, but space is enough for now */
+#define isblank(c)      (c == ' ')
+
+/* Same case folding as the command names are sorted with. */
+#define FOLD(c)         ((c) | 0x20)
+
+/*************************************************************************
+NAME
+    cmdtab_cmp
+
+DESCRIPTION
+    Compare the first len characters of a command name with a word.
+
+RETURNS
+    Less than, equal to or greater than zero, like strncmp().
+*/
+static int cmdtab_cmp(const char *name, const uint8 *word, uint16 len)
+{
+    for (; len; len--, name++, word++)
+    {
+        /* A name that is shorter than the word sorts before it. */
+        if (!*name)
+            return -1;
+
+        if (FOLD(*name) != FOLD(*word))
+            return FOLD(*name) - FOLD(*word);
+    }
+    return 0;
+}
+
+uint16 cmdtab_find(const char *const *names,
+                   uint16 count,
+                   const uint8 *s,
+                   const uint8 *end,
+                   const uint8 **endp)
+{
+    const uint8 *word;
+    uint16 len;
+    uint16 lo = 0;
+    uint16 hi = count;
+    uint16 mid;
+
+    while (s < end && isblank(*s)) s++;
+
+    word = s;
+    while (s < end && !isblank(*s)) s++;
+    len = s - word;
+
+    if (!len)
+        return CMDTAB_NONE;
+
+    /* First name that does not sort before the word. */
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (cmdtab_cmp(names[mid], word, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* Of the names the word is a prefix of, take the first one it gives all the
+     * mandatory (upper case) characters of. */
+    for (; lo < count && cmdtab_cmp(names[lo], word, len) == 0; lo++)
+    {
+        if (!names[lo][len] || (names[lo][len] & 0x20))
+        {
+            if (endp)
+            {
+                while (s < end && isblank(*s)) s++; /* skip spaces */
+                *endp = s;
+            }
+            return lo;
+        }
+    }
+
+    return CMDTAB_NONE;
+}
+
+bool cmdtab_sorted(const char *const *names, uint16 count)
+{
+    const char *name;
+    uint16 i;
+
+    /* Compared over all of the later name, the earlier one must sort before it,
+     * with the same compare as the search. Equal names fail too. */
+    for (i = 1; i < count; i++)
+    {
+        for (name = names[i]; *name; name++)
+            ;
+
+        if (cmdtab_cmp(names[i - 1], (const uint8 *)names[i], name - names[i]) >= 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* End-of-File */
@@ -0,0 +1,52 @@
+/*!
+ * @file cmdtab.h
+ *
+ * @brief Command name lookup.
+ */
+
+#ifndef __CMDTAB_H
+#define __CMDTAB_H
+
+#include <csrtypes.h>
+
+/*!
+ * @brief Returned by cmdtab_find() when no command matches.
+ */
+#define CMDTAB_NONE 0xFFFF
+
+/*!
+ * @brief Find the command a word on the command line refers to.
+ *
+ * Command names are written with the mandatory part in upper case and the optional
+ * part in lower case, e.g. "DEbug" matches "de", "deb" or "DEBUG" but not "d". The
+ * comparison is not case sensitive.
+ *
+ * The names must be sorted in case insensitive order, so the lookup is a binary
+ * search on the word followed by a check of the (usually single) name it is a
+ * prefix of, rather than a compare against every command.
+ *
+ * @param names Command names, sorted.
+ * @param count Number of names.
+ * @param s Start of the command line, leading blanks are skipped.
+ * @param end End of the command line.
+ * @param endp Set to the first parameter after the command word, if not NULL.
+ *
+ * @returns Index of the matching name, or CMDTAB_NONE.
+ */
+uint16 cmdtab_find(const char *const *names,
+                   uint16 count,
+                   const uint8 *s,
+                   const uint8 *end,
+                   const uint8 **endp);
+
+/*!
+ * @brief Check that command names are in the order cmdtab_find() relies on.
+ *
+ * @param names Command names.
+ * @param count Number of names.
+ *
+ * @returns TRUE if every name sorts after the one before it, not case sensitive.
+ */
+bool cmdtab_sorted(const char *const *names, uint16 count);
+
+#endif
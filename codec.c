@@ -0,0 +1,175 @@
+/*!
+ * @file codec.c
+ *
+ * @brief Hex and base64 encoding of binary payloads.
+ *
+ * Used for 'tx' data given as h:0a1b2c... or b:... and for Rx output in the matching
+ * forms, see the 'rxenc' command. The decoders look characters up in a table and
+ * work on a whole group at a time, 4 hex digits to a 16-bit word or 4 base64
+ * characters to 3 bytes, checking the group for bad characters with one test.
+ *
+ * Kept apart from the rest of the application, like cmdtab.c, so the host tools can
+ * build it as is.
+ */
+
+#include "codec.h"
+
+/* Not a hex digit or base64 character. */
+#define XX      0xFF
+
+/* Value of each 7-bit character as a hex digit. */
+static const uint8 hex_value[128] =
+{
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX
+};
+
+/* Value of each 7-bit character in the base64 alphabet, '=' is handled apart. */
+static const uint8 base64_value[128] =
+{
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX,   XX, 0x3E,   XX,   XX,   XX, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D,   XX,   XX,   XX,   XX,   XX,   XX,
+      XX, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,   XX,   XX,   XX,   XX,   XX,
+      XX, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33,   XX,   XX,   XX,   XX,   XX
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+bool codec_hex_decode(const uint8 *s, uint16 n, uint8 *out, uint16 *plen)
+{
+    uint16 len = 0;
+    uint16 word;
+
+    if (n & 1)
+        return FALSE;
+
+    for (; n >= 4; n -= 4, s += 4)
+    {
+        if (
+            (s[0] | s[1] | s[2] | s[3]) & 0x80 ||
+            (hex_value[s[0]] | hex_value[s[1]] | hex_value[s[2]] | hex_value[s[3]]) & 0xF0
+            )
+        {
+            return FALSE;
+        }
+
+        if (out)
+        {
+            word = ((uint16)hex_value[s[0]] << 12) |
+                   ((uint16)hex_value[s[1]] << 8) |
+                   (hex_value[s[2]] << 4) |
+                   hex_value[s[3]];
+            out[len] = (uint8)(word >> 8);
+            out[len + 1] = (uint8)(word & 0xFF);
+        }
+        len += 2;
+    }
+
+    if (n)
+    {
+        if ((s[0] | s[1]) & 0x80 || (hex_value[s[0]] | hex_value[s[1]]) & 0xF0)
+            return FALSE;
+
+        if (out)
+            out[len] = (uint8)((hex_value[s[0]] << 4) | hex_value[s[1]]);
+        len += 1;
+    }
+
+    *plen = len;
+    return TRUE;
+}
+
+bool codec_base64_decode(const uint8 *s, uint16 n, uint8 *out, uint16 *plen)
+{
+    uint16 len = 0;
+    uint32 group;
+    uint16 i;
+
+    /* Padding is optional. */
+    if (n && s[n - 1] == '=') n--;
+    if (n && s[n - 1] == '=') n--;
+
+    if ((n & 3) == 1)
+        return FALSE;
+
+    for (; n; n -= i, s += i)
+    {
+        /* The last group may be 2 or 3 characters. */
+        i = (n > 4) ? 4 : n;
+
+        if (
+            (s[0] | s[1] | s[i - 2] | s[i - 1]) & 0x80 ||
+            (base64_value[s[0]] | base64_value[s[1]] |
+             base64_value[s[i - 2]] | base64_value[s[i - 1]]) & 0xC0
+            )
+        {
+            return FALSE;
+        }
+
+        if (out)
+        {
+            group = ((uint32)base64_value[s[0]] << 18) |
+                    ((uint32)base64_value[s[1]] << 12);
+            if (i > 2) group |= (uint32)base64_value[s[2]] << 6;
+            if (i > 3) group |= base64_value[s[3]];
+
+            out[len] = (uint8)(group >> 16);
+            if (i > 2) out[len + 1] = (uint8)((group >> 8) & 0xFF);
+            if (i > 3) out[len + 2] = (uint8)(group & 0xFF);
+        }
+        len += i - 1;
+    }
+
+    *plen = len;
+    return TRUE;
+}
+
+void codec_hex_encode(const uint8 *data, uint16 len, uint8 *out)
+{
+    while (len--)
+    {
+        *out++ = hex_digits[(*data >> 4) & 0xF];
+        *out++ = hex_digits[*data++ & 0xF];
+    }
+}
+
+void codec_base64_encode(const uint8 *data, uint16 len, uint8 *out)
+{
+    uint32 group;
+
+    for (; len >= 3; len -= 3, data += 3)
+    {
+        group = ((uint32)(data[0] & 0xFF) << 16) | ((uint32)(data[1] & 0xFF) << 8) | (data[2] & 0xFF);
+
+        *out++ = base64_digits[(group >> 18) & 0x3F];
+        *out++ = base64_digits[(group >> 12) & 0x3F];
+        *out++ = base64_digits[(group >> 6) & 0x3F];
+        *out++ = base64_digits[group & 0x3F];
+    }
+
+    if (len)
+    {
+        group = (uint32)(data[0] & 0xFF) << 16;
+        if (len > 1) group |= (uint32)(data[1] & 0xFF) << 8;
+
+        *out++ = base64_digits[(group >> 18) & 0x3F];
+        *out++ = base64_digits[(group >> 12) & 0x3F];
+        *out++ = (len > 1) ? base64_digits[(group >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+}
+
+/* End-of-File */
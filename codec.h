@@ -0,0 +1,70 @@
+/*!
+ * @file codec.h
+ *
+ * @brief Hex and base64 encoding of binary payloads.
+ */
+
+#ifndef __CODEC_H
+#define __CODEC_H
+
+#include <csrtypes.h>
+
+/*!
+ * @brief Characters needed to hex encode n bytes.
+ */
+#define CODEC_HEX_LEN(n)        ((n) * 2)
+
+/*!
+ * @brief Characters needed to base64 encode n bytes, with padding.
+ */
+#define CODEC_BASE64_LEN(n)     (((n) + 2) / 3 * 4)
+
+/*!
+ * @brief Decode a run of hex digits, two to a byte.
+ *
+ * @param s The hex digits, in either case.
+ * @param n Number of digits.
+ * @param out Where to put the bytes, or NULL to only check the digits and get the
+ * length.
+ * @param plen Set to the number of bytes.
+ *
+ * @returns FALSE if there is an odd number of digits or a character that is not one.
+ */
+bool codec_hex_decode(const uint8 *s, uint16 n, uint8 *out, uint16 *plen);
+
+/*!
+ * @brief Decode a run of base64 characters, padding with '=' is optional.
+ *
+ * @param s The base64 characters.
+ * @param n Number of characters.
+ * @param out Where to put the bytes, or NULL to only check the characters and get
+ * the length.
+ * @param plen Set to the number of bytes.
+ *
+ * @returns FALSE if the run has a bad length or character.
+ */
+bool codec_base64_decode(const uint8 *s, uint16 n, uint8 *out, uint16 *plen);
+
+/*!
+ * @brief Hex encode bytes, in lower case.
+ *
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @param out Room for CODEC_HEX_LEN(len) characters.
+ *
+ * @returns void.
+ */
+void codec_hex_encode(const uint8 *data, uint16 len, uint8 *out);
+
+/*!
+ * @brief Base64 encode bytes, with padding.
+ *
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @param out Room for CODEC_BASE64_LEN(len) characters.
+ *
+ * @returns void.
+ */
+void codec_base64_encode(const uint8 *data, uint16 len, uint8 *out);
+
+#endif
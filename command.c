@@ -7,16 +7,20 @@
 #include <util.h>
 #include <stdlib.h>
 #include <panic.h>
+#include <ps.h>
 #include <sink.h>
+#include <stream.h>
 #include <string.h>
 #include <vm.h>
 
 #include "rfcomm_multi_slave.h"
+#include "cmdtab.h"
+#include "codec.h"
 
 /* C defines blank as space, \f, \n, \r, and \t, but space is enough for now */
 #define isblank(c)      (c == ' ')
 
-#define PARAMS()        (params < uart_end)
+#define PARAMS()        (params < ctx->end)
 
 #ifdef ENABLE_HELP
 #   define COMMAND_HELP(msg)                     \
@@ -46,16 +50,16 @@ DESCRIPTION
 RETURNS
 
 */
-static int cmdcmp(const uint8 *s, const uint8 **endp, const char *cmd)
+static int cmdcmp(const CMD_CONTEXT_T *ctx, const uint8 *s, const uint8 **endp, const char *cmd)
 {
     /* skip leading whitespace */
-    while (s < uart_end && isblank(*s)) s++;
+    while (s < ctx->end && isblank(*s)) s++;
 
     if (endp) {
         *endp = s;
     }
     
-    for (; s < uart_end; s++, cmd++)
+    for (; s < ctx->end; s++, cmd++)
     {
         if (*s != *cmd)
         {
@@ -68,7 +72,7 @@ static int cmdcmp(const uint8 *s, const uint8 **endp, const char *cmd)
     if (!*cmd || (*cmd & 0x20))
     {
         if (endp) {
-            while (s < uart_end && isblank(*s)) s++; /* skip spaces */
+            while (s < ctx->end && isblank(*s)) s++; /* skip spaces */
             *endp = s;
         }
         
@@ -111,24 +115,25 @@ DESCRIPTION
 RETURNS
 
 */
-static bool cmd_parse_num(const uint8 *s,
+static bool cmd_parse_num(const CMD_CONTEXT_T *ctx,
+                          const uint8 *s,
                           const uint8 **endp,
                           uint16 *num)
 {
     bool rc = TRUE;
     uint8 i;
     
-    while (s < uart_end && isblank(*s)) s++;
+    while (s < ctx->end && isblank(*s)) s++;
 
-    if (s == uart_end) return FALSE;
+    if (s == ctx->end) return FALSE;
     
-    if (s + 2 < uart_end &&
+    if (s + 2 < ctx->end &&
         s[0] == '0' &&
         (s[1] == 'x' || s[1] == 'X'))
     {
         *num = 0;
         
-        for (s += 2; s < uart_end; s++)
+        for (s += 2; s < ctx->end; s++)
         {
             if (ch_to_u8(*s, &i))
                 *num = (*num << 4) | i;
@@ -139,7 +144,7 @@ static bool cmd_parse_num(const uint8 *s,
     else
     {
         const uint8 *sp = s;
-        s = UtilGetNumber(s, uart_end, num);
+        s = UtilGetNumber(s, ctx->end, num);
 
         if (!s)
         {
@@ -168,7 +173,8 @@ RETURNS
 
 */
 
-static bool cmd_parse_bdaddr(const uint8 *s,
+static bool cmd_parse_bdaddr(const CMD_CONTEXT_T *ctx,
+                             const uint8 *s,
                              const uint8 **endp,
                              bdaddr      *addr)
 {
@@ -176,9 +182,9 @@ static bool cmd_parse_bdaddr(const uint8 *s,
     uint8 num;
     bool rc = TRUE;
 
-    while (s < uart_end && isblank(*s)) s++;
+    while (s < ctx->end && isblank(*s)) s++;
 
-    if (s + 2 < uart_end &&
+    if (s + 2 < ctx->end &&
         s[0] == '0' &&
         (s[1] == 'x' || s[1] == 'X'))
     {
@@ -186,7 +192,7 @@ static bool cmd_parse_bdaddr(const uint8 *s,
 
         memset(addr, 0, sizeof(bdaddr));
         
-        for (i = 0; i < 12 && s < uart_end; i++, s++)
+        for (i = 0; i < 12 && s < ctx->end; i++, s++)
         {
             if (!ch_to_u8(*s, &num))
             {
@@ -224,6 +230,40 @@ static bool cmd_parse_bdaddr(const uint8 *s,
 #endif
 
 
+/*************************************************************************
+NAME    
+    cmd_parse_encoded
+    
+DESCRIPTION
+    Parse a run of binary data written as h:hexdigits or b:base64, which
+    ends at the next blank.
+
+RETURNS
+    TRUE if the run is valid, with the number of bytes in *plen.
+*/
+static bool cmd_parse_encoded(const CMD_CONTEXT_T *ctx,
+                              const uint8 *s,
+                              const uint8 **endp,
+                              uint8 *out,
+                              uint16 *plen)
+{
+    const uint8 *run = s + 2;
+    bool rc;
+
+    for (s = run; s < ctx->end && !isblank(*s); s++)
+        ;
+
+    if ((run[-2] | 0x20) == 'h')
+        rc = codec_hex_decode(run, s - run, out, plen);
+    else if ((run[-2] | 0x20) == 'b')
+        rc = codec_base64_decode(run, s - run, out, plen);
+    else
+        rc = FALSE;
+
+    if (endp) *endp = s;
+    return rc;
+}
+
 /*************************************************************************
 NAME    
     cmd_parse_value
@@ -231,45 +271,64 @@ NAME
 DESCRIPTION
     Parse generic data from input stream.
 
+    With out NULL the data is only checked and measured, so the caller can
+    find room for it before the second pass decodes it into that room.
+
 NOTE
-    Data can be formatted either as "string", 0xhexnum, num, or any
-    combination of those. All numbers are maximum 16 bits.
+    Data can be formatted either as "string", 0xhexnum, num, h:hexdigits,
+    b:base64 or any combination of those. All numbers are maximum 16 bits.
 
 RETURNS
-
+    TRUE if the data is valid, with its length in *plen.
 */
-static bool cmd_parse_value(const uint8 *s,
+static bool cmd_parse_value(const CMD_CONTEXT_T *ctx,
+                            const uint8 *s,
                             const uint8 **endp,
-                            uint16 *plen,
-                            uint8 **prc)
+                            uint8 *out,
+                            uint16 *plen)
 {
     bool in_str = FALSE;
     uint16 len = 0;
     uint16 num;
-    uint8 *rc = NULL;
-
-    rc = PanicUnlessMalloc(uart_end - s);
 
-    /* the way we parse data means that stream length is always greater than
-     * the resulting string length. */
-    while (s < uart_end)
+    while (s < ctx->end)
     {
         /* start/end of string */
         if (*s == '"') in_str = !in_str;
 
         /* string */
-        else if (in_str) rc[len++] = *s;
+        else if (in_str)
+        {
+            if (out) out[len] = *s;
+            len++;
+        }
 
         /* blank */
         else if (isblank(*s))
         {
             /* skip blanks */
-            do s++; while (s < uart_end && isblank(*s));
+            do s++; while (s < ctx->end && isblank(*s));
             continue; /* do not advance s at the end */
         }
 
+        /* h:hexdigits or b:base64 */
+        else if (s + 1 < ctx->end && s[1] == ':')
+        {
+            if (!cmd_parse_encoded(ctx, s, &s, (out) ? out + len : NULL, &num))
+            {
+                in_str = TRUE;
+                break;
+            }
+            len += num;
+            continue; /* s is already past the run */
+        }
+
         /* number */
-        else if (cmd_parse_num(s, &s, &num)) rc[len++] = num;
+        else if (cmd_parse_num(ctx, s, &s, &num))
+        {
+            if (out) out[len] = num;
+            len++;
+        }
 
         /* failure */
         else {
@@ -283,22 +342,236 @@ static bool cmd_parse_value(const uint8 *s,
         s++;
     }
 
-    /* in case of error clean up */
-    if (in_str || !len)
-    {
-        free(rc);
-        rc = NULL;
-        len = 0;
-    }
-    
+    /* empty data is an error too */
+    if (!len)
+        in_str = TRUE;
+
     *plen = len;
-    *prc = rc;
     if (endp) *endp = s;
 
     /* in_str means that we encountered an error */
     return !in_str;
 }
 
+/*************************************************************************
+NAME    
+    cmd_tx_direct
+    
+DESCRIPTION
+    Decode tx data straight into the sink of a link, when nothing is queued
+    on the link and the sink has room for all of it.
+
+RETURNS
+    FALSE if the data has to be queued instead.
+*/
+static bool cmd_tx_direct(MAIN_APP_T *app,
+                          CMD_CONTEXT_T *ctx,
+                          uint16 link_id,
+                          const uint8 *params,
+                          uint16 len)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+    uint16 offs;
+    uint8 *data;
+
+    if (
+        conn->tx_count ||
+        SinkSlack(conn->sink) < len ||
+        (offs = SinkClaim(conn->sink, len)) == 0xffff ||
+        !(data = SinkMap(conn->sink))
+        )
+    {
+        return FALSE;
+    }
+
+    cmd_parse_value(ctx, params, NULL, data + offs, &len);
+    SinkFlush(conn->sink, len);
+    sniff_activity(app, link_id);
+    return TRUE;
+}
+
+/*!
+ * @brief Run a stored script.
+ *
+ * @param app The application state.
+ * @param params The name of the script.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_run(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    const uint8 *name;
+    
+    COMMAND_HELP(
+            "help run name\r\n"
+            );
+    
+    for (name = params; PARAMS() && !isblank(*params); params++)
+        ;
+    
+    if (params == name)
+        return FALSE;
+    
+    if (!script_run(app, name, params - name, ctx->out))
+        print_error(RESULT_NOT_FOUND, "No such script.\r\n");
+    
+    return TRUE;
+}
+
+/*!
+ * @brief List, store or delete scripts.
+ *
+ * @param app The application state.
+ * @param params Nothing to list the scripts, a name to delete a script, or a name
+ * followed by the commands in double quotes, separated by ';', to store one.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_script(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    const uint8 *name;
+    const uint8 *cmds = NULL;
+    uint16 name_len;
+    
+    COMMAND_HELP(
+            "help script [name [\"commands\"]]\r\n"
+            );
+    
+    if (!PARAMS())
+    {
+        script_list();
+        return TRUE;
+    }
+    
+    for (name = params; PARAMS() && !isblank(*params) && *params != '"'; params++)
+        ;
+    name_len = params - name;
+    
+    while (PARAMS() && isblank(*params)) params++;
+    
+    if (PARAMS())
+    {
+        if (*params != '"')
+            return FALSE;
+        
+        for (cmds = ++params; PARAMS() && *params != '"'; params++)
+            ;
+        
+        if (!PARAMS())
+            return FALSE;
+    }
+    
+    if (!name_len)
+    {
+        return FALSE;
+    }
+    else if (cmds && name_len + 1 + (params - cmds) > SCRIPT_MAX_LEN)
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Scripts are limited to %d characters.\r\n", SCRIPT_MAX_LEN);
+    }
+    else if (!script_store(name, name_len, cmds, (cmds) ? params - cmds : 0))
+    {
+        print_error(RESULT_FULL, "No room for the script.\r\n");
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Put links into sniff after a time without data, or wake a link.
+ *
+ * Without parameters outputs the settings and the mode of every connected link.
+ *
+ * @param app The application state.
+ * @param params Nothing, 'off', 'wake' and a link id, or the idle time in ms
+ * followed by optional largest and smallest sniff intervals in slots.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_sniff(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 idle;
+    uint16 max_interval = SNIFF_INTERVAL;
+    uint16 min_interval;
+    uint16 i;
+
+    COMMAND_HELP(
+            "help sniff [off|wake link_id|idle_ms [max_slots [min_slots]]]\r\n"
+            );
+
+    if (!PARAMS())
+    {
+        if (app->sniff_idle)
+            print("Sniff after %l ms idle, %d..%d slots\r\n",
+                  (uint32)app->sniff_idle,
+                  app->sniff_table.min_interval,
+                  app->sniff_table.max_interval
+                  );
+        else
+            print("Sniff off\r\n");
+
+        for (i=0; i<MAX_CONNECTIONS; i++)
+        {
+            const CONN_STATE_T *conn = &app->connection[i];
+
+            if (conn->state != STATE_CONNECTED)
+                continue;
+
+            if (conn->mode == lp_sniff)
+                print("Link %d: sniff, %d slots\r\n", i, conn->interval);
+            else
+                print("Link %d: active\r\n", i);
+        }
+        return TRUE;
+    }
+
+    if (cmdcmp(ctx, params, &params, "Off") == 0)
+    {
+        sniff_set(app, 0, app->sniff_table.min_interval, app->sniff_table.max_interval);
+        return TRUE;
+    }
+
+    if (cmdcmp(ctx, params, &params, "Wake") == 0)
+    {
+        if (!cmd_parse_num(ctx, params, &params, &i))
+            return FALSE;
+
+        if (i >= MAX_CONNECTIONS)
+            print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", i, MAX_CONNECTIONS-1);
+        else if (app->connection[i].state != STATE_CONNECTED)
+            print_error(RESULT_NOT_CONNECTED, "Link %d is not connected.\r\n", i);
+        else
+            sniff_activity(app, i);
+        return TRUE;
+    }
+
+    if (!cmd_parse_num(ctx, params, &params, &idle))
+        return FALSE;
+
+    if (PARAMS() && !cmd_parse_num(ctx, params, &params, &max_interval))
+        return FALSE;
+
+    min_interval = max_interval;
+    if (PARAMS() && !cmd_parse_num(ctx, params, &params, &min_interval))
+        return FALSE;
+
+    if (!idle)
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Idle time must be at least 1 ms, or use 'sniff off'.\r\n");
+    }
+    else if (
+        min_interval < SNIFF_MIN_SLOTS || max_interval > SNIFF_MAX_SLOTS ||
+        min_interval > max_interval || (min_interval & 1) || (max_interval & 1)
+        )
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Intervals must be even, min <= max, in %d..%d slots\r\n", SNIFF_MIN_SLOTS, SNIFF_MAX_SLOTS);
+    }
+    else
+    {
+        sniff_set(app, idle, min_interval, max_interval);
+    }
+    return TRUE;
+}
+
 /*!
  * @brief Outputs the current application state.
  * 
@@ -309,7 +582,7 @@ static bool cmd_parse_value(const uint8 *s,
  *
  * @returns Always returns true, as params are ignored.
  */
-static bool cmd_state(MAIN_APP_T *app, const uint8 *params)
+static bool cmd_state(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
 {
     uint16 i;
     
@@ -351,30 +624,15 @@ static bool cmd_state(MAIN_APP_T *app, const uint8 *params)
                 break;
         }
                 
-        switch(app->connection[i].state)
-        {
-            case STATE_DISCONNECTED:
-                print("Disconnected");
-                break;
-            case STATE_DISCONNECTING:
-                print("Disconnecting");
-                break;
-            case STATE_CONNECTING:
-                print("Connecting");
-                break;
-            case STATE_CONNECTED:
-                print("Connected");
-                break;
-            case STATE_PAIRING:
-                print("Pairing");
-                break;
-            default:
-                print("Unknown (%d)", app->connection[i].state);
-                break;
-        }
+        print("%s", link_state_name(app->connection[i].state));
+        if (app->connection[i].unexpected)
+            print(", %d unexpected", app->connection[i].unexpected);
         print("\r\n");
     }
     
+    if (app->unexpected)
+        print("%d unexpected events for no link\r\n", app->unexpected);
+    
     return TRUE;
 }
 
@@ -386,7 +644,7 @@ static bool cmd_state(MAIN_APP_T *app, const uint8 *params)
  *
  * @returns Always returns true, as params are ignored.
  */
-static bool cmd_connect(MAIN_APP_T *app, const uint8 *params)
+static bool cmd_connect(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
 {
     bool master = FALSE;
     
@@ -396,9 +654,9 @@ static bool cmd_connect(MAIN_APP_T *app, const uint8 *params)
     
     if (!PARAMS())
         return FALSE;
-    else if ( cmdcmp(params, &params, "Master") == 0 )
+    else if ( cmdcmp(ctx, params, &params, "Master") == 0 )
         master = TRUE;
-    else if ( cmdcmp(params, &params, "Slave") == 0 )
+    else if ( cmdcmp(ctx, params, &params, "Slave") == 0 )
         master = FALSE;
     else
         return FALSE;
@@ -408,29 +666,36 @@ static bool cmd_connect(MAIN_APP_T *app, const uint8 *params)
         /* A master can have up to two slave connections. */
         if (app->role == ROLE_SLAVE)
         {
-            print("ERROR: Already connected as slave.\r\n");
+            print_error(RESULT_NOT_ALLOWED, "Already connected as slave.\r\n");
         }
         else if (app->role == ROLE_MASTER && app->conn_count == MAX_CONNECTIONS)
         {
-            print("ERROR: Already have %d slave connections.", MAX_CONNECTIONS);
+            print_error(RESULT_BUSY, "Already have %d slave connections.\r\n", MAX_CONNECTIONS);
         }
         else /* Either master with only 1 connection or role is NONE. */
         {
-            print("Connecting as Master.\r\n");
-            MessageSend(&app->task, MSG_CONNECT_MASTER, 0);
+            MSG_CONNECT_T *msg = PanicUnlessNew(MSG_CONNECT_T);
+            
+            if (!app->machine) print("Connecting as Master.\r\n");
+            msg->tag = app->tag;
+            MessageSend(&app->task, MSG_CONNECT_MASTER, msg);
         }
     }
     else /* Slave */
     {
         if (app->role == ROLE_NONE)
         {
-            print("Connecting as Slave.\r\n");
-            MessageSend(&app->task, MSG_CONNECT_SLAVE, 0);
+            MSG_CONNECT_T *msg = PanicUnlessNew(MSG_CONNECT_T);
+            
+            if (!app->machine) print("Connecting as Slave.\r\n");
+            msg->tag = app->tag;
+            MessageSend(&app->task, MSG_CONNECT_SLAVE, msg);
         }
         else 
         {
-            print(
-                "ERROR: Already connected as %s.\r\n", 
+            print_error(
+                RESULT_NOT_ALLOWED,
+                "Already connected as %s.\r\n",
                 (app->role == ROLE_SLAVE) ? "slave" : "master"
                 );
         }
@@ -446,16 +711,16 @@ static bool cmd_connect(MAIN_APP_T *app, const uint8 *params)
  *
  * @returns Always returns true, as params are ignored.
  */
-static bool cmd_debug(MAIN_APP_T *app, const uint8 *params)
+static bool cmd_debug(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
 {
     COMMAND_HELP(
             "help debug [on|off]\r\n"
             );
     
        
-    if ( cmdcmp(params, &params, "ON") == 0 )
+    if ( cmdcmp(ctx, params, &params, "ON") == 0 )
         app->debug = TRUE;
-    else if ( cmdcmp(params, &params, "OFF") == 0 )
+    else if ( cmdcmp(ctx, params, &params, "OFF") == 0 )
         app->debug = FALSE;
     else if (PARAMS())
         return FALSE;
@@ -472,7 +737,7 @@ static bool cmd_debug(MAIN_APP_T *app, const uint8 *params)
  *
  * @returns Always returns true, as params are ignored.
  */
-static bool cmd_disconnect(MAIN_APP_T *app, const uint8 *params)
+static bool cmd_disconnect(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
 {
     uint16 link_id;
     MSG_DISCONNECT_T *msg;
@@ -483,12 +748,12 @@ static bool cmd_disconnect(MAIN_APP_T *app, const uint8 *params)
     
     if (!PARAMS()) 
         link_id = 0xFFFF;
-    else if (!cmd_parse_num(params, &params, &link_id)) 
+    else if (!cmd_parse_num(ctx, params, &params, &link_id)) 
         return FALSE;
     
     if (app->conn_count == 0)
     {
-        print("ERROR: No links to disconnect.\r\n");
+        print_error(RESULT_NOT_CONNECTED, "No links to disconnect.\r\n");
         return TRUE;
     }
   
@@ -502,6 +767,7 @@ static bool cmd_disconnect(MAIN_APP_T *app, const uint8 *params)
             {
                 msg = PanicUnlessNew(MSG_DISCONNECT_T);
                 msg->link_id = i;
+                msg->tag = app->tag;
                 MessageSend(&app->task, MSG_DISCONNECT, msg);
             }
         }
@@ -512,16 +778,17 @@ static bool cmd_disconnect(MAIN_APP_T *app, const uint8 *params)
         {
             msg = PanicUnlessNew(MSG_DISCONNECT_T);
             msg->link_id = link_id;
+            msg->tag = app->tag;
             MessageSend(&app->task, MSG_DISCONNECT, msg);
         }
         else
         {
-            print("ERROR: Link %d is not connected.\r\n", link_id);
+            print_error(RESULT_NOT_CONNECTED, "Link %d is not connected.\r\n", link_id);
         }
     }
     else
     {
-        print("ERROR: Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+        print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
     }
     return TRUE;
 
@@ -529,145 +796,958 @@ static bool cmd_disconnect(MAIN_APP_T *app, const uint8 *params)
 
 
 /*!
- * @brief Disconnect RFCOMM link
+ * @brief Send data on one, several or all links.
+ *
+ * The data is decoded straight into the sink of each target link that has room for
+ * it. Only when a link is busy is the data decoded into a tx buffer, which is then
+ * shared by all the busy links, each of which sends it as fast as it can.
  *
  * @param app The application state.
- * @param params RFCOMM link id, a number starting 0 to MAX_CONECTION-1.
+ * @param params Link id, '*' for all connected links or '@' followed by a bit mask
+ * of link ids, then the data to send.
  *
- * @returns Always returns true, as params are ignored.
+ * @returns TRUE if the parameters are valid.
  */
-static bool cmd_tx(MAIN_APP_T *app, const uint8 *params)
+static bool cmd_tx(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
 {
     uint16 link_id;
-    uint8  *s;
+    uint16 mask;
+    bool all = FALSE;
     uint16 len;
+    TX_BUFFER_T *buf = NULL;
     
     COMMAND_HELP(
-            "help tx [link_id] \"string to send\"\r\n"
+            "help tx {link_id|*|@mask} {\"string\"|num|h:hexdigits|b:base64} ...\r\n"
             );
     
-    if (!cmd_parse_num(params, &params, &link_id)) 
+    while (PARAMS() && isblank(*params)) params++;
+    
+    if (PARAMS() && *params == '*')
+    {
+        all = TRUE;
+        mask = ALL_LINKS;
+        params++;
+    }
+    else if (PARAMS() && *params == '@')
+    {
+        if (!cmd_parse_num(ctx, params + 1, &params, &mask))
+            return FALSE;
+    }
+    else if (cmd_parse_num(ctx, params, &params, &link_id))
+    {
+        if (link_id >= MAX_CONNECTIONS)
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+            return TRUE;
+        }
+        mask = 1 << link_id;
+    }
+    else
+    {
         return FALSE;
+    }
     
-    if (!cmd_parse_value(params, &params, &len, &s))
+    /* First pass only checks and measures the data. */
+    if (!cmd_parse_value(ctx, params, NULL, NULL, &len))
         return FALSE;
     
     if (app->conn_count == 0)
     {
-        print("ERROR: No connections.\r\n");
+        print_error(RESULT_NOT_CONNECTED, "No connections.\r\n");
     }
-    else if (link_id < MAX_CONNECTIONS) 
+    else if (!mask || (mask & ~ALL_LINKS))
     {
-        if (app->connection[link_id].state == STATE_CONNECTED)
+        /* A mask with no links would send nothing, and still end with OK. */
+        print_error(RESULT_OUT_OF_RANGE, "Link mask 0x%x is out of range 0x1..0x%x\r\n", mask, ALL_LINKS);
+    }
+    else
+    {
+        for (link_id=0; link_id<MAX_CONNECTIONS; link_id++)
         {
-            uint16 offs;
-            uint8 *data;
-    
-            while ( (SinkSlack(app->connection[link_id].sink)) < len )  
+            if (!(mask & (1 << link_id)))
+                continue;
+            
+            if (app->connection[link_id].state != STATE_CONNECTED)
             {
-                SinkFlush(app->connection[link_id].sink, 1);
+                /* '*' only means the links that are connected. */
+                if (!all) print_error(RESULT_NOT_CONNECTED, "Link %d is not connected.\r\n", link_id);
             }
-    
-            if (
-                (offs = SinkClaim(app->connection[link_id].sink, len)) != 0xffff &&
-                (data = SinkMap(app->connection[link_id].sink))
-                )
-            {
-                memmove(data + offs, s, len);
-                SinkFlush(app->connection[link_id].sink, len);
-            }  
-            else
+            else if (!cmd_tx_direct(app, ctx, link_id, params, len))
             {
-                if (app->debug) print("DBG: Tx SinkClaim or SinkMap failed!\r\n");
+                /* Only data that has to wait for the link goes into a pooled tx buffer. */
+                if (!buf)
+                {
+                    buf = tx_buffer_new(len);
+                    cmd_parse_value(ctx, params, NULL, buf->data, &len);
+                }
+                
+                if (!tx_queue(app, link_id, buf))
+                    print_error(RESULT_FULL, "Link %d tx queue is full.\r\n", link_id);
             }
         }
-        else
-        {
-            print("ERROR: Link %d is not connected.\r\n", link_id);
-        }
-    }
-    else
-    {
-        print("ERROR: Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
     }
 
-    free(s);
+    if (buf) tx_buffer_release(buf);
     return TRUE;
-   
 }
-/*************************************************************************
-
-NAME    
-    command_parse
-    
-DESCRIPTION
-    Parse a command line and run correct handler.
-
-RETURNS
 
-*/
-void command_parse(MAIN_APP_T *app, const uint8 *cmd)
+/*!
+ * @brief Indicate current echo mode, or turn echo on or off.
+ *
+ * In echo mode a slave loops everything received from its master straight back,
+ * which is what the 'ping' command on the master expects.
+ *
+ * @param app The application state.
+ * @param params 'on' or 'off' or no param to report state.
+ *
+ * @returns Always returns true, as params are ignored.
+ */
+static bool cmd_echo(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
 {
-    const uint8 *params = NULL;
-    const uint8 **pparams = &params;
-    bool ok = TRUE;
+    uint16 i;
     
-    /* skip blanks */
-    while (cmd < uart_end && isblank(*cmd)) cmd++;
-
-    if (cmd < uart_end)
+    COMMAND_HELP(
+            "help echo [on|off]\r\n"
+            );
+    
+    if ( cmdcmp(ctx, params, &params, "ON") == 0 )
+        app->echo = TRUE;
+    else if ( cmdcmp(ctx, params, &params, "OFF") == 0 )
+        app->echo = FALSE;
+    else if (PARAMS())
+        return FALSE;
+    else
     {
-#ifdef ENABLE_HELP
-        if (!cmdcmp(cmd, &cmd, "Help"))
-        {
-            /* help for a particular command */
-            if (cmd < uart_end)
-            {
-                /* pparams == NULL means that the handler prints out help */
-                pparams = NULL;
-
-                /* NOTE: COMMAND_HELP(help_message) macro needs to be present
-                 * in the beginning of every command handler. */
-            }
-            
-            /* list all commands */
-            else
-            {
-                print("help State       Get current state\r\n");
-                print("help Connect     Start a master or slave connection\r\n");
-                print("help DEbug       With debug on, extra event data is output\r\n");
-                print("Help Disconnect  Disconnect a link.\r\n");
-                print("help TX          Send data on a specific link.\r\n");
-
-                return;
-            }
-        }
-#endif /* ENABLE_HELP */
-        
-        if (!cmdcmp(cmd, pparams, "State"))
-            ok = cmd_state(app, params);
-
-        else if (!cmdcmp(cmd, pparams, "Connect"))
-            ok = cmd_connect(app, params);
-        
-        else if (!cmdcmp(cmd, pparams, "DEbug"))
-            ok = cmd_debug(app, params);
-
-        else if (!cmdcmp(cmd, pparams, "Disconnect"))
-            ok = cmd_disconnect(app, params);
-        
-        else if (!cmdcmp(cmd, pparams, "TX"))
-            ok = cmd_tx(app, params);
-
-        else
-            print("ERROR: Unknown command.\r\n");
-        
-        if (!ok)
-            print("ERROR: Invalid command parameters.\r\n");
+        print("Echo mode: %s\r\n", (app->echo) ? "On" : "Off");
+        return TRUE;
     }
+    
+    for (i=0; i<MAX_CONNECTIONS; i++)
+        echo_update(app, i);
+    
+    print("Echo mode: %s\r\n", (app->echo) ? "On" : "Off");
+    return TRUE;
 }
 
-
-
+/*!
+ * @brief Measure round trip latency to a slave in echo mode.
+ *
+ * @param app The application state.
+ * @param params RFCOMM link id, optional probe count and optional probe size.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_ping(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 link_id;
+    uint16 count = 10;
+    uint16 size = 32;
+    
+    COMMAND_HELP(
+            "help ping link_id [count] [size]\r\n"
+            );
+    
+    if (!cmd_parse_num(ctx, params, &params, &link_id)) 
+        return FALSE;
+    
+    if (PARAMS() && !cmd_parse_num(ctx, params, &params, &count))
+        return FALSE;
+    
+    if (PARAMS() && !cmd_parse_num(ctx, params, &params, &size))
+        return FALSE;
+    
+    if (count == 0 || count > PING_MAX_COUNT || size == 0 || size > PING_MAX_SIZE)
+    {
+        print_error(RESULT_OUT_OF_RANGE, "count must be 1..%d and size 1..%d\r\n", PING_MAX_COUNT, PING_MAX_SIZE);
+    }
+    else if (app->ping.link_id != NO_ACTIVE)
+    {
+        print_error(RESULT_BUSY, "Already pinging link %d.\r\n", app->ping.link_id);
+    }
+    else if (link_id >= MAX_CONNECTIONS) 
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+    }
+    else if (app->connection[link_id].state != STATE_CONNECTED)
+    {
+        print_error(RESULT_NOT_CONNECTED, "Link %d is not connected.\r\n", link_id);
+    }
+    else
+    {
+        ping_start(app, link_id, count, size);
+    }
+    return TRUE;
+}
+
+#ifdef ENABLE_PROFILE
+/*!
+ * @brief Output the profile of message handling, and start a new one.
+ *
+ * Each dump covers the time since the one before, or since boot.
+ *
+ * @param app The application state.
+ * @param params None.
+ *
+ * @returns Always returns true, as params are ignored.
+ */
+static bool cmd_prof(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    COMMAND_HELP(
+            "help prof\r\n"
+            );
+    
+    prof_report();
+    prof_reset();
+    return TRUE;
+}
+
+#   define COMMAND_PROF(X) \
+    X("PRof",       cmd_prof,       "Output and reset the message handling profile.")
+#else
+#   define COMMAND_PROF(X)
+#endif
+
+/*!
+ * @brief Output the use of the block pools, or start their statistics over.
+ *
+ * @param app The application state.
+ * @param params Nothing, or 'reset'.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_pool(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    COMMAND_HELP(
+            "help pool [reset]\r\n"
+            );
+    
+    if (!PARAMS())
+        pool_report();
+    else if (cmdcmp(ctx, params, &params, "Reset") == 0)
+        pool_reset();
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+/*!
+ * @brief Start or stop sampling the link quality, or output the last samples of
+ * each link, oldest first.
+ *
+ * @param app The application state.
+ * @param params Nothing, 'on' with an optional interval in ms, or 'off'.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_quality(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 interval = QUALITY_INTERVAL;
+    uint16 i;
+    uint16 n;
+
+    COMMAND_HELP(
+            "help quality [on [interval_ms]|off]\r\n"
+            );
+
+    if (PARAMS())
+    {
+        if (cmdcmp(ctx, params, &params, "OFf") == 0)
+        {
+            quality_set(app, 0);
+        }
+        else if (cmdcmp(ctx, params, &params, "ON") == 0)
+        {
+            if (PARAMS() && !cmd_parse_num(ctx, params, &params, &interval))
+                return FALSE;
+
+            if (interval < QUALITY_MIN_INTERVAL)
+                print_error(RESULT_OUT_OF_RANGE, "Interval must be at least %d ms\r\n", QUALITY_MIN_INTERVAL);
+            else
+                quality_set(app, interval);
+        }
+        else
+        {
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    if (app->quality_interval)
+        print("Sampling every %l ms\r\n", (uint32)app->quality_interval);
+    else
+        print("Sampling off\r\n");
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        const CONN_STATE_T *conn = &app->connection[i];
+
+        if (conn->state != STATE_CONNECTED)
+            continue;
+
+        print("Link %d: quality/RSSI:", i);
+
+        for (n=0; n<conn->history_count; n++)
+        {
+            const QUALITY_SAMPLE_T *s = &conn->history[(conn->history_head + n) % QUALITY_HISTORY];
+
+            print(" %d/%d", s->quality, s->rssi);
+        }
+        print("\r\n");
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Run a command on the slave of a link, over its control channel.
+ *
+ * The slave's reply lines are output as "Remote <link_id>: ..." as they arrive, with
+ * the tag of this command.
+ *
+ * @param app The application state.
+ * @param params RFCOMM link id, then the command line for the slave.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_remote(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 link_id;
+    
+    COMMAND_HELP(
+            "help remote link_id command\r\n"
+            );
+    
+    if (!cmd_parse_num(ctx, params, &params, &link_id)) 
+        return FALSE;
+    
+    while (PARAMS() && isblank(*params)) params++;
+    
+    if (!PARAMS())
+        return FALSE;
+    
+    if (app->role != ROLE_MASTER)
+    {
+        print_error(RESULT_NOT_ALLOWED, "Only a master can run remote commands.\r\n");
+    }
+    else if (link_id >= MAX_CONNECTIONS) 
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+    }
+    else if (app->connection[link_id].state != STATE_CONNECTED)
+    {
+        print_error(RESULT_NOT_CONNECTED, "Link %d is not connected.\r\n", link_id);
+    }
+    else if (!app->connection[link_id].ctrl_sink)
+    {
+        print_error(RESULT_NOT_FOUND, "Link %d has no control channel.\r\n", link_id);
+    }
+    else if (!remote_send(app, link_id, params, ctx->end - params))
+    {
+        print_error(RESULT_FULL, "Link %d control channel is full.\r\n", link_id);
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Show or change the routes that forward data from one link to others.
+ *
+ * @param app The application state.
+ * @param params Nothing to list the routes, or the link the data is received on
+ * followed by the link to add, '@' with a mask of links, or 'none'.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_route(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 from;
+    uint16 to;
+    
+    COMMAND_HELP(
+            "help route [from_link {to_link|@mask|none}]\r\n"
+            );
+    
+    if (PARAMS())
+    {
+        if (!cmd_parse_num(ctx, params, &params, &from))
+            return FALSE;
+        
+        if (from >= MAX_CONNECTIONS)
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", from, MAX_CONNECTIONS-1);
+            return TRUE;
+        }
+        
+        if (PARAMS() && *params == '@')
+        {
+            if (!cmd_parse_num(ctx, params + 1, &params, &to))
+                return FALSE;
+        }
+        else if (cmdcmp(ctx, params, &params, "None") == 0)
+        {
+            to = 0;
+        }
+        else if (cmd_parse_num(ctx, params, &params, &to))
+        {
+            if (to >= MAX_CONNECTIONS)
+            {
+                print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", to, MAX_CONNECTIONS-1);
+                return TRUE;
+            }
+            to = app->route[from] | (1 << to);
+        }
+        else
+        {
+            return FALSE;
+        }
+        
+        if (to & ~ALL_LINKS)
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Link mask 0x%x is out of range 0x0..0x%x\r\n", to, ALL_LINKS);
+            return TRUE;
+        }
+        if (to & (1 << from))
+        {
+            print_error(RESULT_NOT_ALLOWED, "Link %d can't be routed to itself.\r\n", from);
+            return TRUE;
+        }
+        
+        app->route[from] = to;
+    }
+    
+    for (from=0; from<MAX_CONNECTIONS; from++)
+    {
+        print("Route %d: ", from);
+        if (!app->route[from])
+        {
+            print("none");
+        }
+        for (to=0; to<MAX_CONNECTIONS; to++)
+        {
+            if (app->route[from] & (1 << to))
+                print("%d ", to);
+        }
+        print("\r\n");
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Show or change the UART high water marks for Rx data.
+ *
+ * Rx data is held back in the RFCOMM source of a link while the UART occupancy is
+ * above the global mark or the mark of that link.
+ *
+ * @param app The application state.
+ * @param params Nothing to show the settings, 'uart' or a link id followed by the
+ * high water mark in bytes.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_flow(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 link_id;
+    uint16 hwm;
+    
+    COMMAND_HELP(
+            "help flow [{uart|link_id} high_water_mark]\r\n"
+            );
+    
+    if (PARAMS())
+    {
+        if (cmdcmp(ctx, params, &params, "Uart") == 0)
+            link_id = NO_ACTIVE;
+        else if (!cmd_parse_num(ctx, params, &params, &link_id))
+            return FALSE;
+        
+        if (!cmd_parse_num(ctx, params, &params, &hwm))
+            return FALSE;
+        
+        if (hwm > app->uart_size)
+            hwm = app->uart_size;
+        
+        if (link_id == NO_ACTIVE)
+        {
+            app->uart_hwm = hwm;
+        }
+        else if (link_id < MAX_CONNECTIONS)
+        {
+            app->connection[link_id].rx_hwm = hwm;
+        }
+        else
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+            return TRUE;
+        }
+        
+        /* A higher mark may let held back data through straight away. */
+        rx_resume(app);
+    }
+    
+    print("UART: size %d, used %d, high water %d, stalls %l\r\n",
+          app->uart_size,
+          app->uart_size - SinkSlack(StreamUartSink()),
+          app->uart_hwm,
+          app->rx_stalls
+          );
+    
+    for (link_id=0; link_id<MAX_CONNECTIONS; link_id++)
+    {
+        CONN_STATE_T *conn = &app->connection[link_id];
+        
+        print("%d: high water %d, weight %d, stalls %l%s\r\n",
+              link_id,
+              (conn->rx_hwm < app->uart_hwm) ? conn->rx_hwm : app->uart_hwm,
+              conn->rx_weight,
+              conn->rx_stalls,
+              (conn->rx_stalled) ? ", stalled" : ""
+              );
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Show or change the RFCOMM frame size the links ask for.
+ *
+ * A new size applies from the next time the link connects. The frame size a link
+ * opens with is the smaller of what the two ends ask for. Larger frames carry less
+ * header per byte, and let the link manager use the multi-slot DH3 and DH5 packets.
+ *
+ * Only the frame size is negotiated. The Connection library can not set the packet
+ * types of a link, so those are left to the link manager, and the output says so.
+ *
+ * @param app The application state.
+ * @param params Nothing to show the settings, or a link id or '*' for all links
+ * followed by the frame size in bytes, 0 for the default.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_frame(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 link_id;
+    uint16 size;
+
+    COMMAND_HELP(
+            "help frame [{link_id|*} size]\r\n"
+            "Sets the RFCOMM frame size only, packet types are left to the link manager.\r\n"
+            );
+
+    if (PARAMS())
+    {
+        while (PARAMS() && isblank(*params)) params++;
+
+        if (PARAMS() && *params == '*')
+        {
+            link_id = NO_ACTIVE;
+            params++;
+        }
+        else if (!cmd_parse_num(ctx, params, &params, &link_id))
+        {
+            return FALSE;
+        }
+
+        if (!cmd_parse_num(ctx, params, &params, &size))
+            return FALSE;
+
+        if (size && (size < FRAME_MIN || size > FRAME_MAX))
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Frame size must be 0 (default) or %d..%d\r\n", FRAME_MIN, FRAME_MAX);
+            return TRUE;
+        }
+        else if (link_id == NO_ACTIVE)
+        {
+            for (link_id=0; link_id<MAX_CONNECTIONS; link_id++)
+                app->connection[link_id].frame_max = size;
+        }
+        else if (link_id < MAX_CONNECTIONS)
+        {
+            app->connection[link_id].frame_max = size;
+        }
+        else
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+            return TRUE;
+        }
+    }
+
+    for (link_id=0; link_id<MAX_CONNECTIONS; link_id++)
+    {
+        CONN_STATE_T *conn = &app->connection[link_id];
+
+        if (conn->frame_max)
+            print("%d: asks for %d", link_id, conn->frame_max);
+        else
+            print("%d: asks for default", link_id);
+
+        if (conn->state == STATE_CONNECTED)
+            print(", open with %d", conn->frame);
+        print("\r\n");
+    }
+    print("Packet types: link manager default\r\n");
+    return TRUE;
+}
+
+/*!
+ * @brief Set the share of UART bandwidth a link gets for its Rx data.
+ *
+ * Each scheduling round a link outputs up to RX_QUANTUM bytes times its weight.
+ *
+ * @param app The application state.
+ * @param params RFCOMM link id and weight 1..RX_MAX_WEIGHT.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_weight(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 link_id;
+    uint16 weight;
+    
+    COMMAND_HELP(
+            "help weight link_id weight\r\n"
+            );
+    
+    if (!cmd_parse_num(ctx, params, &params, &link_id))
+        return FALSE;
+    
+    if (!cmd_parse_num(ctx, params, &params, &weight))
+        return FALSE;
+    
+    if (link_id >= MAX_CONNECTIONS)
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+    }
+    else if (weight == 0 || weight > RX_MAX_WEIGHT)
+    {
+        print_error(RESULT_OUT_OF_RANGE, "Weight must be 1..%d\r\n", RX_MAX_WEIGHT);
+    }
+    else
+    {
+        app->connection[link_id].rx_weight = weight;
+        print("Link %d weight %d\r\n", link_id, weight);
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Show or change how data received on a link is output.
+ *
+ * Text outputs the data as it is, hex and base64 output it in the same h: and b:
+ * forms that 'tx' accepts, so binary data survives the trip. Multiplexer mode is
+ * always binary.
+ *
+ * @param app The application state.
+ * @param params Nothing to show the settings, or a link id followed by 'text', 'hex'
+ * or 'base64'.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_rxenc(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    static const char *const names[] = { "text", "hex", "base64" };
+    uint16 link_id;
+    RX_ENC_ENUM_T enc;
+    
+    COMMAND_HELP(
+            "help rxenc [link_id {text|hex|base64}]\r\n"
+            );
+    
+    if (PARAMS())
+    {
+        if (!cmd_parse_num(ctx, params, &params, &link_id))
+            return FALSE;
+        
+        if (cmdcmp(ctx, params, &params, "Text") == 0)
+            enc = RX_ENC_TEXT;
+        else if (cmdcmp(ctx, params, &params, "Hex") == 0)
+            enc = RX_ENC_HEX;
+        else if (cmdcmp(ctx, params, &params, "Base64") == 0)
+            enc = RX_ENC_BASE64;
+        else
+            return FALSE;
+        
+        if (link_id >= MAX_CONNECTIONS)
+        {
+            print_error(RESULT_OUT_OF_RANGE, "Link id %d is out of range 0..%d\r\n", link_id, MAX_CONNECTIONS-1);
+            return TRUE;
+        }
+        
+        app->connection[link_id].rx_enc = enc;
+    }
+    
+    for (link_id=0; link_id<MAX_CONNECTIONS; link_id++)
+        print("Rx %d: %s\r\n", link_id, names[app->connection[link_id].rx_enc]);
+    
+    return TRUE;
+}
+
+/*!
+ * @brief Switch the UART to multiplexer mode, where each link is its own channel.
+ *
+ * See ui.c for the framing. The host leaves multiplexer mode with a close down
+ * (CLD) message.
+ *
+ * @param app The application state.
+ * @param params None.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_mux(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    COMMAND_HELP(
+            "help mux\r\n"
+            );
+    
+    if (PARAMS())
+        return FALSE;
+    
+    if (!app->mux)
+    {
+        print("Multiplexer mode on.\r\n");
+        app->mux = TRUE;
+    }
+    return TRUE;
+}
+
+/*!
+ * @brief Switch between output for people and output for a host program.
+ *
+ * In machine mode input is not echoed, every command ends with 'OK' or 'E<code>'
+ * (see RESULT_ENUM_T) instead of an error message, and there are no banners. A
+ * connection or disconnection that goes on after its command reports its progress
+ * as 'C<code> <link_id>' (see COMPLETION_ENUM_T), with the tag of the command. The
+ * mode is kept in PS, so a host does not have to set it after every reset.
+ *
+ * @param app The application state.
+ * @param params Nothing to show the mode, 'human' or 'machine' to change it.
+ *
+ * @returns TRUE if the parameters are valid.
+ */
+static bool cmd_mode(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params)
+{
+    uint16 machine;
+    
+    COMMAND_HELP(
+            "help mode [human|machine]\r\n"
+            );
+    
+    if (!PARAMS())
+    {
+        print("Mode: %s\r\n", (app->machine) ? "machine" : "human");
+        return TRUE;
+    }
+    
+    if ( cmdcmp(ctx, params, &params, "Human") == 0 )
+        machine = FALSE;
+    else if ( cmdcmp(ctx, params, &params, "Machine") == 0 )
+        machine = TRUE;
+    else
+        return FALSE;
+    
+    if (PARAMS())
+        return FALSE;
+    
+    app->machine = machine;
+    PsStore(PS_KEY_MODE, &machine, 1);
+    return TRUE;
+}
+
+/*!
+ * @brief Every command, in case insensitive alphabetical order of its name.
+ *
+ * The upper case part of a name is what has to be typed, the lower case part is
+ * optional. Names are at most 11 characters, so the help listing lines up.
+ */
+#define COMMANDS(X) \
+    X("Connect",    cmd_connect,    "Start a master or slave connection.") \
+    X("DEbug",      cmd_debug,      "With debug on, extra event data is output.") \
+    X("Disconnect", cmd_disconnect, "Disconnect a link.") \
+    X("Echo",       cmd_echo,       "Loop received data back to the master.") \
+    X("Flow",       cmd_flow,       "UART high water marks for Rx data.") \
+    X("FRame",      cmd_frame,      "RFCOMM frame size a link asks for.") \
+    X("MOde",       cmd_mode,       "Human or machine (terse, no echo) output.") \
+    X("Mux",        cmd_mux,        "Frame UART traffic per link for a host demultiplexer.") \
+    X("Ping",       cmd_ping,       "Measure round trip latency of a link.") \
+    X("POol",       cmd_pool,       "Use of the buffer pools.") \
+    COMMAND_PROF(X) \
+    X("Quality",    cmd_quality,    "Link quality sampling and history.") \
+    X("REmote",     cmd_remote,     "Run a command on the slave of a link.") \
+    X("Route",      cmd_route,      "Forward data received on a link to other links.") \
+    X("RUn",        cmd_run,        "Run a stored script.") \
+    X("RXenc",      cmd_rxenc,      "Output Rx data as text, hex or base64.") \
+    X("SCript",     cmd_script,     "List, store or delete scripts of commands.") \
+    X("SNiff",      cmd_sniff,      "Put idle links into sniff, or wake a link.") \
+    X("State",      cmd_state,      "Get current state.") \
+    X("TX",         cmd_tx,         "Send data on a specific link.") \
+    X("Weight",     cmd_weight,     "Share of the UART a link gets for Rx data.")
+
+typedef bool (*COMMAND_HANDLER_T)(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *params);
+
+#define COMMAND_NAME(name, handler, help)       name,
+#define COMMAND_HANDLER(name, handler, help)    handler,
+#define COMMAND_SUMMARY(name, handler, help)    help,
+
+static const char *const command_names[] = { COMMANDS(COMMAND_NAME) };
+static const COMMAND_HANDLER_T command_handlers[] = { COMMANDS(COMMAND_HANDLER) };
+
+#define COMMAND_COUNT   (sizeof(command_names) / sizeof(command_names[0]))
+
+#ifdef ENABLE_HELP
+static const char *const command_summaries[] = { COMMANDS(COMMAND_SUMMARY) };
+#endif
+
+/*************************************************************************
+
+NAME    
+    command_run
+    
+DESCRIPTION
+    Run the command on a command line, without its tag.
+
+RETURNS
+
+*/
+static void command_run(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, const uint8 *cmd)
+{
+    const uint8 *params = NULL;
+    const uint8 **pparams = &params;
+    bool ok = TRUE;
+    uint16 i;
+    
+#ifdef ENABLE_HELP
+    if (!cmdcmp(ctx, cmd, &cmd, "Help"))
+    {
+        /* help for a particular command */
+        if (cmd < ctx->end)
+        {
+            /* pparams == NULL means that the handler prints out help */
+            pparams = NULL;
+
+            /* NOTE: COMMAND_HELP(help_message) macro needs to be present
+             * in the beginning of every command handler. */
+        }
+        
+        /* list all commands */
+        else
+        {
+            for (i=0; i<COMMAND_COUNT; i++)
+            {
+                print("help %s%s%s\r\n",
+                      command_names[i],
+                      "            " + strlen(command_names[i]),
+                      command_summaries[i]
+                      );
+            }
+            return;
+        }
+    }
+#endif /* ENABLE_HELP */
+    
+    i = cmdtab_find(command_names, COMMAND_COUNT, cmd, ctx->end, pparams);
+    
+    if (i == CMDTAB_NONE)
+        print_error(RESULT_UNKNOWN_COMMAND, "Unknown command.\r\n");
+    else
+        ok = command_handlers[i](app, ctx, params);
+    
+    if (!ok)
+        print_error(RESULT_INVALID_PARAMS, "Invalid command parameters.\r\n");
+}
+
+#ifdef COMMAND_CHECK
+/*************************************************************************
+
+NAME    
+    command_check
+    
+DESCRIPTION
+    Panic if the command table is not sorted, as a name added out of order
+    would otherwise only make some commands unknown.
+
+RETURNS
+
+*/
+void command_check(void)
+{
+    if (!cmdtab_sorted(command_names, COMMAND_COUNT))
+        Panic();
+}
+#endif /* COMMAND_CHECK */
+
+/*************************************************************************
+
+NAME    
+    command_parse
+    
+DESCRIPTION
+    Parse a command line and run correct handler.
+
+    A line can start with '#tag', a number the host chooses, in which case
+    all output of the command, now and when it completes later, starts
+    with the same '#tag'.
+
+RETURNS
+
+*/
+void command_parse(MAIN_APP_T *app, CMD_CONTEXT_T *ctx)
+{
+    const uint8 *cmd = ctx->buf;
+    const uint8 *end = ctx->end;
+    const uint8 *s;
+    Sink out = print_sink(ctx->out);
+    uint16 old_tag = app->tag;
+    uint16 tag;
+    RESULT_ENUM_T result;
+    bool in_str;
+    
+    /* skip blanks */
+    while (cmd < end && isblank(*cmd)) cmd++;
+
+    if (cmd < end && *cmd == '#')
+    {
+        if (cmd_parse_num(ctx, cmd + 1, &cmd, &tag) && tag != NO_TAG)
+        {
+            while (cmd < end && isblank(*cmd)) cmd++;
+            app->tag = tag;
+        }
+        else
+        {
+            print_error(RESULT_INVALID_PARAMS, "Invalid tag.\r\n");
+            cmd = end;
+        }
+    }
+
+    /* Commands are separated by ';', other than in strings. */
+    while (cmd < end)
+    {
+        for (s = cmd, in_str = FALSE; s < end && (in_str || *s != ';'); s++)
+        {
+            if (*s == '"') in_str = !in_str;
+        }
+        
+        while (cmd < s && isblank(*cmd)) cmd++;
+        
+        if (cmd < s)
+        {
+            /* A script has results of its own, inside that of 'run'. */
+            result = app->result;
+            app->result = RESULT_OK;
+            
+            ctx->end = s;
+            command_run(app, ctx, cmd);
+            
+            if (app->machine && app->result == RESULT_OK)
+                print("OK\r\n");
+            app->result = result;
+        }
+        
+        if (s == end)
+            break;
+        cmd = s + 1;
+    }
+    
+    /* A script runs inside the command that started it. */
+    ctx->end = end;
+    app->tag = old_tag;
+    print_sink(out);
+}
 
 /* End-of-File */
@@ -0,0 +1,190 @@
+/*
+ * cmd_bench - compare command lookup through the sorted command table (cmdtab.c)
+ * with the cmdcmp() chain that command_parse() used to run.
+ *
+ * Uses a set of 50 commands, to see how the two scale as the command set grows.
+ * Every input is looked up both ways and the results must agree.
+ *
+ * Usage: cmd_bench [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "cmdtab.h"
+
+#define isblank_(c)     (c == ' ')
+
+static const char *const names[] = {
+    "Advertise", "Auth", "Bench", "BOnd", "Cancel", "CLass", "Connect", "DEbug",
+    "Disconnect", "DIScover", "Echo", "ENcrypt", "Flow", "FOrget", "Inquiry", "Key",
+    "LAtency", "LInk", "List", "Mode", "Mux", "Name", "Pair", "PIn", "Ping", "POwer",
+    "PRof", "Quality", "Remote", "RESet", "Role", "Route", "Rssi", "RUn", "SCan",
+    "SCRipt", "SEcurity", "SNiff", "State", "STats", "TAg", "TX", "Uart", "UNpair",
+    "Version", "Weight", "WHitelist", "Xtal", "Yield", "Zone"
+};
+
+#define NAME_COUNT      (sizeof(names) / sizeof(names[0]))
+#define MAX_INPUTS      (NAME_COUNT * 3 + 8)
+#define MAX_LINE        32
+
+static char inputs[MAX_INPUTS][MAX_LINE];
+static unsigned input_count;
+
+/* The cmdcmp() of command.c before the table, with the end of line passed in. */
+static int cmdcmp(const uint8 *s, const uint8 *end, const uint8 **endp, const char *cmd)
+{
+    while (s < end && isblank_(*s)) s++;
+
+    if (endp)
+        *endp = s;
+
+    for (; s < end; s++, cmd++)
+    {
+        if (*s != *cmd)
+        {
+            if (isblank_(*s)) break;
+            if ((*s | 0x20) != (*cmd | 0x20)) return *s - *cmd;
+        }
+    }
+
+    if (!*cmd || (*cmd & 0x20))
+    {
+        if (endp)
+        {
+            while (s < end && isblank_(*s)) s++;
+            *endp = s;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static uint16 chain_find(const uint8 *s, const uint8 *end, const uint8 **endp)
+{
+    uint16 i;
+
+    for (i = 0; i < NAME_COUNT; i++)
+    {
+        if (!cmdcmp(s, end, endp, names[i]))
+            return i;
+    }
+    return CMDTAB_NONE;
+}
+
+static void add_input(const char *word, size_t len, const char *params)
+{
+    char *line = inputs[input_count++];
+
+    memcpy(line, word, len);
+    strcpy(line + len, params);
+}
+
+static void make_inputs(void)
+{
+    static const char *const unknown[] = {
+        "x", "zz", "hello 1 2", "abc", "stat", "d", "tx0", "pingpong"
+    };
+    char lower[MAX_LINE];
+    unsigned i, j, mandatory;
+
+    for (i = 0; i < NAME_COUNT; i++)
+    {
+        for (mandatory = 0; isupper((unsigned char)names[i][mandatory]); mandatory++)
+            ;
+
+        for (j = 0; names[i][j]; j++)
+            lower[j] = tolower((unsigned char)names[i][j]);
+
+        add_input(lower, j, "");
+        add_input(lower, mandatory, " 1 \"param\"");
+        add_input(names[i], j, " 0x10");
+    }
+
+    for (i = 0; i < sizeof(unknown) / sizeof(unknown[0]); i++)
+        add_input(unknown[i], strlen(unknown[i]), "");
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench(uint16 (*find)(const uint8 *, const uint8 *, const uint8 **),
+                    unsigned long iterations,
+                    unsigned long *sum)
+{
+    const uint8 *params;
+    unsigned long n;
+    unsigned i;
+    double t = now();
+
+    for (n = 0; n < iterations; n++)
+    {
+        for (i = 0; i < input_count; i++)
+        {
+            const uint8 *s = (const uint8 *)inputs[i];
+            *sum += find(s, s + strlen(inputs[i]), &params);
+        }
+    }
+    return (now() - t) * 1e9 / ((double)iterations * input_count);
+}
+
+static uint16 table_find(const uint8 *s, const uint8 *end, const uint8 **endp)
+{
+    return cmdtab_find(names, NAME_COUNT, s, end, endp);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20000;
+    unsigned long sum = 0;
+    const uint8 *chain_params, *table_params;
+    double chain_ns, table_ns;
+    unsigned i;
+
+    for (i = 1; i < NAME_COUNT; i++)
+    {
+        if (strcasecmp(names[i - 1], names[i]) >= 0)
+        {
+            fprintf(stderr, "cmd_bench: \"%s\" is out of order\n", names[i]);
+            return 1;
+        }
+    }
+
+    make_inputs();
+
+    for (i = 0; i < input_count; i++)
+    {
+        const uint8 *s = (const uint8 *)inputs[i];
+        const uint8 *end = s + strlen(inputs[i]);
+        uint16 chain = chain_find(s, end, &chain_params);
+        uint16 table = table_find(s, end, &table_params);
+
+        if (chain != table || (chain != CMDTAB_NONE && chain_params != table_params))
+        {
+            fprintf(stderr, "cmd_bench: \"%s\" gives %u from the chain and %u from the table\n",
+                    inputs[i], chain, table);
+            return 1;
+        }
+    }
+
+    chain_ns = bench(chain_find, iterations, &sum);
+    table_ns = bench(table_find, iterations, &sum);
+
+    printf("%u commands, %u inputs, %lu iterations (checksum %lu)\n",
+           (unsigned)NAME_COUNT, input_count, iterations, sum);
+    printf("cmdcmp chain: %8.1f ns/lookup\n", chain_ns);
+    printf("cmdtab_find:  %8.1f ns/lookup\n", table_ns);
+    printf("speedup:      %8.1fx\n", chain_ns / table_ns);
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * Host build stand-in for the BlueLab bdaddr.h, implemented by the simulator
+ * (sim/sim_conn.c).
+ */
+
+#ifndef BDADDR_H__
+#define BDADDR_H__
+
+#include <connection.h>
+
+void BdaddrSetZero(bdaddr *addr);
+bool BdaddrIsZero(const bdaddr *addr);
+bool BdaddrIsSame(const bdaddr *first, const bdaddr *second);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Host build stand-in for the BlueLab Connection library, implemented by the
+ * simulator (sim/sim_conn.c).
+ *
+ * Only the messages, fields and calls the application uses are here.
+ */
+
+#ifndef CONNECTION_H__
+#define CONNECTION_H__
+
+#include <message.h>
+
+typedef struct
+{
+    uint32  lap;
+    uint8   uap;
+    uint16  nap;
+} bdaddr;
+
+typedef enum
+{
+    success,
+    fail,
+    rfcomm_connect_pending = 0x10,
+    rfcomm_connect_rejected
+} connection_lib_status;
+
+typedef enum { inquiry_status_result, inquiry_status_ready } inquiry_status;
+typedef enum { hci_success, hci_error_conn_timeout = 8 } hci_status;
+typedef enum { protocol_l2cap, protocol_rfcomm } dm_protocol_id;
+typedef enum { sec4_in_level_1 } dm_security_level_in;
+typedef enum { sec4_out_level_1 } dm_security_level_out;
+typedef enum { hci_scan_enable_off, hci_scan_enable_inq_and_page = 3 } hci_scan_enable;
+typedef enum { cl_sm_io_cap_no_input_no_output = 3 } cl_sm_io_capability;
+typedef enum { lp_active, lp_sniff, lp_passive } lp_power_mode;
+
+typedef struct
+{
+    lp_power_mode   state;
+    uint16          min_interval;
+    uint16          max_interval;
+    uint16          attempt;
+    uint16          timeout;
+    uint16          time;
+} lp_power_table;
+
+typedef struct
+{
+    uint16  max_payload_size;
+    uint8   modem_signal;
+    uint8   break_signal;
+    uint16  msc_timeout;
+} rfcomm_config_params;
+
+#define CL_MESSAGE_BASE 0x5000
+
+enum
+{
+    CL_INIT_CFM = CL_MESSAGE_BASE,
+    CL_DM_LOCAL_BD_ADDR_CFM,
+    CL_DM_LOCAL_NAME_COMPLETE,
+    CL_RFCOMM_REGISTER_CFM,
+    CL_SDP_REGISTER_CFM,
+    CL_SDP_UNREGISTER_CFM,
+    CL_SM_REMOTE_IO_CAPABILITY_IND,
+    CL_SM_IO_CAPABILITY_REQ_IND,
+    CL_SM_AUTHORISE_IND,
+    CL_RFCOMM_CONNECT_IND,
+    CL_RFCOMM_SERVER_CONNECT_CFM,
+    CL_DM_INQUIRE_RESULT,
+    CL_SM_REGISTER_OUTGOING_SERVICE_CFM,
+    CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM,
+    CL_RFCOMM_CLIENT_CONNECT_CFM,
+    CL_DM_ACL_OPENED_IND,
+    CL_RFCOMM_DISCONNECT_CFM,
+    CL_RFCOMM_DISCONNECT_IND,
+    CL_DM_ACL_CLOSED_IND,
+    CL_SM_AUTHENTICATE_CFM,
+    CL_RFCOMM_CONTROL_IND,
+    CL_RFCOMM_LINE_STATUS_IND,
+    CL_SM_ENCRYPTION_KEY_REFRESH_IND,
+    CL_SM_ENCRYPTION_CHANGE_IND,
+    CL_DM_MODE_CHANGE_EVENT,
+    CL_DM_RSSI_CFM,
+    CL_DM_LINK_QUALITY_CFM
+};
+
+typedef struct { connection_lib_status status; } CL_INIT_CFM_T;
+typedef struct { hci_status status; bdaddr bd_addr; } CL_DM_LOCAL_BD_ADDR_CFM_T;
+typedef struct { hci_status status; uint16 size_local_name; uint8 local_name[1]; } CL_DM_LOCAL_NAME_COMPLETE_T;
+typedef struct { connection_lib_status status; uint8 server_channel; } CL_RFCOMM_REGISTER_CFM_T;
+typedef struct { connection_lib_status status; uint32 service_handle; } CL_SDP_REGISTER_CFM_T;
+typedef struct { connection_lib_status status; uint32 service_handle; } CL_SDP_UNREGISTER_CFM_T;
+typedef struct { bdaddr bd_addr; uint16 authentication_requirements; uint16 io_capability; } CL_SM_REMOTE_IO_CAPABILITY_IND_T;
+typedef struct { bdaddr bd_addr; } CL_SM_IO_CAPABILITY_REQ_IND_T;
+typedef struct { bdaddr bd_addr; dm_protocol_id protocol_id; uint32 channel; bool incoming; } CL_SM_AUTHORISE_IND_T;
+typedef struct { bdaddr bd_addr; uint8 server_channel; uint16 frame_size; Sink sink; } CL_RFCOMM_CONNECT_IND_T;
+typedef struct { connection_lib_status status; uint8 server_channel; uint16 payload_size; Sink sink; } CL_RFCOMM_SERVER_CONNECT_CFM_T;
+typedef struct { inquiry_status status; bdaddr bd_addr; uint32 dev_class; } CL_DM_INQUIRE_RESULT_T;
+typedef struct { bdaddr bd_addr; uint16 security_channel; } CL_SM_REGISTER_OUTGOING_SERVICE_CFM_T;
+typedef struct { connection_lib_status status; uint16 size_attributes; bdaddr bd_addr; uint8 attributes[1]; } CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T;
+typedef struct { connection_lib_status status; uint8 server_channel; uint16 payload_size; Sink sink; } CL_RFCOMM_CLIENT_CONNECT_CFM_T;
+typedef struct { bdaddr bd_addr; bool incoming; hci_status status; } CL_DM_ACL_OPENED_IND_T;
+typedef struct { connection_lib_status status; Sink sink; } CL_RFCOMM_DISCONNECT_CFM_T;
+typedef struct { connection_lib_status status; Sink sink; } CL_RFCOMM_DISCONNECT_IND_T;
+typedef struct { bdaddr bd_addr; hci_status status; } CL_DM_ACL_CLOSED_IND_T;
+typedef struct { bdaddr bd_addr; hci_status status; uint16 key_type; bool bonded; } CL_SM_AUTHENTICATE_CFM_T;
+typedef struct { Sink sink; uint16 break_signal; uint16 modem_signal; } CL_RFCOMM_CONTROL_IND_T;
+typedef struct { Sink sink; bool error; uint16 line_status; } CL_RFCOMM_LINE_STATUS_IND_T;
+typedef struct { bdaddr bd_addr; lp_power_mode mode; uint16 interval; } CL_DM_MODE_CHANGE_EVENT_T;
+typedef struct { hci_status status; int16 rssi; Sink sink; } CL_DM_RSSI_CFM_T;
+typedef struct { hci_status status; uint8 link_quality; Sink sink; } CL_DM_LINK_QUALITY_CFM_T;
+
+void ConnectionInit(Task theAppTask);
+void ConnectionReadLocalAddr(Task theAppTask);
+void ConnectionReadLocalName(Task theAppTask);
+void ConnectionWriteClassOfDevice(uint32 cod);
+void ConnectionWriteScanEnable(hci_scan_enable mode);
+
+void ConnectionRfcommAllocateChannel(Task theAppTask, uint8 suggested_server_channel);
+void ConnectionRfcommConnectRequest(Task theAppTask, const bdaddr *bd_addr,
+                                    uint16 security_channel, uint8 remote_server_channel,
+                                    const rfcomm_config_params *config);
+void ConnectionRfcommConnectResponse(Task theAppTask, bool response, Sink sink,
+                                     uint8 local_server_channel,
+                                     const rfcomm_config_params *config);
+void ConnectionRfcommDisconnectRequest(Task theAppTask, Sink sink);
+void ConnectionRfcommDisconnectResponse(Sink sink);
+
+void ConnectionRegisterServiceRecord(Task theAppTask, uint16 num_rec_bytes,
+                                     const uint8 *service_record);
+void ConnectionUnregisterServiceRecord(Task theAppTask, uint32 service_record_hdl);
+void ConnectionSdpServiceSearchAttributeRequest(Task theAppTask, const bdaddr *addr,
+                                                uint16 max_num_recs,
+                                                uint16 size_srch_pttrn,
+                                                const uint8 *srch_pttrn,
+                                                uint16 size_attr_list,
+                                                const uint8 *attr_list);
+
+void ConnectionInquire(Task theAppTask, uint32 inquiry_lap, uint8 max_responses,
+                       uint8 timeout, uint32 class_of_device);
+
+void ConnectionSmRegisterIncomingService(dm_protocol_id protocol_id, uint32 channel,
+                                         dm_security_level_in security_level);
+void ConnectionSmRegisterOutgoingService(Task theAppTask, const bdaddr *bd_addr,
+                                         dm_protocol_id protocol_id, uint32 remote_channel,
+                                         dm_security_level_out security_level);
+void ConnectionSmSetSdpSecurityIn(bool enable);
+void ConnectionSmIoCapabilityResponse(const bdaddr *bd_addr, cl_sm_io_capability io_capability,
+                                      bool force_mitm, bool bonding, bool oob_data_present,
+                                      uint8 *oob_hash_c, uint8 *oob_rand_r);
+void ConnectionSmAuthoriseResponse(const bdaddr *bd_addr, dm_protocol_id protocol_id,
+                                   uint32 channel, bool incoming, bool authorised);
+
+void ConnectionSetLinkPolicy(Sink sink, uint16 size_power_table,
+                             const lp_power_table *power_table);
+void ConnectionGetRssi(Task theAppTask, Sink sink);
+void ConnectionGetLinkQuality(Task theAppTask, Sink sink);
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Host build stand-in for the BlueLab csrtypes.h, for firmware sources that are
+ * built into the host tools.
+ */
+
+#ifndef CSRTYPES_H__
+#define CSRTYPES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t     uint8;
+typedef uint16_t    uint16;
+typedef uint32_t    uint32;
+typedef int8_t      int8;
+typedef int16_t     int16;
+typedef int32_t     int32;
+typedef unsigned    bool;
+
+#define TRUE    1
+#define FALSE   0
+
+#endif
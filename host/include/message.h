@@ -0,0 +1,40 @@
+/*
+ * Host build stand-in for the BlueLab message.h, implemented by the simulator
+ * (sim/sim_message.c).
+ */
+
+#ifndef MESSAGE_H__
+#define MESSAGE_H__
+
+#include <csrtypes.h>
+
+typedef struct __SINK *Sink;
+typedef struct __SOURCE *Source;
+
+typedef uint16 MessageId;
+typedef const void *Message;
+
+typedef struct TaskData *Task;
+typedef struct TaskData
+{
+    void (*handler)(Task task, MessageId id, Message message);
+} TaskData;
+
+void MessageSend(Task task, MessageId id, void *message);
+void MessageSendLater(Task task, MessageId id, void *message, uint32 delay);
+uint16 MessageCancelAll(Task task, MessageId id);
+bool MessageCancelFirst(Task task, MessageId id);
+uint16 MessagesPendingForTask(Task task, int32 *first_due);
+void MessageLoop(void);
+Task MessageSinkTask(Sink sink, Task task);
+
+#define SYSTEM_MESSAGE_BASE_    0x8000
+#define MESSAGE_MORE_DATA       (SYSTEM_MESSAGE_BASE_ + 1)
+#define MESSAGE_MORE_SPACE      (SYSTEM_MESSAGE_BASE_ + 2)
+#define MESSAGE_SOURCE_EMPTY    (SYSTEM_MESSAGE_BASE_ + 3)
+
+typedef struct { Source source; } MessageMoreData;
+typedef struct { Sink sink; } MessageMoreSpace;
+typedef struct { Source source; } MessageSourceEmpty;
+
+#endif
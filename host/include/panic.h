@@ -0,0 +1,17 @@
+/*
+ * Host build stand-in for the BlueLab panic.h, implemented by the simulator
+ * (sim/sim_message.c).
+ */
+
+#ifndef PANIC_H__
+#define PANIC_H__
+
+#include <csrtypes.h>
+
+void Panic(void);
+void *PanicNull(void *p);
+void *PanicUnlessMalloc(size_t size);
+
+#define PanicUnlessNew(T)   ((T *)PanicUnlessMalloc(sizeof(T)))
+
+#endif
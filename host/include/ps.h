@@ -0,0 +1,14 @@
+/*
+ * Host build stand-in for the BlueLab ps.h, implemented by the simulator
+ * (sim/sim_ps.c).
+ */
+
+#ifndef PS_H__
+#define PS_H__
+
+#include <csrtypes.h>
+
+uint16 PsStore(uint16 key, const void *buff, uint16 words);
+uint16 PsRetrieve(uint16 key, void *buff, uint16 words);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host build stand-in for the BlueLab sdp_parse.h, implemented by the simulator
+ * (sim/sim_conn.c).
+ */
+
+#ifndef SDP_PARSE_H__
+#define SDP_PARSE_H__
+
+#include <csrtypes.h>
+
+bool SdpParseInsertRfcommServerChannel(uint16 size_service_record,
+                                       uint8 *service_record,
+                                       uint8 chan);
+bool SdpParseGetMultipleRfcommServerChannels(uint16 size_service_record,
+                                             uint8 *service_record,
+                                             uint8 size_chans,
+                                             uint8 **chans,
+                                             uint8 *chans_found);
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Host build stand-in for the BlueLab sink.h, implemented by the simulator
+ * (sim/sim_stream.c).
+ */
+
+#ifndef SINK_H__
+#define SINK_H__
+
+#include <message.h>
+
+#define VM_SINK_MESSAGES    1
+
+#define VM_MESSAGES_ALL     0
+#define VM_MESSAGES_SOME    1
+#define VM_MESSAGES_NONE    0xffff
+
+uint16 SinkSlack(Sink sink);
+uint16 SinkClaim(Sink sink, uint16 extra);
+uint8 *SinkMap(Sink sink);
+bool SinkFlush(Sink sink, uint16 amount);
+bool SinkConfigure(Sink sink, uint16 key, uint16 value);
+bool SinkIsValid(Sink sink);
+bool SinkClose(Sink sink);
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Host build stand-in for the BlueLab source.h, implemented by the simulator
+ * (sim/sim_stream.c).
+ */
+
+#ifndef SOURCE_H__
+#define SOURCE_H__
+
+#include <message.h>
+
+uint16 SourceSize(Source source);
+const uint8 *SourceMap(Source source);
+void SourceDrop(Source source, uint16 amount);
+uint16 SourceBoundary(Source source);
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * Host build stand-in for the BlueLab stream.h, implemented by the simulator
+ * (sim/sim_stream.c).
+ */
+
+#ifndef STREAM_H__
+#define STREAM_H__
+
+#include <message.h>
+
+Sink StreamUartSink(void);
+Source StreamSourceFromSink(Sink sink);
+Sink StreamSinkFromSource(Source source);
+bool StreamConnect(Source source, Sink sink);
+void StreamDisconnect(Source source, Sink sink);
+
+#endif
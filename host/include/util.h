@@ -0,0 +1,13 @@
+/*
+ * Host build stand-in for the BlueLab util.h, implemented by the simulator
+ * (sim/sim_conn.c).
+ */
+
+#ifndef UTIL_H__
+#define UTIL_H__
+
+#include <csrtypes.h>
+
+const uint8 *UtilGetNumber(const uint8 *start, const uint8 *end, uint16 *result);
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Host build stand-in for the BlueLab vm.h, implemented by the simulator
+ * (sim/sim_message.c).
+ */
+
+#ifndef VM_H__
+#define VM_H__
+
+#include <csrtypes.h>
+
+uint32 VmGetClock(void);
+uint32 VmGetTimerTime(void);
+
+#endif
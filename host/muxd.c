@@ -0,0 +1,611 @@
+/*!
+ * @file muxd.c
+ *
+ * @brief Host demultiplexer for the UART multiplexer mode.
+ *
+ * Switches the module into multiplexer mode (the 'mux' command) and then exposes the
+ * command line and every link as its own pseudo terminal, so existing per device
+ * software can open a link as if it was a serial port:
+ *
+ *     <dir>/ctl     command line (DLCI 0)
+ *     <dir>/link0   link 0 (DLCI 1)
+ *     <dir>/link1   link 1 (DLCI 2)
+ *     ...
+ *
+ * Flow control works both ways. When the module sends an MSC with the FC bit for a
+ * link, nothing more is read from that pty until the FC bit is cleared. When a pty
+ * reader is too slow, the module is sent an MSC to stop that link's Rx data.
+ *
+ * The framing is described in ui.c.
+ *
+ * Usage: muxd [-b baud] [-n links] [-d dir] [-v] device
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define MUX_FLAG        0xF9
+#define MUX_EA          0x01
+#define MUX_CR          0x02
+#define MUX_PF          0x10
+#define MUX_UIH         0xEF
+#define MUX_UI          0x03
+#define MUX_MAX_INFO    127
+#define MUX_OVERHEAD    6
+#define MUX_GOOD_FCS    0xCF
+
+#define MUX_MSC_CMD     0xE3
+#define MUX_MSC_RSP     0xE1
+#define MUX_CLD_CMD     0xC3
+#define MUX_CLD_RSP     0xC1
+#define MUX_V24_FC      0x02
+
+/*!
+ * @brief Largest number of channels, the command line plus up to seven links.
+ */
+#define MAX_CHANNELS    8
+
+/*!
+ * @brief Data buffered for a pty reader before the link is flow controlled.
+ */
+#define CHAN_BUF        4096
+
+/*!
+ * @brief A pty for one DLCI.
+ */
+typedef struct
+{
+    int             fd;             /* pty master */
+    int             slave_fd;       /* kept open so the master never sees a hangup */
+    char            path[256];      /* symlink to the pty slave */
+    unsigned char   out[CHAN_BUF];  /* data the pty reader has not taken yet */
+    size_t          out_len;
+    unsigned char   line[MUX_MAX_INFO]; /* command line being typed, DLCI 0 only */
+    size_t          line_len;
+    int             remote_stopped; /* module asked us to stop sending */
+    int             local_stopped;  /* we asked the module to stop sending */
+} channel_t;
+
+static channel_t chan[MAX_CHANNELS];
+static int nchan;
+static int serial_fd = -1;
+static int verbose;
+static volatile sig_atomic_t done;
+
+static unsigned char rx[CHAN_BUF];
+static size_t rx_len;
+
+/*************************************************************************
+NAME
+    mux_crc
+
+DESCRIPTION
+    Run the 07.10 CRC-8 (reversed polynomial 0xE0) over some octets.
+
+RETURNS
+    The updated CRC, start with 0xFF.
+*/
+static unsigned char mux_crc(unsigned char crc, const unsigned char *p, size_t len)
+{
+    int i;
+
+    while (len--)
+    {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xE0) : (crc >> 1);
+    }
+    return crc;
+}
+
+/*************************************************************************
+NAME
+    serial_write
+
+DESCRIPTION
+    Write all of a buffer to the serial port.
+
+RETURNS
+
+*/
+static void serial_write(const unsigned char *p, size_t len)
+{
+    ssize_t n;
+
+    while (len)
+    {
+        n = write(serial_fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("muxd: serial write");
+            exit(1);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+/*************************************************************************
+NAME
+    mux_frame
+
+DESCRIPTION
+    Send a frame to the module. We are the initiator, so C/R is set.
+
+RETURNS
+
+*/
+static void mux_frame(int dlci, unsigned char ctrl, const unsigned char *info, size_t len)
+{
+    unsigned char frame[MUX_OVERHEAD + MUX_MAX_INFO];
+
+    frame[0] = MUX_FLAG;
+    frame[1] = (unsigned char)((dlci << 2) | MUX_CR | MUX_EA);
+    frame[2] = ctrl;
+    frame[3] = (unsigned char)((len << 1) | MUX_EA);
+    memcpy(&frame[4], info, len);
+    frame[4 + len] = 0xFF - mux_crc(0xFF, &frame[1], 3);
+    frame[5 + len] = MUX_FLAG;
+
+    serial_write(frame, MUX_OVERHEAD + len);
+}
+
+/*************************************************************************
+NAME
+    mux_msc
+
+DESCRIPTION
+    Ask the module to stop or resume Rx data for a link.
+
+RETURNS
+
+*/
+static void mux_msc(int dlci, int stop)
+{
+    unsigned char msc[4];
+
+    msc[0] = MUX_MSC_CMD;
+    msc[1] = (2 << 1) | MUX_EA;
+    msc[2] = (unsigned char)((dlci << 2) | MUX_CR | MUX_EA);
+    msc[3] = (stop) ? (MUX_V24_FC | MUX_EA) : MUX_EA;
+
+    mux_frame(0, MUX_UI, msc, 4);
+}
+
+/*************************************************************************
+NAME
+    chan_drain
+
+DESCRIPTION
+    Write buffered data to a pty reader, resuming the link once most of
+    it has gone.
+
+RETURNS
+
+*/
+static void chan_drain(int dlci)
+{
+    channel_t *c = &chan[dlci];
+    ssize_t n;
+
+    if (c->out_len)
+    {
+        n = write(c->fd, c->out, c->out_len);
+        if (n > 0)
+        {
+            memmove(c->out, c->out + n, c->out_len - n);
+            c->out_len -= n;
+        }
+    }
+
+    if (dlci && c->local_stopped && c->out_len < CHAN_BUF / 4)
+    {
+        c->local_stopped = 0;
+        mux_msc(dlci, 0);
+    }
+}
+
+/*************************************************************************
+NAME
+    chan_write
+
+DESCRIPTION
+    Pass data from the module to a pty reader, stopping the link while
+    the reader falls behind.
+
+RETURNS
+
+*/
+static void chan_write(int dlci, const unsigned char *p, size_t len)
+{
+    channel_t *c = &chan[dlci];
+
+    if (len > CHAN_BUF - c->out_len)
+    {
+        fprintf(stderr, "muxd: channel %d overrun, %zu bytes lost\n",
+                dlci, len - (CHAN_BUF - c->out_len));
+        len = CHAN_BUF - c->out_len;
+    }
+
+    memcpy(c->out + c->out_len, p, len);
+    c->out_len += len;
+    chan_drain(dlci);
+
+    if (dlci && !c->local_stopped && c->out_len > CHAN_BUF / 2)
+    {
+        c->local_stopped = 1;
+        mux_msc(dlci, 1);
+    }
+}
+
+/*************************************************************************
+NAME
+    mux_input
+
+DESCRIPTION
+    Dispatch a frame from the module.
+
+RETURNS
+
+*/
+static void mux_input(int dlci, unsigned char ctrl, const unsigned char *info, size_t len)
+{
+    if (dlci == 0 && ctrl == MUX_UI)
+    {
+        if (len >= 4 && info[0] == MUX_MSC_CMD)
+        {
+            int link = info[2] >> 2;
+
+            if (link > 0 && link < nchan)
+                chan[link].remote_stopped = (info[3] & MUX_V24_FC) != 0;
+        }
+        else if (len >= 1 && info[0] == MUX_CLD_RSP)
+        {
+            done = 1;
+        }
+    }
+    else if (dlci < nchan)
+    {
+        chan_write(dlci, info, len);
+    }
+    else if (verbose)
+    {
+        fprintf(stderr, "muxd: frame for unknown DLCI %d\n", dlci);
+    }
+}
+
+/*************************************************************************
+NAME
+    mux_deframe
+
+DESCRIPTION
+    Take complete frames out of the serial receive buffer.
+
+RETURNS
+
+*/
+static void mux_deframe(void)
+{
+    size_t skip;
+    size_t info_len;
+
+    for (;;)
+    {
+        if (!rx_len)
+            return;
+
+        if (rx[0] != MUX_FLAG)
+        {
+            /* Text before the first frame, e.g. the echo of the mux command. */
+            for (skip = 1; skip < rx_len && rx[skip] != MUX_FLAG; skip++)
+                ;
+            if (verbose)
+                fwrite(rx, 1, skip, stderr);
+        }
+        else if (rx_len > 1 && rx[1] == MUX_FLAG)
+        {
+            skip = 1;
+        }
+        else if (rx_len < MUX_OVERHEAD)
+        {
+            return;
+        }
+        else if (!(rx[1] & MUX_EA) || !(rx[3] & MUX_EA))
+        {
+            skip = 1;
+        }
+        else
+        {
+            info_len = rx[3] >> 1;
+            if (rx_len < MUX_OVERHEAD + info_len)
+                return;
+
+            if (
+                rx[5 + info_len] != MUX_FLAG ||
+                mux_crc(mux_crc(0xFF, &rx[1], 3), &rx[4 + info_len], 1) != MUX_GOOD_FCS
+                )
+            {
+                if (verbose)
+                    fprintf(stderr, "muxd: bad frame\n");
+                skip = 1;
+            }
+            else
+            {
+                mux_input(rx[1] >> 2, rx[2] & ~MUX_PF, &rx[4], info_len);
+                skip = 5 + info_len;
+            }
+        }
+
+        memmove(rx, rx + skip, rx_len - skip);
+        rx_len -= skip;
+    }
+}
+
+/*************************************************************************
+NAME
+    chan_read
+
+DESCRIPTION
+    Pass data from a pty writer to the module. The command line is sent a
+    line at a time, as the module runs every DLCI 0 frame as a command.
+
+RETURNS
+
+*/
+static void chan_read(int dlci)
+{
+    channel_t *c = &chan[dlci];
+    unsigned char buf[MUX_MAX_INFO];
+    ssize_t n;
+    ssize_t i;
+
+    n = read(c->fd, buf, sizeof(buf));
+    if (n <= 0)
+        return;
+
+    if (dlci)
+    {
+        mux_frame(dlci, MUX_UIH, buf, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (buf[i] == '\r' || buf[i] == '\n')
+        {
+            if (c->line_len)
+                mux_frame(0, MUX_UIH, c->line, c->line_len);
+            c->line_len = 0;
+        }
+        else if (c->line_len < sizeof(c->line))
+        {
+            c->line[c->line_len++] = buf[i];
+        }
+    }
+}
+
+/*************************************************************************
+NAME
+    open_serial
+
+DESCRIPTION
+    Open the serial port to the module in raw mode.
+
+RETURNS
+    File descriptor.
+*/
+static int open_serial(const char *path, speed_t speed)
+{
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || tcgetattr(fd, &tio) < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cflag |= CLOCAL | CREAD;
+
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    return fd;
+}
+
+/*************************************************************************
+NAME
+    open_pty
+
+DESCRIPTION
+    Create the pty for a DLCI and link it into the pty directory.
+
+RETURNS
+
+*/
+static void open_pty(int dlci, const char *dir, const char *name)
+{
+    channel_t *c = &chan[dlci];
+    struct termios tio;
+    const char *slave;
+
+    if (
+        (c->fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+        grantpt(c->fd) < 0 ||
+        unlockpt(c->fd) < 0 ||
+        !(slave = ptsname(c->fd)) ||
+        (c->slave_fd = open(slave, O_RDWR | O_NOCTTY)) < 0
+        )
+    {
+        perror("muxd: pty");
+        exit(1);
+    }
+
+    /* Binary data must pass through untouched. */
+    tcgetattr(c->slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(c->slave_fd, TCSANOW, &tio);
+
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+    snprintf(c->path, sizeof(c->path), "%s/%s", dir, name);
+    unlink(c->path);
+    if (symlink(slave, c->path) < 0)
+    {
+        perror(c->path);
+        exit(1);
+    }
+
+    printf("%s -> %s\n", c->path, slave);
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    done = 1;
+}
+
+static speed_t baud_to_speed(long baud)
+{
+    switch (baud)
+    {
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+        case 460800:    return B460800;
+        case 921600:    return B921600;
+    }
+    fprintf(stderr, "muxd: unsupported baud rate %ld\n", baud);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned char cld[2] = { MUX_CLD_CMD, MUX_EA };
+    struct pollfd pfd[1 + MAX_CHANNELS];
+    const char *dir = "/tmp/rfcomm-multi";
+    speed_t speed = B115200;
+    int links = 2;
+    char name[16];
+    ssize_t n;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "b:n:d:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': speed = baud_to_speed(strtol(optarg, NULL, 10)); break;
+            case 'n': links = atoi(optarg); break;
+            case 'd': dir = optarg; break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: muxd [-b baud] [-n links] [-d dir] [-v] device\n");
+                return 2;
+        }
+    }
+
+    if (optind != argc - 1 || links < 1 || links >= MAX_CHANNELS)
+    {
+        fprintf(stderr, "usage: muxd [-b baud] [-n links 1..%d] [-d dir] [-v] device\n",
+                MAX_CHANNELS - 1);
+        return 2;
+    }
+
+    serial_fd = open_serial(argv[optind], speed);
+    nchan = links + 1;
+
+    mkdir(dir, 0755);
+    open_pty(0, dir, "ctl");
+    for (i = 1; i < nchan; i++)
+    {
+        snprintf(name, sizeof(name), "link%d", i - 1);
+        open_pty(i, dir, name);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGHUP, on_signal);
+
+    /* Abandon any partly typed line, then switch to multiplexer mode. */
+    serial_write((const unsigned char *)"\rmux\r", 5);
+
+    while (!done)
+    {
+        pfd[0].fd = serial_fd;
+        pfd[0].events = POLLIN;
+
+        for (i = 0; i < nchan; i++)
+        {
+            pfd[1 + i].fd = chan[i].fd;
+            pfd[1 + i].events = 0;
+            if (!chan[i].remote_stopped)
+                pfd[1 + i].events |= POLLIN;
+            if (chan[i].out_len)
+                pfd[1 + i].events |= POLLOUT;
+        }
+
+        if (poll(pfd, 1 + nchan, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("muxd: poll");
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN)
+        {
+            n = read(serial_fd, rx + rx_len, sizeof(rx) - rx_len);
+            if (n <= 0)
+            {
+                fprintf(stderr, "muxd: serial port closed\n");
+                break;
+            }
+            rx_len += n;
+            mux_deframe();
+
+            /* A full buffer that is not a frame is never going to become one. */
+            if (rx_len == sizeof(rx))
+                rx_len = 0;
+        }
+
+        for (i = 0; i < nchan; i++)
+        {
+            if (pfd[1 + i].revents & POLLOUT)
+                chan_drain(i);
+            if (pfd[1 + i].revents & POLLIN)
+                chan_read(i);
+        }
+    }
+
+    /* Leave the module in text mode. */
+    mux_frame(0, MUX_UI, cld, sizeof(cld));
+
+    for (i = 0; i < nchan; i++)
+        unlink(chan[i].path);
+
+    return 0;
+}
+
+/* End-of-File */
@@ -0,0 +1,519 @@
+/*!
+ * @file sim.h
+ *
+ * @brief Host simulator of the BlueLab VM, interfaces between its parts.
+ *
+ * The firmware sources are built unmodified against the stand-in headers in
+ * host/include. The simulator provides what is behind them:
+ *
+ * - sim_message.c  message queue, timers, MessageLoop(), Panic and the VM clock.
+ * - sim_stream.c   sinks and sources: the UART (a pty, or stdin and stdout) and the
+ *                  two ends of every RFCOMM channel, and the radio link model that
+ *                  carries RFCOMM data between them.
+ * - sim_conn.c     the Connection library, and the simulated peer devices of the
+ *                  virtual piconet, or the other modules.
+ * - sim_node.c     many modules at once, a thread each, on a shared virtual clock.
+ * - sim_trace.c    recording what the application gets, and replaying it.
+ * - sim_ps.c       persistent store, optionally kept in a file.
+ *
+ * Time is virtual: it jumps from one event to the next, so a run depends only on
+ * its input, options and random seed, and minutes of simulated time take a moment.
+ * With -r it follows the wall clock instead, for use from a terminal.
+ *
+ * With several modules, everything a module has of its own is SIM_LOCAL, like the
+ * firmware's state is NODE_LOCAL, and its thread only sees its own.
+ */
+
+#ifndef SIM_H__
+#define SIM_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <connection.h>
+
+/*!
+ * @brief Storage class of the simulator state of a module.
+ */
+#define SIM_LOCAL       __thread
+
+/*!
+ * @brief Simulation time, in microseconds.
+ */
+typedef uint64_t sim_time;
+
+#define SIM_NEVER       ((sim_time)-1)
+#define SIM_MS(ms)      ((sim_time)(ms) * 1000)
+
+/*!
+ * @brief Size of the UART sink and source buffers.
+ */
+#define SIM_UART_BUFFER     1024
+
+/*!
+ * @brief Size of the sink and source buffers at each end of an RFCOMM channel.
+ */
+#define SIM_RFCOMM_BUFFER   1024
+
+/*!
+ * @brief Maximum number of simulated peer devices.
+ */
+#define SIM_MAX_PEERS       8
+
+/*!
+ * @brief Maximum RFCOMM credit window.
+ */
+#define SIM_MAX_CREDITS     32
+
+/*!
+ * @brief Radio link to a peer device, an ACL. Its channels share its bandwidth.
+ */
+typedef struct
+{
+    uint32      rate;           /* bits per second */
+    sim_time    latency;        /* from the end of a packet to its delivery */
+    uint16      loss;           /* chance of a packet being lost, in 1/65536 */
+    sim_time    busy_until;     /* end of the last packet sent */
+    sim_time    outage_start;   /* peer out of range from... */
+    sim_time    outage_end;     /* ...until, SIM_NEVER for good */
+    uint16      sniff;          /* sniff interval in slots, 0 in active mode */
+    sim_time    anchor;         /* a sniff anchor, from which the others follow */
+
+    uint32      packets;
+    uint32      retries;        /* packets sent again after being lost */
+} sim_link;
+
+/*!
+ * @brief Kind of stream end point.
+ */
+typedef enum
+{
+    SIM_EP_UART,
+    SIM_EP_RFCOMM
+} sim_ep_type;
+
+/*!
+ * @brief One end of a stream.
+ *
+ * The Sink and the Source of an end point are the same object, so that
+ * StreamSourceFromSink() is a cast. Data flushed into the sink of an RFCOMM end
+ * point turns up in the source of its peer.
+ */
+typedef struct sim_ep
+{
+    sim_ep_type     type;
+    bool            open;
+    struct sim_ep  *peer;           /* other end of an RFCOMM channel */
+    struct sim_ep  *connect;        /* sink this source is StreamConnect()ed to */
+    struct sim_ep  *connect_from;   /* source StreamConnect()ed to this sink */
+    Task            task;           /* gets MESSAGE_MORE_DATA and MESSAGE_MORE_SPACE */
+    bool            more_data;      /* MESSAGE_MORE_DATA is queued */
+    bool            more_space;     /* MESSAGE_MORE_SPACE is queued */
+
+    uint8          *tx;             /* flushed data, then claimed data */
+    uint16          tx_size;
+    uint16          tx_queued;
+    uint16          tx_claimed;
+
+    uint8          *rx;
+    uint16          rx_size;
+    uint16          rx_len;
+
+    uint8           server_channel; /* RFCOMM: server channel of the slave end */
+    void           *owner;          /* RFCOMM: sim_conn.c state of the channel */
+    struct sim_node *node;          /* module it belongs to, NULL with one module */
+
+    sim_link       *link;           /* RFCOMM: the ACL the channel is on */
+    uint16          frame;          /* RFCOMM: largest packet */
+    uint16          credits;        /* RFCOMM: packets the other end has room for */
+    uint16          rx_frames[SIM_MAX_CREDITS]; /* sizes of the packets in rx */
+    uint16          rx_head;
+    uint16          rx_count;
+    uint16          rx_used;        /* dropped from the first packet in rx */
+} sim_ep;
+
+#define SIM_EP(s)       ((sim_ep *)(void *)(s))
+#define SIM_SINK(ep)    ((Sink)(void *)(ep))
+#define SIM_SOURCE(ep)  ((Source)(void *)(ep))
+
+/*!
+ * @brief A message waiting to be delivered.
+ *
+ * Messages due at the same time are delivered in the order of the module that
+ * sent them, and then in the order it sent them in, so that the order does not
+ * depend on which thread got there first.
+ */
+typedef struct sim_msg
+{
+    struct sim_msg *next;
+    Task            task;
+    MessageId       id;
+    void           *payload;
+    sim_time        due;
+    uint16          src;        /* module that sent it */
+    uint32          seq;        /* messages it sent before */
+} sim_msg;
+
+/*!
+ * @brief A module, when there are several.
+ */
+typedef struct sim_node
+{
+    uint16          index;
+    bdaddr          addr;
+    const char     *script;     /* its UART input */
+    size_t          script_len;
+    pthread_t       thread;
+    pthread_mutex_t lock;       /* of the inbox */
+    sim_msg        *inbox;      /* messages from other modules */
+    uint32          messages;   /* delivered, when it has finished */
+} sim_node;
+
+/* sim_message.c */
+
+/*!
+ * @brief Output on stderr, with the simulation time, when running with -v.
+ */
+void sim_log(const char *fmt, ...);
+
+/*!
+ * @brief Time since the simulation started.
+ */
+sim_time sim_clock(void);
+
+/*!
+ * @brief Milliseconds since the simulation started.
+ */
+uint32 sim_now(void);
+
+/*!
+ * @brief Queue a message to be delivered at a given time.
+ */
+void sim_send_at(Task task, MessageId id, void *message, sim_time due);
+
+/*!
+ * @brief Make a message from this module, to be queued here or at another one.
+ */
+sim_msg *sim_msg_new(Task task, MessageId id, void *message, sim_time due);
+
+/*!
+ * @brief Queue a message made by sim_msg_new() here or at another module.
+ */
+void sim_msg_queue(sim_msg *m);
+
+/*!
+ * @brief When the next thing happens: a message is due or the input resumes.
+ */
+sim_time sim_next(void);
+
+/*!
+ * @brief Deliver every message due before the given time, feeding the UART input
+ * as it comes.
+ */
+void sim_run_until(sim_time end);
+
+/*!
+ * @brief The message being handled busy waits until the given time.
+ */
+void sim_spin_until(sim_time t);
+
+/*!
+ * @brief Stop the simulation after this many more milliseconds.
+ */
+void sim_stop_after(uint32 ms);
+
+/*!
+ * @brief Seed the random numbers of this module.
+ */
+void sim_seed(uint32 seed);
+
+/*!
+ * @brief Next random number, from 0 to 0xFFFF.
+ */
+uint16 sim_random(void);
+
+/*!
+ * @brief Log on stderr, set by -v.
+ */
+extern int sim_verbose;
+
+/*!
+ * @brief Time follows the wall clock, set by -r.
+ */
+extern bool sim_realtime;
+
+/*!
+ * @brief Milliseconds to keep running after the end of the input, set by -e.
+ */
+extern uint32 sim_linger;
+
+/*!
+ * @brief Seed of the random numbers, set by -S. Each module gets its own from it.
+ */
+extern uint32 sim_seed_base;
+
+/*!
+ * @brief Messages delivered to this module.
+ */
+extern SIM_LOCAL uint32 sim_messages;
+
+/* sim_stream.c */
+
+/*!
+ * @brief Create a stream end point.
+ */
+sim_ep *sim_ep_new(sim_ep_type type, uint16 size);
+
+/*!
+ * @brief Join two RFCOMM end points into a channel.
+ */
+void sim_ep_pair(sim_ep *a, sim_ep *b);
+
+/*!
+ * @brief Close both ends of a channel. Data in flight is lost.
+ */
+void sim_ep_close(sim_ep *ep);
+
+/*!
+ * @brief Use these file descriptors as the UART. -1 for out_fd drops the output.
+ */
+void sim_uart_open(int in_fd, int out_fd);
+
+/*!
+ * @brief Take the UART input from memory instead, which is not copied.
+ */
+void sim_uart_script(const char *text, size_t len);
+
+/*!
+ * @brief Called before a message is delivered, to clear the queued flags of the end
+ * point it is about.
+ */
+void sim_stream_delivered(MessageId id, Message message);
+
+/*!
+ * @brief Move UART input into the UART source, a line at a time. An input line
+ * '@<ms>' is not passed on, but holds back the lines after it for that long.
+ *
+ * Without -r this waits for a complete line, so that when the input is a pipe
+ * its timing does not matter.
+ *
+ * @returns TRUE if there was input.
+ */
+bool sim_uart_feed(void);
+
+/*!
+ * @brief Time the input resumes after an '@<ms>' line, SIM_NEVER if it is not held.
+ */
+sim_time sim_uart_resume(void);
+
+/*!
+ * @brief The input has ended and all of it has been fed.
+ */
+bool sim_uart_ended(void);
+
+/*!
+ * @brief With -r, wait for UART input until the wall clock gets to the given time.
+ */
+void sim_uart_wait(sim_time until);
+
+/*!
+ * @brief Write out what is left in the UART sink, at the end of the simulation.
+ */
+void sim_uart_close(void);
+
+/*!
+ * @brief UART bit rate, 0 for no limit. Set by -u.
+ */
+extern uint32 sim_uart_baud;
+
+/*!
+ * @brief Data has come in for an end point: the UART input, or a packet on a
+ * channel.
+ *
+ * @returns FALSE if it is closed, or has no room for the data.
+ */
+bool sim_ep_receive(sim_ep *ep, const uint8 *data, uint16 len);
+
+/*!
+ * @brief Bytes flushed into sinks by this module.
+ */
+extern SIM_LOCAL uint32 sim_out_bytes;
+
+/*!
+ * @brief Give an RFCOMM end point its link, frame size and credits.
+ */
+void sim_ep_link(sim_ep *ep, sim_link *link, uint16 frame, uint16 credits);
+
+/*!
+ * @brief Time the UART output was held up by the firmware busy waiting for space.
+ */
+extern SIM_LOCAL sim_time sim_uart_spin;
+
+/* sim_conn.c */
+
+/*!
+ * @brief Peer device roles, from the point of view of the peer.
+ */
+typedef enum
+{
+    SIM_PEER_SLAVE,     /* discoverable, the application connects to it */
+    SIM_PEER_MASTER     /* connects to the application when it is a slave */
+} sim_peer_role;
+
+/*!
+ * @brief What a peer device does with the data it gets.
+ */
+typedef enum
+{
+    SIM_PEER_ECHO,      /* loops it back */
+    SIM_PEER_SINK,      /* drops it */
+    SIM_PEER_TALK       /* drops it, and sends a line every SIM_TALK_INTERVAL */
+} sim_peer_behaviour;
+
+/*!
+ * @brief Add a peer device to the virtual piconet.
+ *
+ * @returns FALSE if there are SIM_MAX_PEERS already.
+ */
+bool sim_peer_add(sim_peer_role role, sim_peer_behaviour behaviour);
+
+/*!
+ * @brief Take a peer out of range from at_ms, for for_ms (0 for good). Its link is
+ * lost if that is longer than the link supervision timeout.
+ *
+ * @returns FALSE if there is no such peer.
+ */
+bool sim_peer_outage(uint16 index, uint32 at_ms, uint32 for_ms);
+
+/*!
+ * @brief Log link statistics of every peer.
+ */
+void sim_peer_stats(void);
+
+/*!
+ * @brief Link parameters given to every peer, set by -b, -L and -x.
+ */
+extern sim_link sim_link_default;
+
+/*!
+ * @brief RFCOMM credit window of every channel, set by -w.
+ */
+extern uint16 sim_credits;
+
+/*!
+ * @brief Link supervision timeout in milliseconds, set by -T.
+ */
+extern uint32 sim_supervision;
+
+/*!
+ * @brief Handler of the messages modules send each other about their links.
+ */
+extern TaskData sim_module_task;
+
+/* sim_node.c */
+
+/*!
+ * @brief Add count modules, all with the UART input in script_path.
+ *
+ * @returns FALSE if the file can not be read.
+ */
+bool sim_node_add(uint16 count, const char *script_path);
+
+/*!
+ * @brief Run the modules until end_ms, on up to cores threads at once, with the
+ * UART output of each in out_dir (if not NULL). Does not return.
+ */
+void sim_node_run(uint16 cores, uint32 end_ms, const char *out_dir);
+
+/*!
+ * @brief MessageLoop() of a module when there are several. Does not return.
+ */
+void sim_node_loop(void);
+
+/*!
+ * @brief Queue a message for a task of another module, or of this one. Messages
+ * between modules take at least the link latency, which is what lets the modules
+ * run side by side.
+ */
+void sim_post(sim_node *node, Task task, MessageId id, void *message, sim_time due);
+
+/*!
+ * @brief Find a module by its address.
+ *
+ * @returns The module, or NULL.
+ */
+sim_node *sim_node_find(const bdaddr *addr);
+
+/*!
+ * @brief Number of modules, 0 for one on its own with simulated peers.
+ */
+extern uint16 sim_node_count;
+
+/*!
+ * @brief All of them.
+ */
+extern sim_node *sim_nodes;
+
+/*!
+ * @brief The module this thread runs.
+ */
+extern SIM_LOCAL sim_node *sim_self;
+
+/* sim_trace.c */
+
+/*!
+ * @brief Record a trace into a file, set by -R.
+ */
+void sim_trace_record(const char *path);
+
+/*!
+ * @brief Replay a trace from a file instead of simulating the Connection library,
+ * set by -P.
+ */
+void sim_trace_replay(const char *path);
+
+/*!
+ * @brief The task of the application, which ConnectionInit() is given.
+ */
+void sim_trace_app(Task task);
+
+/*!
+ * @brief Deliver a message, recording it or timing its handler.
+ */
+void sim_trace_deliver(sim_msg *m);
+
+/*!
+ * @brief Record data in for an end point of the application.
+ */
+void sim_trace_input(sim_ep *ep, const uint8 *data, uint16 len);
+
+/*!
+ * @brief A message of the simulated Connection library is not sent during a replay.
+ *
+ * @returns TRUE if it is to be dropped.
+ */
+bool sim_trace_drop(MessageId id);
+
+/*!
+ * @brief The replay has got to the end of the trace, or there is none.
+ */
+bool sim_trace_ended(void);
+
+/*!
+ * @brief Finish the trace file, or report on the replay.
+ */
+void sim_trace_close(void);
+
+/*!
+ * @brief A trace is being recorded or replayed.
+ */
+extern bool sim_tracing;
+
+/* sim_ps.c */
+
+/*!
+ * @brief Keep the persistent store in a file, loading what is in it.
+ */
+void sim_ps_open(const char *path);
+
+#endif
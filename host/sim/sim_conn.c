@@ -0,0 +1,1632 @@
+/*!
+ * @file sim_conn.c
+ *
+ * @brief Simulated Connection library, and the peer devices of the virtual piconet.
+ *
+ * There is no radio: the Connection library answers the application from what it
+ * knows about the peers, with a short delay where the real one would have to go to
+ * the air. A peer is a task of its own, with the far end of each of its RFCOMM
+ * channels, and does with the data what its behaviour says.
+ *
+ * Slave peers are found by ConnectionInquire() and offer the same service as the
+ * application, with a data channel (SIM_PEER_DATA_CHANNEL) and a control channel
+ * (SIM_PEER_CTRL_CHANNEL), which answers every command line it gets. Master peers
+ * connect to the application while it is page scanning with a service record
+ * registered, and then open its control channel, as a master running the
+ * application would.
+ *
+ * Every peer has its own link, with the rate, latency and loss given to the
+ * simulator, which its channels share. A peer can be taken out of range: if that
+ * lasts for the link supervision timeout, its channels and its ACL are lost. The
+ * RSSI and link quality a link reports go down with its loss, to nothing while it
+ * is out of range.
+ *
+ * A channel opens with the smaller of the RFCOMM frame sizes its two ends ask for,
+ * 127 bytes for an end that does not ask. A peer takes up to SIM_PEER_FRAME bytes,
+ * and a master peer asks for that much.
+ *
+ * With several modules there are no peers: the modules find and connect to each
+ * other. Whatever one module asks of another goes as a message to sim_module_task
+ * there, which answers the same way, after at least the link latency. The links
+ * between two modules are one each way, and can not be taken out of range.
+ *
+ * Security is not simulated: links are never authenticated or encrypted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bdaddr.h>
+#include <connection.h>
+#include <panic.h>
+#include <sdp_parse.h>
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+#include <util.h>
+
+#include "sim.h"
+
+/* Server channels of a slave peer. */
+#define SIM_PEER_DATA_CHANNEL   1
+#define SIM_PEER_CTRL_CHANNEL   2
+
+/* Milliseconds between the lines of a talking peer. */
+#define SIM_TALK_INTERVAL       100
+
+/* Longest control channel line a slave peer answers. */
+#define SIM_CTRL_LINE           80
+
+/* RFCOMM frame size of a channel when the application does not ask for one. */
+#define SIM_FRAME_SIZE          127
+
+/* Largest RFCOMM frame size a peer takes, and the size a master peer asks for. */
+#define SIM_PEER_FRAME          990
+
+/* Milliseconds for a link to change to or from sniff once asked to. */
+#define SIM_MODE_DELAY          10
+
+/* RSSI in dB below the golden receive power range of a link that loses every packet. */
+#define SIM_RSSI_FLOOR          40
+
+/* Time to give up paging a peer that is out of range. */
+#define SIM_PAGE_TIMEOUT        5120
+
+/* Time a module waits for the application of another to answer a connection. */
+#define SIM_CONNECT_TIMEOUT     10000
+
+/* Longest inquiry response backoff, in 625 us slots. */
+#define SIM_INQUIRY_BACKOFF     1024
+
+/* Messages of a peer task to itself. */
+enum
+{
+    SIM_MSG_CONNECT = 0x7000,   /* master: connect to the application */
+    SIM_MSG_CTRL_CONNECT,       /* master: open the control channel */
+    SIM_MSG_TALK,               /* send the next line */
+    SIM_MSG_ACL_CLOSE,          /* close the ACL if no channel uses it */
+    SIM_MSG_OUTAGE,             /* out of range */
+    SIM_MSG_LINK_LOSS           /* link supervision timeout */
+};
+
+/* Messages between modules, and of a module to itself. */
+enum
+{
+    SIM_MOD_INQUIRY = 0x7200,   /* looking for modules to connect to */
+    SIM_MOD_INQUIRY_RSP,        /* found one */
+    SIM_MOD_INQUIRY_END,        /* inquiry timeout */
+    SIM_MOD_SDP_REQ,            /* service search */
+    SIM_MOD_SDP_RSP,            /* its result */
+    SIM_MOD_CONNECT_REQ,        /* connect to a server channel */
+    SIM_MOD_CONNECT_RSP,        /* accepted or not */
+    SIM_MOD_CONNECT_TIMEOUT,    /* the application never answered */
+    SIM_MOD_CLOSE,              /* the other end has gone */
+    SIM_MOD_ACL_CLOSE,          /* close the ACL if no channel uses it */
+    SIM_MOD_MODE                /* the link goes to or out of sniff */
+};
+
+typedef struct
+{
+    uint16  from;           /* module it is from */
+    uint8   channel;        /* server channel */
+    bool    ok;
+    sim_ep *ep;             /* end point at the module it is for */
+    sim_ep *from_ep;        /* end point at the module it is from */
+    uint16  frame;          /* RFCOMM frame size asked for, or agreed on */
+    uint16  interval;       /* sniff interval in slots, 0 for active mode */
+    uint16  size;
+    uint8   data[1];        /* service record */
+} SIM_MOD_MSG_T;
+
+/*!
+ * @brief sim_conn.c state of a channel between modules.
+ */
+typedef struct
+{
+    uint16  remote;         /* module at the other end */
+    bool    pending;        /* the connection has not been answered yet */
+    bool    acl;            /* counted in acl_refs */
+} sim_chan;
+
+/*!
+ * @brief A simulated peer device.
+ */
+typedef struct
+{
+    TaskData            task;
+    uint16              index;
+    sim_peer_role       role;
+    sim_peer_behaviour  behaviour;
+    bdaddr              addr;
+    bool                acl;            /* ACL to the application is up */
+    sim_ep             *data;           /* peer end of the data channel */
+    sim_ep             *ctrl;           /* peer end of the control channel */
+    uint8               ctrl_channel;   /* master: control channel of the application */
+    uint8               line[SIM_CTRL_LINE];
+    uint16              line_len;
+    uint16              talk_count;
+    sim_link            link;
+} sim_peer;
+
+static SIM_LOCAL sim_peer peers[SIM_MAX_PEERS];
+static SIM_LOCAL uint16 peer_count;
+
+static SIM_LOCAL Task app_task;
+static SIM_LOCAL uint8 next_channel = 1;
+static SIM_LOCAL bool page_scan;
+
+static SIM_LOCAL uint8 *record;
+static SIM_LOCAL uint16 record_size;
+static SIM_LOCAL uint32 record_handle;
+
+/* With several modules: the link to each other module, the channels on the ACL
+ * to it and if it is up, and what is left of an inquiry.
+ */
+static SIM_LOCAL sim_link *links;
+static SIM_LOCAL uint16 *acl_refs;
+static SIM_LOCAL bool *acl_up;
+static SIM_LOCAL uint8 inquiry_left;
+static SIM_LOCAL uint32 inquiry_cod;
+
+static void module_handler(Task task, MessageId id, Message message);
+
+TaskData sim_module_task = { module_handler };
+
+sim_link sim_link_default = { 723000, 5000, 0, 0, SIM_NEVER, SIM_NEVER, 0, 0, 0, 0 };
+uint16 sim_credits = 7;
+uint32 sim_supervision = 20000;
+
+static const bdaddr local_addr = { 0x000001, 0x5B, 0x0002 };
+static const char local_name[] = "Multi-Slave sim";
+
+/*************************************************************************
+NAME
+    msg_new
+
+DESCRIPTION
+    Allocate a message, for messages with a variable size part.
+
+RETURNS
+    The zeroed message.
+*/
+static void *msg_new(size_t size)
+{
+    return PanicNull(calloc(1, size));
+}
+
+#define MSG_NEW(T)  ((T *)msg_new(sizeof(T)))
+
+/*************************************************************************
+NAME
+    peer_find
+
+DESCRIPTION
+    Find a peer by its address.
+
+RETURNS
+    The peer, or NULL.
+*/
+static sim_peer *peer_find(const bdaddr *addr)
+{
+    uint16 i;
+
+    for (i=0; i<peer_count; i++)
+    {
+        if (BdaddrIsSame(&peers[i].addr, addr))
+            return &peers[i];
+    }
+    return NULL;
+}
+
+/*************************************************************************
+NAME
+    peer_reachable
+
+DESCRIPTION
+    Check that a peer is in range.
+
+RETURNS
+    TRUE if it is.
+*/
+static bool peer_reachable(const sim_peer *peer)
+{
+    sim_time now = sim_clock();
+
+    return now < peer->link.outage_start || now >= peer->link.outage_end;
+}
+
+/*************************************************************************
+NAME
+    frame_size
+
+DESCRIPTION
+    Get the RFCOMM frame size the application asks for.
+
+RETURNS
+    The size in the configuration, or the default size.
+*/
+static uint16 frame_size(const rfcomm_config_params *config)
+{
+    return (config && config->max_payload_size) ? config->max_payload_size : SIM_FRAME_SIZE;
+}
+
+/*************************************************************************
+NAME
+    record_channel
+
+DESCRIPTION
+    Find a uint8 after the given three bytes in the registered service
+    record, e.g. the server channel after the RFCOMM UUID.
+
+RETURNS
+    The value, or 0 if it is not there.
+*/
+static uint8 record_channel(uint8 a, uint8 b, uint8 c)
+{
+    uint16 i;
+
+    for (i=0; record && i+4 < record_size; i++)
+    {
+        if (record[i] == a && record[i+1] == b && record[i+2] == c && record[i+3] == 0x08)
+            return record[i+4];
+    }
+    return 0;
+}
+
+/*************************************************************************
+NAME
+    channel_open
+
+DESCRIPTION
+    Create an RFCOMM channel between the application and a peer, with the
+    given frame size. The application end goes to the application task, the
+    peer end to the peer.
+
+RETURNS
+    The application end.
+*/
+static sim_ep *channel_open(sim_peer *peer, uint8 server_channel, bool ctrl, uint16 frame)
+{
+    sim_ep *app_ep = sim_ep_new(SIM_EP_RFCOMM, SIM_RFCOMM_BUFFER);
+    sim_ep *peer_ep = sim_ep_new(SIM_EP_RFCOMM, SIM_RFCOMM_BUFFER);
+
+    sim_ep_pair(app_ep, peer_ep);
+    sim_ep_link(app_ep, &peer->link, frame, sim_credits);
+    sim_ep_link(peer_ep, &peer->link, frame, sim_credits);
+    app_ep->task = app_task;
+    app_ep->owner = peer;
+    app_ep->server_channel = server_channel;
+    peer_ep->task = &peer->task;
+    peer_ep->owner = peer;
+    peer_ep->server_channel = server_channel;
+
+    if (ctrl)
+    {
+        peer->ctrl = peer_ep;
+        peer->line_len = 0;
+    }
+    else
+    {
+        peer->data = peer_ep;
+
+        if (peer->behaviour == SIM_PEER_ECHO)
+            StreamConnect(SIM_SOURCE(peer_ep), SIM_SINK(peer_ep));
+        else if (peer->behaviour == SIM_PEER_TALK)
+            MessageSendLater(&peer->task, SIM_MSG_TALK, 0, SIM_TALK_INTERVAL);
+    }
+
+    sim_log("peer %u: %s channel %u open", peer->index, ctrl ? "control" : "data",
+            server_channel);
+    return app_ep;
+}
+
+/*************************************************************************
+NAME
+    acl_open
+
+DESCRIPTION
+    Bring up the ACL to a peer, if it is not up already.
+
+RETURNS
+
+*/
+static void acl_open(sim_peer *peer, bool incoming)
+{
+    CL_DM_ACL_OPENED_IND_T *m;
+
+    if (peer->acl)
+        return;
+
+    peer->acl = TRUE;
+    m = MSG_NEW(CL_DM_ACL_OPENED_IND_T);
+    m->bd_addr = peer->addr;
+    m->incoming = incoming;
+    m->status = hci_success;
+    MessageSend(app_task, CL_DM_ACL_OPENED_IND, m);
+}
+
+/*************************************************************************
+NAME
+    peer_write
+
+DESCRIPTION
+    Send text from a peer on one of its channels, as far as it fits.
+
+RETURNS
+
+*/
+static void peer_write(sim_ep *ep, const char *text, uint16 len)
+{
+    uint16 off;
+
+    if (!ep || !SinkIsValid(SIM_SINK(ep)))
+        return;
+
+    if (len > SinkSlack(SIM_SINK(ep)))
+        len = SinkSlack(SIM_SINK(ep));
+
+    if (!len || (off = SinkClaim(SIM_SINK(ep), len)) == 0xFFFF)
+        return;
+
+    memmove(SinkMap(SIM_SINK(ep)) + off, text, len);
+    SinkFlush(SIM_SINK(ep), len);
+}
+
+/*************************************************************************
+NAME
+    peer_ctrl_data
+
+DESCRIPTION
+    Control channel data for a peer. A slave answers each command line,
+    with the '#tag ' the line starts with in front, as the application
+    would; a master only logs what its slave replies.
+
+RETURNS
+
+*/
+static void peer_ctrl_data(sim_peer *peer, Source src)
+{
+    const uint8 *data = SourceMap(src);
+    uint16 len = SourceSize(src);
+    uint16 i;
+
+    for (i=0; data && i<len; i++)
+    {
+        char reply[SIM_CTRL_LINE + 32];
+        int n;
+
+        if (data[i] != '\r' && data[i] != '\n')
+        {
+            if (peer->line_len < SIM_CTRL_LINE)
+                peer->line[peer->line_len++] = data[i];
+            continue;
+        }
+        if (!peer->line_len)
+            continue;
+
+        if (peer->role == SIM_PEER_SLAVE)
+        {
+            uint16 tag_len = 0;
+
+            if (peer->line[0] == '#')
+            {
+                while (tag_len < peer->line_len && peer->line[tag_len++] != ' ')
+                    ;
+            }
+            n = sprintf(reply, "%.*sPeer %u: %.*s\r\n", (int)tag_len, (const char *)peer->line,
+                        peer->index, (int)(peer->line_len - tag_len),
+                        (const char *)peer->line + tag_len);
+            peer_write(peer->ctrl, reply, (uint16)n);
+        }
+        sim_log("peer %u: control %.*s", peer->index, (int)peer->line_len,
+                (const char *)peer->line);
+        peer->line_len = 0;
+    }
+    SourceDrop(src, len);
+}
+
+/*************************************************************************
+NAME
+    link_loss
+
+DESCRIPTION
+    The link supervision timeout of a peer has expired: its channels go,
+    then its ACL.
+
+RETURNS
+
+*/
+static void link_loss(sim_peer *peer)
+{
+    sim_ep **eps[2];
+    CL_DM_ACL_CLOSED_IND_T *acl;
+    uint16 i;
+
+    if (!peer->acl)
+        return;
+
+    eps[0] = &peer->ctrl;
+    eps[1] = &peer->data;
+
+    for (i=0; i<2; i++)
+    {
+        sim_ep *ep = *eps[i];
+
+        if (ep && ep->peer)
+        {
+            CL_RFCOMM_DISCONNECT_IND_T *m = MSG_NEW(CL_RFCOMM_DISCONNECT_IND_T);
+
+            m->status = fail;
+            m->sink = SIM_SINK(ep->peer);
+            MessageSend(app_task, CL_RFCOMM_DISCONNECT_IND, m);
+            sim_ep_close(ep);
+        }
+        *eps[i] = NULL;
+    }
+    MessageCancelAll(&peer->task, SIM_MSG_TALK);
+
+    peer->acl = FALSE;
+    peer->link.sniff = 0;
+    acl = MSG_NEW(CL_DM_ACL_CLOSED_IND_T);
+    acl->bd_addr = peer->addr;
+    acl->status = hci_error_conn_timeout;
+    MessageSend(app_task, CL_DM_ACL_CLOSED_IND, acl);
+
+    sim_log("peer %u: link supervision timeout", peer->index);
+}
+
+/*************************************************************************
+NAME
+    peer_handler
+
+DESCRIPTION
+    Message handler of a peer task.
+
+RETURNS
+
+*/
+static void peer_handler(Task task, MessageId id, Message message)
+{
+    sim_peer *peer = (sim_peer *)task;
+
+    switch (id)
+    {
+        case MESSAGE_MORE_DATA:
+        {
+            Source src = ((const MessageMoreData *)message)->source;
+
+            if (peer->ctrl && src == SIM_SOURCE(peer->ctrl))
+                peer_ctrl_data(peer, src);
+            else
+                SourceDrop(src, SourceSize(src));
+            break;
+        }
+
+        case MESSAGE_MORE_SPACE:
+            break;
+
+        case SIM_MSG_CONNECT:
+        {
+            CL_RFCOMM_CONNECT_IND_T *m;
+            uint8 channel = record_channel(0x19, 0x00, 0x03);
+
+            /* The application stopped scanning, or the peer got another link. */
+            if (!page_scan || !channel || peer->acl || !peer_reachable(peer))
+                break;
+
+            peer->ctrl_channel = record_channel(0x09, 0x02, 0x00);
+            acl_open(peer, TRUE);
+
+            m = MSG_NEW(CL_RFCOMM_CONNECT_IND_T);
+            m->bd_addr = peer->addr;
+            m->server_channel = channel;
+            m->frame_size = SIM_PEER_FRAME;
+            m->sink = SIM_SINK(channel_open(peer, channel, FALSE, SIM_PEER_FRAME));
+            MessageSend(app_task, CL_RFCOMM_CONNECT_IND, m);
+            break;
+        }
+
+        case SIM_MSG_CTRL_CONNECT:
+        {
+            CL_RFCOMM_CONNECT_IND_T *m;
+
+            if (!peer->data || !SinkIsValid(SIM_SINK(peer->data)) || peer->ctrl ||
+                !peer_reachable(peer))
+                break;
+
+            m = MSG_NEW(CL_RFCOMM_CONNECT_IND_T);
+            m->bd_addr = peer->addr;
+            m->server_channel = peer->ctrl_channel;
+            m->frame_size = SIM_PEER_FRAME;
+            m->sink = SIM_SINK(channel_open(peer, peer->ctrl_channel, TRUE, SIM_PEER_FRAME));
+            MessageSend(app_task, CL_RFCOMM_CONNECT_IND, m);
+            break;
+        }
+
+        case SIM_MSG_TALK:
+            if (peer->data && SinkIsValid(SIM_SINK(peer->data)))
+            {
+                char line[40];
+                int n = sprintf(line, "Peer %u line %u\r\n", peer->index,
+                                peer->talk_count++);
+
+                peer_write(peer->data, line, (uint16)n);
+                MessageSendLater(&peer->task, SIM_MSG_TALK, 0, SIM_TALK_INTERVAL);
+            }
+            break;
+
+        case SIM_MSG_ACL_CLOSE:
+            if (peer->acl && !peer->data && !peer->ctrl)
+            {
+                CL_DM_ACL_CLOSED_IND_T *m = MSG_NEW(CL_DM_ACL_CLOSED_IND_T);
+
+                peer->acl = FALSE;
+                peer->link.sniff = 0;
+                m->bd_addr = peer->addr;
+                m->status = hci_success;
+                MessageSend(app_task, CL_DM_ACL_CLOSED_IND, m);
+                sim_log("peer %u: ACL closed", peer->index);
+            }
+            break;
+
+        case SIM_MSG_OUTAGE:
+            sim_log("peer %u: out of range", peer->index);
+            break;
+
+        case SIM_MSG_LINK_LOSS:
+            link_loss(peer);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*************************************************************************
+NAME
+    mod_send
+
+DESCRIPTION
+    Send a message to sim_module_task of another module, which gets it
+    after the link latency and delay milliseconds more.
+
+RETURNS
+
+*/
+static void mod_send(uint16 to, MessageId id, SIM_MOD_MSG_T *m, sim_time delay)
+{
+    m->from = sim_self->index;
+    sim_post(&sim_nodes[to], &sim_module_task, id, m,
+             sim_clock() + sim_link_default.latency + delay);
+}
+
+/*************************************************************************
+NAME
+    mod_msg
+
+DESCRIPTION
+    Allocate a message between modules, with room for size bytes of data.
+
+RETURNS
+    The zeroed message.
+*/
+static SIM_MOD_MSG_T *mod_msg(uint16 size)
+{
+    SIM_MOD_MSG_T *m = (SIM_MOD_MSG_T *)msg_new(sizeof(SIM_MOD_MSG_T) + size);
+
+    m->size = size;
+    return m;
+}
+
+/*************************************************************************
+NAME
+    mod_links
+
+DESCRIPTION
+    Set up the links to the other modules, the first time they are needed.
+
+RETURNS
+
+*/
+static void mod_links(void)
+{
+    uint16 i;
+
+    if (links)
+        return;
+
+    links = (sim_link *)PanicNull(calloc(sim_node_count, sizeof(sim_link)));
+    acl_refs = (uint16 *)PanicNull(calloc(sim_node_count, sizeof(uint16)));
+    acl_up = (bool *)PanicNull(calloc(sim_node_count, sizeof(bool)));
+
+    for (i=0; i<sim_node_count; i++)
+        links[i] = sim_link_default;
+}
+
+/*************************************************************************
+NAME
+    acl_ref
+
+DESCRIPTION
+    A channel to another module uses the ACL to it, which comes up with the
+    first one.
+
+RETURNS
+
+*/
+static void acl_ref(sim_chan *chan, bool incoming)
+{
+    uint16 i = chan->remote;
+
+    chan->acl = TRUE;
+    acl_refs[i]++;
+
+    if (!acl_up[i])
+    {
+        CL_DM_ACL_OPENED_IND_T *m = MSG_NEW(CL_DM_ACL_OPENED_IND_T);
+
+        acl_up[i] = TRUE;
+        m->bd_addr = sim_nodes[i].addr;
+        m->incoming = incoming;
+        m->status = hci_success;
+        MessageSend(app_task, CL_DM_ACL_OPENED_IND, m);
+    }
+}
+
+/*************************************************************************
+NAME
+    chan_new
+
+DESCRIPTION
+    Create the end point of a channel to another module.
+
+RETURNS
+    The end point.
+*/
+static sim_ep *chan_new(uint16 remote, uint8 server_channel, Task task, uint16 frame)
+{
+    sim_ep *ep = sim_ep_new(SIM_EP_RFCOMM, SIM_RFCOMM_BUFFER);
+    sim_chan *chan = (sim_chan *)PanicNull(calloc(1, sizeof(sim_chan)));
+
+    mod_links();
+    chan->remote = remote;
+    chan->pending = TRUE;
+    ep->owner = chan;
+    ep->task = task;
+    ep->server_channel = server_channel;
+    sim_ep_link(ep, &links[remote], frame, sim_credits);
+    return ep;
+}
+
+/*************************************************************************
+NAME
+    chan_close
+
+DESCRIPTION
+    Close this end of a channel to another module. The ACL goes a little
+    after the last channel on it.
+
+RETURNS
+
+*/
+static void chan_close(sim_ep *ep)
+{
+    sim_chan *chan = (sim_chan *)ep->owner;
+
+    sim_ep_close(ep);
+    chan->pending = FALSE;
+
+    if (chan->acl)
+    {
+        SIM_MOD_MSG_T *m = mod_msg(0);
+
+        chan->acl = FALSE;
+        acl_refs[chan->remote]--;
+        m->from = chan->remote;
+        MessageSendLater(&sim_module_task, SIM_MOD_ACL_CLOSE, m, 50);
+    }
+}
+
+/*************************************************************************
+NAME
+    chan_refuse
+
+DESCRIPTION
+    Refuse a connection from another module, closing the end point made
+    for it.
+
+RETURNS
+
+*/
+static void chan_refuse(sim_ep *ep)
+{
+    SIM_MOD_MSG_T *m = mod_msg(0);
+
+    m->ep = ep->peer;
+    m->ok = FALSE;
+    mod_send(((sim_chan *)ep->owner)->remote, SIM_MOD_CONNECT_RSP, m, 0);
+    chan_close(ep);
+}
+
+/*************************************************************************
+NAME
+    link_mode
+
+DESCRIPTION
+    Put a link into sniff with the given interval, or back into active
+    mode with 0, and tell the application. The first sniff anchor is now.
+
+RETURNS
+
+*/
+static void link_mode(sim_link *link, const bdaddr *addr, uint16 interval)
+{
+    CL_DM_MODE_CHANGE_EVENT_T *m = MSG_NEW(CL_DM_MODE_CHANGE_EVENT_T);
+
+    link->sniff = interval;
+    link->anchor = sim_clock();
+
+    m->bd_addr = *addr;
+    m->mode = interval ? lp_sniff : lp_active;
+    m->interval = interval;
+    MessageSend(app_task, CL_DM_MODE_CHANGE_EVENT, m);
+}
+
+/*************************************************************************
+NAME
+    module_handler
+
+DESCRIPTION
+    Message handler of the link layer of a module, for what the other
+    modules ask and answer.
+
+RETURNS
+
+*/
+static void module_handler(Task task, MessageId id, Message message)
+{
+    const SIM_MOD_MSG_T *msg = (const SIM_MOD_MSG_T *)message;
+
+    mod_links();
+
+    switch (id)
+    {
+        case SIM_MOD_INQUIRY:
+            /* Discoverable: answer after a random backoff, as on the air. */
+            if (page_scan && record)
+                mod_send(msg->from, SIM_MOD_INQUIRY_RSP, mod_msg(0),
+                         (sim_time)(sim_random() % SIM_INQUIRY_BACKOFF) * 625);
+            break;
+
+        case SIM_MOD_INQUIRY_RSP:
+            if (inquiry_left)
+            {
+                CL_DM_INQUIRE_RESULT_T *m = MSG_NEW(CL_DM_INQUIRE_RESULT_T);
+
+                m->status = inquiry_status_result;
+                m->bd_addr = sim_nodes[msg->from].addr;
+                m->dev_class = inquiry_cod;
+                MessageSend(app_task, CL_DM_INQUIRE_RESULT, m);
+
+                if (--inquiry_left)
+                    break;
+
+                /* That is all that was asked for. */
+                MessageCancelAll(&sim_module_task, SIM_MOD_INQUIRY_END);
+                m = MSG_NEW(CL_DM_INQUIRE_RESULT_T);
+                m->status = inquiry_status_ready;
+                MessageSend(app_task, CL_DM_INQUIRE_RESULT, m);
+            }
+            break;
+
+        case SIM_MOD_INQUIRY_END:
+            if (inquiry_left)
+            {
+                CL_DM_INQUIRE_RESULT_T *m = MSG_NEW(CL_DM_INQUIRE_RESULT_T);
+
+                inquiry_left = 0;
+                m->status = inquiry_status_ready;
+                MessageSend(app_task, CL_DM_INQUIRE_RESULT, m);
+            }
+            break;
+
+        case SIM_MOD_SDP_REQ:
+        {
+            bool ok = record && (page_scan || acl_up[msg->from]);
+            SIM_MOD_MSG_T *m = mod_msg(ok ? record_size : 0);
+
+            m->ok = ok;
+            if (ok)
+                memmove(m->data, record, record_size);
+            mod_send(msg->from, SIM_MOD_SDP_RSP, m,
+                     ok ? SIM_MS(20) : SIM_MS(SIM_PAGE_TIMEOUT));
+            break;
+        }
+
+        case SIM_MOD_SDP_RSP:
+        {
+            CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T *m = (CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T *)
+                    msg_new(sizeof(CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T) + msg->size);
+
+            m->bd_addr = sim_nodes[msg->from].addr;
+            m->status = msg->ok ? success : fail;
+            m->size_attributes = msg->size;
+            memmove(m->attributes, msg->data, msg->size);
+            MessageSend(app_task, CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM, m);
+            break;
+        }
+
+        case SIM_MOD_CONNECT_REQ:
+        {
+            CL_RFCOMM_CONNECT_IND_T *m;
+            SIM_MOD_MSG_T *timer;
+            sim_ep *ep;
+
+            /* Only a module that is page scanning, or has the ACL up, is found. */
+            if ((!page_scan && !acl_up[msg->from]) ||
+                !msg->channel || msg->channel >= next_channel)
+            {
+                SIM_MOD_MSG_T *rsp = mod_msg(0);
+
+                rsp->ep = msg->from_ep;
+                rsp->ok = FALSE;
+                mod_send(msg->from, SIM_MOD_CONNECT_RSP, rsp,
+                         acl_up[msg->from] || page_scan ? 0 : SIM_MS(SIM_PAGE_TIMEOUT));
+                break;
+            }
+
+            ep = chan_new(msg->from, msg->channel, app_task, msg->frame);
+            ep->peer = msg->from_ep;
+            acl_ref((sim_chan *)ep->owner, TRUE);
+
+            m = MSG_NEW(CL_RFCOMM_CONNECT_IND_T);
+            m->bd_addr = sim_nodes[msg->from].addr;
+            m->server_channel = msg->channel;
+            m->frame_size = msg->frame;
+            m->sink = SIM_SINK(ep);
+            MessageSend(app_task, CL_RFCOMM_CONNECT_IND, m);
+
+            timer = mod_msg(0);
+            timer->ep = ep;
+            MessageSendLater(&sim_module_task, SIM_MOD_CONNECT_TIMEOUT, timer,
+                             SIM_CONNECT_TIMEOUT);
+            break;
+        }
+
+        case SIM_MOD_CONNECT_RSP:
+        {
+            CL_RFCOMM_CLIENT_CONNECT_CFM_T *m;
+            sim_ep *ep = msg->ep;
+            sim_chan *chan = (sim_chan *)ep->owner;
+
+            /* Given up on while it was being answered. */
+            if (!ep->open || !chan->pending)
+            {
+                if (msg->ok)
+                {
+                    SIM_MOD_MSG_T *close = mod_msg(0);
+
+                    close->ep = msg->from_ep;
+                    mod_send(msg->from, SIM_MOD_CLOSE, close, 0);
+                }
+                break;
+            }
+
+            m = MSG_NEW(CL_RFCOMM_CLIENT_CONNECT_CFM_T);
+            m->server_channel = ep->server_channel;
+            m->sink = SIM_SINK(ep);
+            chan->pending = FALSE;
+
+            if (msg->ok)
+            {
+                ep->peer = msg->from_ep;
+                acl_ref(chan, FALSE);
+                sim_ep_link(ep, ep->link, msg->frame, ep->credits);
+                m->status = success;
+                m->payload_size = msg->frame;
+                sim_log("module %u: channel %u open", msg->from, ep->server_channel);
+            }
+            else
+            {
+                chan_close(ep);
+                m->status = fail;
+            }
+            MessageSend(app_task, CL_RFCOMM_CLIENT_CONNECT_CFM, m);
+            break;
+        }
+
+        case SIM_MOD_CONNECT_TIMEOUT:
+            if (msg->ep->open && ((sim_chan *)msg->ep->owner)->pending)
+                chan_refuse(msg->ep);
+            break;
+
+        case SIM_MOD_CLOSE:
+            if (msg->ep->open)
+            {
+                CL_RFCOMM_DISCONNECT_IND_T *m = MSG_NEW(CL_RFCOMM_DISCONNECT_IND_T);
+
+                m->status = success;
+                m->sink = SIM_SINK(msg->ep);
+                MessageSend(app_task, CL_RFCOMM_DISCONNECT_IND, m);
+                chan_close(msg->ep);
+            }
+            break;
+
+        case SIM_MOD_ACL_CLOSE:
+            if (acl_up[msg->from] && !acl_refs[msg->from])
+            {
+                CL_DM_ACL_CLOSED_IND_T *m = MSG_NEW(CL_DM_ACL_CLOSED_IND_T);
+
+                acl_up[msg->from] = FALSE;
+                links[msg->from].sniff = 0;
+                m->bd_addr = sim_nodes[msg->from].addr;
+                m->status = hci_success;
+                MessageSend(app_task, CL_DM_ACL_CLOSED_IND, m);
+            }
+            break;
+
+        case SIM_MOD_MODE:
+            if (sim_node_count && acl_up[msg->from])
+                link_mode(&links[msg->from], &sim_nodes[msg->from].addr, msg->interval);
+            else if (!sim_node_count && peers[msg->from].acl)
+                link_mode(&peers[msg->from].link, &peers[msg->from].addr, msg->interval);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*************************************************************************
+NAME
+    module_inquire
+
+DESCRIPTION
+    ConnectionInquire() with several modules: ask every other one, and take
+    the first max_responses that answer.
+
+RETURNS
+
+*/
+static void module_inquire(uint8 max_responses, uint8 timeout, uint32 class_of_device)
+{
+    uint16 i;
+
+    MessageCancelAll(&sim_module_task, SIM_MOD_INQUIRY_END);
+    inquiry_left = max_responses ? max_responses : 0xFF;
+    inquiry_cod = class_of_device;
+
+    for (i=0; i<sim_node_count; i++)
+    {
+        if (i != sim_self->index)
+            mod_send(i, SIM_MOD_INQUIRY, mod_msg(0), 0);
+    }
+    MessageSendLater(&sim_module_task, SIM_MOD_INQUIRY_END, mod_msg(0),
+                     (uint32)timeout * 1280);
+}
+
+/*************************************************************************
+NAME
+    module_disconnect
+
+DESCRIPTION
+    ConnectionRfcommDisconnectRequest() with several modules: close this
+    end, and tell the other.
+
+RETURNS
+
+*/
+static void module_disconnect(sim_ep *ep)
+{
+    if (!ep->open)
+        return;
+
+    /* Without a peer the other end has not answered yet, and is told then. */
+    if (ep->peer)
+    {
+        SIM_MOD_MSG_T *m = mod_msg(0);
+
+        m->ep = ep->peer;
+        mod_send(((sim_chan *)ep->owner)->remote, SIM_MOD_CLOSE, m, 0);
+    }
+    sim_log("module %u: channel %u closed", ((sim_chan *)ep->owner)->remote,
+            ep->server_channel);
+    chan_close(ep);
+}
+
+bool sim_peer_add(sim_peer_role role, sim_peer_behaviour behaviour)
+{
+    sim_peer *peer;
+
+    if (peer_count == SIM_MAX_PEERS)
+        return FALSE;
+
+    peer = &peers[peer_count];
+    memset(peer, 0, sizeof(*peer));
+    peer->task.handler = peer_handler;
+    peer->index = peer_count;
+    peer->role = role;
+    peer->behaviour = behaviour;
+    peer->addr.nap = 0x0002;
+    peer->addr.uap = 0x5B;
+    peer->addr.lap = 0x000010 + peer_count;
+    peer->link = sim_link_default;
+
+    peer_count++;
+    return TRUE;
+}
+
+bool sim_peer_outage(uint16 index, uint32 at_ms, uint32 for_ms)
+{
+    sim_peer *peer;
+
+    if (index >= peer_count)
+        return FALSE;
+
+    peer = &peers[index];
+    peer->link.outage_start = SIM_MS(at_ms);
+    peer->link.outage_end = for_ms ? SIM_MS(at_ms) + SIM_MS(for_ms) : SIM_NEVER;
+
+    sim_send_at(&peer->task, SIM_MSG_OUTAGE, 0, peer->link.outage_start);
+    if (!for_ms || for_ms >= sim_supervision)
+        sim_send_at(&peer->task, SIM_MSG_LINK_LOSS, 0,
+                    peer->link.outage_start + SIM_MS(sim_supervision));
+    return TRUE;
+}
+
+void sim_peer_stats(void)
+{
+    uint16 i;
+
+    for (i=0; i<peer_count; i++)
+    {
+        if (peers[i].link.packets)
+            sim_log("peer %u: %lu packets, %lu sent again", i,
+                    (unsigned long)peers[i].link.packets,
+                    (unsigned long)peers[i].link.retries);
+    }
+}
+
+void ConnectionInit(Task theAppTask)
+{
+    CL_INIT_CFM_T *m = MSG_NEW(CL_INIT_CFM_T);
+
+    app_task = theAppTask;
+    if (sim_tracing)
+        sim_trace_app(theAppTask);
+    m->status = success;
+    MessageSend(app_task, CL_INIT_CFM, m);
+}
+
+void ConnectionReadLocalAddr(Task theAppTask)
+{
+    CL_DM_LOCAL_BD_ADDR_CFM_T *m = MSG_NEW(CL_DM_LOCAL_BD_ADDR_CFM_T);
+
+    m->status = hci_success;
+    m->bd_addr = sim_self ? sim_self->addr : local_addr;
+    MessageSend(theAppTask, CL_DM_LOCAL_BD_ADDR_CFM, m);
+}
+
+void ConnectionReadLocalName(Task theAppTask)
+{
+    uint16 len = (uint16)strlen(local_name);
+    CL_DM_LOCAL_NAME_COMPLETE_T *m = (CL_DM_LOCAL_NAME_COMPLETE_T *)
+                                     msg_new(sizeof(CL_DM_LOCAL_NAME_COMPLETE_T) + len);
+
+    m->status = hci_success;
+    m->size_local_name = len;
+    memmove(m->local_name, local_name, len);
+    MessageSend(theAppTask, CL_DM_LOCAL_NAME_COMPLETE, m);
+}
+
+void ConnectionWriteClassOfDevice(uint32 cod)
+{
+}
+
+void ConnectionWriteScanEnable(hci_scan_enable mode)
+{
+    uint16 i;
+
+    page_scan = (mode == hci_scan_enable_inq_and_page);
+    sim_log("scan %s", page_scan ? "on" : "off");
+
+    if (!page_scan || !record)
+        return;
+
+    /* The first master that is free finds the application. */
+    for (i=0; i<peer_count; i++)
+    {
+        if (peers[i].role == SIM_PEER_MASTER && !peers[i].acl)
+        {
+            MessageSendLater(&peers[i].task, SIM_MSG_CONNECT, 0, 200);
+            break;
+        }
+    }
+}
+
+void ConnectionRfcommAllocateChannel(Task theAppTask, uint8 suggested_server_channel)
+{
+    CL_RFCOMM_REGISTER_CFM_T *m = MSG_NEW(CL_RFCOMM_REGISTER_CFM_T);
+
+    m->status = success;
+    m->server_channel = next_channel++;
+    MessageSend(theAppTask, CL_RFCOMM_REGISTER_CFM, m);
+}
+
+void ConnectionRfcommConnectRequest(Task theAppTask, const bdaddr *bd_addr,
+                                    uint16 security_channel, uint8 remote_server_channel,
+                                    const rfcomm_config_params *config)
+{
+    sim_peer *peer = peer_find(bd_addr);
+    CL_RFCOMM_CLIENT_CONNECT_CFM_T *m = MSG_NEW(CL_RFCOMM_CLIENT_CONNECT_CFM_T);
+    bool ctrl = (remote_server_channel == SIM_PEER_CTRL_CHANNEL);
+    uint16 frame = frame_size(config);
+    sim_ep *ep;
+
+    m->server_channel = remote_server_channel;
+
+    if (sim_node_count)
+    {
+        sim_node *node = sim_node_find(bd_addr);
+
+        if (!node || node == sim_self)
+        {
+            m->status = fail;
+            MessageSendLater(theAppTask, CL_RFCOMM_CLIENT_CONNECT_CFM, m, 30);
+        }
+        else
+        {
+            SIM_MOD_MSG_T *req = mod_msg(0);
+
+            ep = chan_new(node->index, remote_server_channel, theAppTask, frame);
+            req->channel = remote_server_channel;
+            req->frame = frame;
+            req->from_ep = ep;
+            mod_send(node->index, SIM_MOD_CONNECT_REQ, req, 0);
+
+            m->status = rfcomm_connect_pending;
+            m->sink = SIM_SINK(ep);
+            MessageSend(theAppTask, CL_RFCOMM_CLIENT_CONNECT_CFM, m);
+        }
+        return;
+    }
+
+    if (!peer || peer->role != SIM_PEER_SLAVE ||
+        (remote_server_channel != SIM_PEER_DATA_CHANNEL && !ctrl) ||
+        (ctrl ? peer->ctrl : peer->data))
+    {
+        m->status = fail;
+        MessageSendLater(theAppTask, CL_RFCOMM_CLIENT_CONNECT_CFM, m, 30);
+        return;
+    }
+
+    if (!peer_reachable(peer))
+    {
+        m->status = fail;
+        MessageSendLater(theAppTask, CL_RFCOMM_CLIENT_CONNECT_CFM, m, SIM_PAGE_TIMEOUT);
+        return;
+    }
+
+    if (frame > SIM_PEER_FRAME)
+        frame = SIM_PEER_FRAME;
+
+    acl_open(peer, FALSE);
+    ep = channel_open(peer, remote_server_channel, ctrl, frame);
+
+    m->status = rfcomm_connect_pending;
+    m->sink = SIM_SINK(ep);
+    MessageSend(theAppTask, CL_RFCOMM_CLIENT_CONNECT_CFM, m);
+
+    m = MSG_NEW(CL_RFCOMM_CLIENT_CONNECT_CFM_T);
+    m->status = success;
+    m->server_channel = remote_server_channel;
+    m->payload_size = frame;
+    m->sink = SIM_SINK(ep);
+    MessageSendLater(theAppTask, CL_RFCOMM_CLIENT_CONNECT_CFM, m, 30);
+}
+
+void ConnectionRfcommConnectResponse(Task theAppTask, bool response, Sink sink,
+                                     uint8 local_server_channel,
+                                     const rfcomm_config_params *config)
+{
+    sim_ep *ep = SIM_EP(sink);
+    sim_peer *peer = sim_node_count ? NULL : (sim_peer *)ep->owner;
+    uint16 frame = frame_size(config);
+    CL_RFCOMM_SERVER_CONNECT_CFM_T *m;
+
+    /* The smaller of the sizes the two ends ask for. */
+    if (frame > ep->frame)
+        frame = ep->frame;
+
+    if (sim_node_count)
+    {
+        sim_chan *chan = (sim_chan *)ep->owner;
+        SIM_MOD_MSG_T *rsp;
+
+        if (!ep->open || !chan->pending)
+            return;
+        if (!response)
+        {
+            chan_refuse(ep);
+            return;
+        }
+
+        chan->pending = FALSE;
+        sim_ep_link(ep, ep->link, frame, ep->credits);
+        rsp = mod_msg(0);
+        rsp->ep = ep->peer;
+        rsp->from_ep = ep;
+        rsp->ok = TRUE;
+        rsp->frame = frame;
+        mod_send(chan->remote, SIM_MOD_CONNECT_RSP, rsp, 0);
+        sim_log("module %u: channel %u open", chan->remote, local_server_channel);
+    }
+    else if (!response)
+    {
+        /* Without a peer, the channel is one of a replay. */
+        if (peer)
+        {
+            if (peer->ctrl == ep->peer)
+                peer->ctrl = NULL;
+            if (peer->data == ep->peer)
+                peer->data = NULL;
+            MessageSendLater(&peer->task, SIM_MSG_ACL_CLOSE, 0, 50);
+        }
+        sim_ep_close(ep);
+        return;
+    }
+    else if (ep->peer)
+    {
+        sim_ep_link(ep, ep->link, frame, ep->credits);
+        sim_ep_link(ep->peer, ep->link, frame, ep->peer->credits);
+    }
+
+    m = MSG_NEW(CL_RFCOMM_SERVER_CONNECT_CFM_T);
+    m->status = success;
+    m->server_channel = local_server_channel;
+    m->payload_size = frame;
+    m->sink = sink;
+    MessageSend(theAppTask, CL_RFCOMM_SERVER_CONNECT_CFM, m);
+
+    /* With the data channel up, a master opens the control channel. */
+    if (peer && ep->peer == peer->data && peer->ctrl_channel)
+        MessageSendLater(&peer->task, SIM_MSG_CTRL_CONNECT, 0, 50);
+}
+
+void ConnectionRfcommDisconnectRequest(Task theAppTask, Sink sink)
+{
+    sim_ep *ep = SIM_EP(sink);
+    sim_peer *peer = (ep && !sim_node_count) ? (sim_peer *)ep->owner : NULL;
+    CL_RFCOMM_DISCONNECT_CFM_T *m = MSG_NEW(CL_RFCOMM_DISCONNECT_CFM_T);
+
+    if (ep && sim_node_count)
+    {
+        module_disconnect(ep);
+    }
+    else if (peer)
+    {
+        if (peer->ctrl == ep->peer)
+            peer->ctrl = NULL;
+        if (peer->data == ep->peer)
+        {
+            peer->data = NULL;
+            MessageCancelAll(&peer->task, SIM_MSG_TALK);
+        }
+        MessageSendLater(&peer->task, SIM_MSG_ACL_CLOSE, 0, 50);
+        sim_log("peer %u: channel %u closed", peer->index, ep->server_channel);
+    }
+    if (ep && !sim_node_count)
+        sim_ep_close(ep);
+
+    m->status = success;
+    m->sink = sink;
+    MessageSend(theAppTask, CL_RFCOMM_DISCONNECT_CFM, m);
+}
+
+void ConnectionRfcommDisconnectResponse(Sink sink)
+{
+}
+
+void ConnectionRegisterServiceRecord(Task theAppTask, uint16 num_rec_bytes,
+                                     const uint8 *service_record)
+{
+    CL_SDP_REGISTER_CFM_T *m = MSG_NEW(CL_SDP_REGISTER_CFM_T);
+
+    /* Like the firmware, take the record over. */
+    free(record);
+    record = (uint8 *)service_record;
+    record_size = num_rec_bytes;
+
+    m->status = success;
+    m->service_handle = ++record_handle;
+    MessageSend(theAppTask, CL_SDP_REGISTER_CFM, m);
+}
+
+void ConnectionUnregisterServiceRecord(Task theAppTask, uint32 service_record_hdl)
+{
+    CL_SDP_UNREGISTER_CFM_T *m = MSG_NEW(CL_SDP_UNREGISTER_CFM_T);
+
+    if (record && service_record_hdl == record_handle)
+    {
+        free(record);
+        record = NULL;
+        record_size = 0;
+        m->status = success;
+    }
+    else
+    {
+        m->status = fail;
+    }
+    m->service_handle = service_record_hdl;
+    MessageSend(theAppTask, CL_SDP_UNREGISTER_CFM, m);
+}
+
+void ConnectionSdpServiceSearchAttributeRequest(Task theAppTask, const bdaddr *addr,
+                                                uint16 max_num_recs,
+                                                uint16 size_srch_pttrn,
+                                                const uint8 *srch_pttrn,
+                                                uint16 size_attr_list,
+                                                const uint8 *attr_list)
+{
+    /* ProtocolDescriptorList and the control channel of a slave peer. */
+    static const uint8 attrs[] =
+    {
+        0x35, 0x16,
+        0x09, 0x00, 0x04,
+        0x35, 0x0c, 0x35, 0x03, 0x19, 0x01, 0x00,
+        0x35, 0x05, 0x19, 0x00, 0x03, 0x08, SIM_PEER_DATA_CHANNEL,
+        0x09, 0x02, 0x00, 0x08, SIM_PEER_CTRL_CHANNEL
+    };
+    sim_peer *peer = peer_find(addr);
+    sim_node *node = sim_node_count ? sim_node_find(addr) : NULL;
+    CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T *m;
+
+    if (node && node != sim_self)
+    {
+        mod_links();
+        mod_send(node->index, SIM_MOD_SDP_REQ, mod_msg(0), 0);
+        return;
+    }
+
+    m = (CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T *)
+        msg_new(sizeof(CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T) + sizeof(attrs));
+    m->bd_addr = *addr;
+
+    if (peer && peer->role == SIM_PEER_SLAVE && peer_reachable(peer))
+    {
+        m->status = success;
+        m->size_attributes = sizeof(attrs);
+        memmove(m->attributes, attrs, sizeof(attrs));
+    }
+    else
+    {
+        m->status = fail;
+    }
+    MessageSendLater(theAppTask, CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM, m, 20);
+}
+
+void ConnectionInquire(Task theAppTask, uint32 inquiry_lap, uint8 max_responses,
+                       uint8 timeout, uint32 class_of_device)
+{
+    CL_DM_INQUIRE_RESULT_T *m;
+    uint32 delay = 0;
+    uint16 found = 0;
+    uint16 i;
+
+    if (sim_node_count)
+    {
+        module_inquire(max_responses, timeout, class_of_device);
+        return;
+    }
+
+    for (i=0; i<peer_count && found < max_responses; i++)
+    {
+        if (peers[i].role != SIM_PEER_SLAVE || peers[i].acl || !peer_reachable(&peers[i]))
+            continue;
+
+        delay += 100;
+        m = MSG_NEW(CL_DM_INQUIRE_RESULT_T);
+        m->status = inquiry_status_result;
+        m->bd_addr = peers[i].addr;
+        m->dev_class = class_of_device;
+        MessageSendLater(theAppTask, CL_DM_INQUIRE_RESULT, m, delay);
+        found++;
+    }
+
+    /* Inquiry stops early once it has max_responses, else it runs to the end. */
+    delay = found ? delay + 100 : (uint32)timeout * 1280;
+
+    m = MSG_NEW(CL_DM_INQUIRE_RESULT_T);
+    m->status = inquiry_status_ready;
+    MessageSendLater(theAppTask, CL_DM_INQUIRE_RESULT, m, delay);
+}
+
+void ConnectionSmRegisterIncomingService(dm_protocol_id protocol_id, uint32 channel,
+                                         dm_security_level_in security_level)
+{
+}
+
+void ConnectionSmRegisterOutgoingService(Task theAppTask, const bdaddr *bd_addr,
+                                         dm_protocol_id protocol_id, uint32 remote_channel,
+                                         dm_security_level_out security_level)
+{
+    CL_SM_REGISTER_OUTGOING_SERVICE_CFM_T *m = MSG_NEW(CL_SM_REGISTER_OUTGOING_SERVICE_CFM_T);
+
+    m->bd_addr = *bd_addr;
+    m->security_channel = remote_channel ? (uint16)remote_channel : 1;
+    MessageSend(theAppTask, CL_SM_REGISTER_OUTGOING_SERVICE_CFM, m);
+}
+
+void ConnectionSmSetSdpSecurityIn(bool enable)
+{
+}
+
+void ConnectionSmIoCapabilityResponse(const bdaddr *bd_addr, cl_sm_io_capability io_capability,
+                                      bool force_mitm, bool bonding, bool oob_data_present,
+                                      uint8 *oob_hash_c, uint8 *oob_rand_r)
+{
+}
+
+void ConnectionSmAuthoriseResponse(const bdaddr *bd_addr, dm_protocol_id protocol_id,
+                                   uint32 channel, bool incoming, bool authorised)
+{
+}
+
+void ConnectionSetLinkPolicy(Sink sink, uint16 size_power_table,
+                             const lp_power_table *power_table)
+{
+    sim_ep *ep = SIM_EP(sink);
+    SIM_MOD_MSG_T *m;
+    uint16 interval = 0;
+
+    /* Without an owner, the channel is one of a replay. */
+    if (!SinkIsValid(sink) || !ep->owner || !size_power_table)
+        return;
+
+    /* The master picks the longest interval it is allowed. */
+    if (power_table[0].state == lp_sniff)
+        interval = power_table[0].max_interval;
+
+    m = mod_msg(0);
+    m->interval = interval;
+    if (sim_node_count)
+    {
+        SIM_MOD_MSG_T *r = mod_msg(0);
+
+        r->interval = interval;
+        m->from = ((sim_chan *)ep->owner)->remote;
+        mod_send(m->from, SIM_MOD_MODE, r, SIM_MODE_DELAY);
+    }
+    else
+    {
+        m->from = ((sim_peer *)ep->owner)->index;
+    }
+    MessageSendLater(&sim_module_task, SIM_MOD_MODE, m, SIM_MODE_DELAY);
+}
+
+/*************************************************************************
+NAME
+    link_signal
+
+DESCRIPTION
+    Make up the RSSI and the link quality of the link of a channel from its
+    loss: a clean link is in the golden receive power range with full
+    quality, more loss takes both down, and a link out of range has neither.
+
+RETURNS
+    The link quality, with the RSSI in dB from the golden range in *rssi.
+*/
+static uint8 link_signal(Sink sink, int16 *rssi)
+{
+    const sim_link *link = SinkIsValid(sink) ? SIM_EP(sink)->link : NULL;
+    sim_time now = sim_clock();
+
+    *rssi = 0;
+    if (!link)
+        return 0xFF;
+
+    if (now >= link->outage_start && now < link->outage_end)
+    {
+        *rssi = -SIM_RSSI_FLOOR;
+        return 0;
+    }
+
+    *rssi = -(int16)(((uint32)link->loss * SIM_RSSI_FLOOR) >> 16);
+    return (uint8)(0xFF - (((uint32)link->loss * 0xFF) >> 16));
+}
+
+void ConnectionGetRssi(Task theAppTask, Sink sink)
+{
+    CL_DM_RSSI_CFM_T *m = MSG_NEW(CL_DM_RSSI_CFM_T);
+
+    m->status = SinkIsValid(sink) ? hci_success : hci_error_conn_timeout;
+    link_signal(sink, &m->rssi);
+    m->sink = sink;
+    MessageSend(theAppTask, CL_DM_RSSI_CFM, m);
+}
+
+void ConnectionGetLinkQuality(Task theAppTask, Sink sink)
+{
+    CL_DM_LINK_QUALITY_CFM_T *m = MSG_NEW(CL_DM_LINK_QUALITY_CFM_T);
+    int16 rssi;
+
+    m->status = SinkIsValid(sink) ? hci_success : hci_error_conn_timeout;
+    m->link_quality = link_signal(sink, &rssi);
+    m->sink = sink;
+    MessageSend(theAppTask, CL_DM_LINK_QUALITY_CFM, m);
+}
+
+const uint8 *UtilGetNumber(const uint8 *start, const uint8 *end, uint16 *result)
+{
+    uint16 n = 0;
+    const uint8 *p;
+
+    for (p = start; p < end && *p >= '0' && *p <= '9'; p++)
+        n = (uint16)(n * 10 + (*p - '0'));
+
+    if (p == start)
+        return NULL;
+
+    *result = n;
+    return p;
+}
+
+void BdaddrSetZero(bdaddr *addr)
+{
+    addr->lap = 0;
+    addr->uap = 0;
+    addr->nap = 0;
+}
+
+bool BdaddrIsZero(const bdaddr *addr)
+{
+    return !addr->lap && !addr->uap && !addr->nap;
+}
+
+bool BdaddrIsSame(const bdaddr *first, const bdaddr *second)
+{
+    return first->lap == second->lap && first->uap == second->uap &&
+           first->nap == second->nap;
+}
+
+bool SdpParseInsertRfcommServerChannel(uint16 size_service_record,
+                                       uint8 *service_record,
+                                       uint8 chan)
+{
+    uint16 i;
+
+    for (i=0; i+4 < size_service_record; i++)
+    {
+        if (service_record[i] == 0x19 && service_record[i+1] == 0x00 &&
+            service_record[i+2] == 0x03 && service_record[i+3] == 0x08)
+        {
+            service_record[i+4] = chan;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+bool SdpParseGetMultipleRfcommServerChannels(uint16 size_service_record,
+                                             uint8 *service_record,
+                                             uint8 size_chans,
+                                             uint8 **chans,
+                                             uint8 *chans_found)
+{
+    uint16 i;
+
+    *chans_found = 0;
+
+    for (i=0; i+4 < size_service_record && *chans_found < size_chans; i++)
+    {
+        if (service_record[i] == 0x19 && service_record[i+1] == 0x00 &&
+            service_record[i+2] == 0x03 && service_record[i+3] == 0x08)
+        {
+            (*chans)[(*chans_found)++] = service_record[i+4];
+        }
+    }
+    return *chans_found != 0;
+}
+
+/* End-of-File */
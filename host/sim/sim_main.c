@@ -0,0 +1,403 @@
+/*!
+ * @file sim_main.c
+ *
+ * @brief Host simulator of the module, running the firmware unmodified.
+ *
+ * The firmware sources are compiled for the host against the stand-in headers in
+ * host/include, with main() renamed fw_main(), and linked with the simulator of the
+ * VM and the Connection library. The UART is a pseudo terminal, so the module can be
+ * driven by a terminal program, muxd or a test script as if it was on a serial port,
+ * or stdin and stdout with -t.
+ *
+ * The virtual piconet is a set of peer devices, each a slave the application can
+ * connect to as a master, or a master that connects to it when it is a slave:
+ *
+ *     -p slave:echo    a slave that echoes its data (the default behaviour)
+ *     -p slave:sink    a slave that drops its data
+ *     -p slave:talk    a slave that sends a line every 100 ms
+ *     -p master:echo   a master, which connects on 'connect slave'
+ *
+ * Without -p there are two echoing slaves and an echoing master.
+ *
+ * The links to the peers are modelled with the given rate (-b kbit/s), latency (-L ms)
+ * and packet loss (-x %), the RFCOMM credit window (-w) and the link supervision
+ * timeout (-T ms). -o peer:at[:for] takes peer number 'peer' (from 0, in the order
+ * of -p) out of range at 'at' ms for 'for' ms, or for good. Packet loss is random,
+ * from the seed given with -S. The UART runs at -u baud.
+ *
+ * Time is virtual with -t, so that the output only depends on the input and the
+ * options, and follows the wall clock with a pty or -r. An input line '@<ms>' holds
+ * back the input after it for that long, e.g.
+ *
+ *     printf 'connect master\r@1000\rtx 0 "hello"\r' | fwsim -t
+ *
+ * -n count:script adds count modules, all running the firmware with the UART input
+ * in the file script, and no peers: the modules find and connect to each other,
+ * e.g. 50 masters and 350 slaves with
+ *
+ *     fwsim -n 50:master.txt -n 350:slave.txt -d 120000 -j 8 -O out
+ *
+ * They run side by side on -j cores (all of them by default) for -d ms of virtual
+ * time, with the UART output of each in a file in the directory given with -O.
+ *
+ * -R trace records what the application gets from outside, the messages to its task
+ * and the input, into the file trace. -P trace replays it instead of simulating the
+ * peers, with the UART output on stdout, to compare builds on the same workload:
+ *
+ *     printf 'connect master\r@1000\rtx 0 "hello"\r' | fwsim -t -R run.trace
+ *     fwsim -P run.trace
+ *
+ * At the end of a replay the time taken by the handler and the bytes it output
+ * are reported on stderr for every message id.
+ *
+ * Usage: fwsim [-t] [-r] [-p role[:behaviour]]... [-o peer:at[:for]]... [-s psfile]
+ *              [-e ms] [-l link] [-b kbps] [-L ms] [-x loss] [-w credits] [-T ms]
+ *              [-u baud] [-S seed] [-R trace] [-v]
+ *        fwsim -P trace [-e ms] [-v]
+ *        fwsim -n count:script... [-j cores] [-d ms] [-O dir] [-b kbps] [-L ms]
+ *              [-x loss] [-w credits] [-u baud] [-S seed] [-v]
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+#define USAGE "usage: fwsim [-t] [-r] [-p role[:behaviour]]... [-o peer:at[:for]]... " \
+              "[-s psfile]\n             [-e ms] [-l link] [-b kbps] [-L ms] [-x loss] " \
+              "[-w credits] [-T ms]\n             [-u baud] [-S seed] [-R trace] [-v]\n" \
+              "       fwsim -P trace [-e ms] [-v]\n" \
+              "       fwsim -n count:script... [-j cores] [-d ms] [-O dir] [-b kbps] " \
+              "[-L ms]\n             [-x loss] [-w credits] [-u baud] [-S seed] [-v]\n"
+
+int fw_main(void);
+
+static const char *link_path;
+
+/*************************************************************************
+NAME
+    add_peer
+
+DESCRIPTION
+    Add the peer described by a -p argument.
+
+RETURNS
+    FALSE if the argument is not valid.
+*/
+static bool add_peer(const char *arg)
+{
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    sim_peer_role role;
+    sim_peer_behaviour behaviour = SIM_PEER_ECHO;
+
+    if (len == 5 && !strncmp(arg, "slave", 5))
+        role = SIM_PEER_SLAVE;
+    else if (len == 6 && !strncmp(arg, "master", 6))
+        role = SIM_PEER_MASTER;
+    else
+        return FALSE;
+
+    if (colon)
+    {
+        if (!strcmp(colon + 1, "echo"))
+            behaviour = SIM_PEER_ECHO;
+        else if (!strcmp(colon + 1, "sink"))
+            behaviour = SIM_PEER_SINK;
+        else if (!strcmp(colon + 1, "talk"))
+            behaviour = SIM_PEER_TALK;
+        else
+            return FALSE;
+    }
+
+    return sim_peer_add(role, behaviour);
+}
+
+/*************************************************************************
+NAME
+    open_pty
+
+DESCRIPTION
+    Open a pseudo terminal for the UART, optionally with a symlink to its
+    slave side, which is kept open so that the UART survives the terminal
+    program being restarted.
+
+RETURNS
+    The master side.
+*/
+static int open_pty(void)
+{
+    struct termios tio;
+    const char *slave;
+    int fd;
+
+    if (
+        (fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+        grantpt(fd) < 0 ||
+        unlockpt(fd) < 0 ||
+        !(slave = ptsname(fd)) ||
+        open(slave, O_RDWR | O_NOCTTY) < 0
+        )
+    {
+        perror("fwsim: pty");
+        exit(1);
+    }
+
+    /* Like a UART, bytes pass through untouched. */
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (link_path)
+    {
+        unlink(link_path);
+        if (symlink(slave, link_path) < 0)
+        {
+            perror(link_path);
+            exit(1);
+        }
+        printf("%s -> %s\n", link_path, slave);
+    }
+    else
+    {
+        printf("%s\n", slave);
+    }
+    fflush(stdout);
+    return fd;
+}
+
+/*************************************************************************
+NAME
+    add_outage
+
+DESCRIPTION
+    Take a peer out of range as described by a -o argument.
+
+RETURNS
+    FALSE if the argument is not valid.
+*/
+static bool add_outage(const char *arg)
+{
+    char *end;
+    unsigned long peer = strtoul(arg, &end, 10);
+    unsigned long at;
+    unsigned long len = 0;
+
+    if (end == arg || *end != ':')
+        return FALSE;
+
+    arg = end + 1;
+    at = strtoul(arg, &end, 10);
+    if (end == arg || (*end && *end != ':'))
+        return FALSE;
+
+    if (*end)
+    {
+        arg = end + 1;
+        len = strtoul(arg, &end, 10);
+        if (end == arg || *end || !len)
+            return FALSE;
+    }
+
+    return sim_peer_outage((uint16)peer, (uint32)at, (uint32)len);
+}
+
+/*************************************************************************
+NAME
+    add_nodes
+
+DESCRIPTION
+    Add the modules described by a -n argument.
+
+RETURNS
+    FALSE if the argument is not valid.
+*/
+static bool add_nodes(const char *arg)
+{
+    char *end;
+    unsigned long count = strtoul(arg, &end, 10);
+
+    if (end == arg || *end != ':' || !count || sim_node_count + count > 0xFFFF)
+        return FALSE;
+
+    if (!sim_node_add((uint16)count, end + 1))
+    {
+        perror(end + 1);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void remove_link(void)
+{
+    if (link_path)
+        unlink(link_path);
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *peer_args[SIM_MAX_PEERS];
+    const char *outage_args[SIM_MAX_PEERS];
+    int peers = 0;
+    int outages = 0;
+    bool use_stdio = FALSE;
+    bool ps_file = FALSE;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32 end_ms = 60000;
+    const char *out_dir = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "trp:o:s:e:l:b:L:x:w:T:u:S:vn:j:d:O:R:P:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': use_stdio = TRUE; break;
+            case 'r': sim_realtime = TRUE; break;
+            case 'p':
+                if (peers == SIM_MAX_PEERS)
+                {
+                    fprintf(stderr, "fwsim: no more than %d peers\n", SIM_MAX_PEERS);
+                    return 2;
+                }
+                peer_args[peers++] = optarg;
+                break;
+            case 'o':
+                if (outages == SIM_MAX_PEERS)
+                {
+                    fprintf(stderr, "fwsim: no more than %d outages\n", SIM_MAX_PEERS);
+                    return 2;
+                }
+                outage_args[outages++] = optarg;
+                break;
+            case 's': sim_ps_open(optarg); ps_file = TRUE; break;
+            case 'e': sim_linger = (uint32)strtoul(optarg, NULL, 10); break;
+            case 'l': link_path = optarg; break;
+            case 'b': sim_link_default.rate = (uint32)(strtod(optarg, NULL) * 1000); break;
+            case 'L': sim_link_default.latency = (sim_time)(strtod(optarg, NULL) * 1000); break;
+            case 'x': sim_link_default.loss = (uint16)(strtod(optarg, NULL) * 65535 / 100); break;
+            case 'w': sim_credits = (uint16)strtoul(optarg, NULL, 10); break;
+            case 'T': sim_supervision = (uint32)strtoul(optarg, NULL, 10); break;
+            case 'u': sim_uart_baud = (uint32)strtoul(optarg, NULL, 10); break;
+            case 'S': sim_seed_base = (uint32)strtoul(optarg, NULL, 0); break;
+            case 'v': sim_verbose = 1; break;
+            case 'n':
+                if (!add_nodes(optarg))
+                {
+                    fprintf(stderr, "fwsim: bad modules '%s'\n" USAGE, optarg);
+                    return 2;
+                }
+                break;
+            case 'j': threads = strtol(optarg, NULL, 10); break;
+            case 'd': end_ms = (uint32)strtoul(optarg, NULL, 10); break;
+            case 'O': out_dir = optarg; break;
+            case 'R': record_path = optarg; break;
+            case 'P': replay_path = optarg; break;
+            default:
+                fprintf(stderr, USAGE);
+                return 2;
+        }
+    }
+
+    if (optind != argc || sim_credits < 1 || sim_credits > SIM_MAX_CREDITS)
+    {
+        fprintf(stderr, USAGE);
+        return 2;
+    }
+
+    sim_seed(sim_seed_base);
+
+    if (sim_node_count)
+    {
+        /* The modules run side by side for as long as the link latency. */
+        if (peers || outages || ps_file || sim_realtime || use_stdio ||
+            record_path || replay_path ||
+            !sim_link_default.latency || threads < 1 || threads > 0xFFFF)
+        {
+            fprintf(stderr, USAGE);
+            return 2;
+        }
+        sim_node_run((uint16)threads, end_ms, out_dir);
+    }
+
+    if (replay_path)
+    {
+        /* The trace is the peers and the input. */
+        if (peers || outages || sim_realtime || record_path)
+        {
+            fprintf(stderr, USAGE);
+            return 2;
+        }
+        sim_trace_replay(replay_path);
+        sim_uart_open(-1, 1);
+        return fw_main();
+    }
+
+    /* After the options, which set up the links of the peers. */
+    for (i = 0; i < peers; i++)
+    {
+        if (!add_peer(peer_args[i]))
+        {
+            fprintf(stderr, "fwsim: bad peer '%s'\n" USAGE, peer_args[i]);
+            return 2;
+        }
+    }
+
+    if (!peers)
+    {
+        sim_peer_add(SIM_PEER_SLAVE, SIM_PEER_ECHO);
+        sim_peer_add(SIM_PEER_SLAVE, SIM_PEER_ECHO);
+        sim_peer_add(SIM_PEER_MASTER, SIM_PEER_ECHO);
+    }
+
+    for (i = 0; i < outages; i++)
+    {
+        if (!add_outage(outage_args[i]))
+        {
+            fprintf(stderr, "fwsim: bad outage '%s'\n" USAGE, outage_args[i]);
+            return 2;
+        }
+    }
+
+    if (record_path)
+        sim_trace_record(record_path);
+
+    if (use_stdio)
+    {
+        sim_uart_open(0, 1);
+    }
+    else
+    {
+        int fd = open_pty();
+
+        /* A terminal needs the wall clock. */
+        sim_realtime = TRUE;
+
+        atexit(remove_link);
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        sim_uart_open(fd, fd);
+    }
+
+    return fw_main();
+}
+
+/* End-of-File */
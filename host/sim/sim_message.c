@@ -0,0 +1,386 @@
+/*!
+ * @file sim_message.c
+ *
+ * @brief Simulated message queue, timers and VM services.
+ *
+ * Messages wait in a single queue ordered by the time they are due, and in the
+ * order they were sent for the same time, like on the chip. MessageLoop() delivers
+ * every message that is due, feeds the UART input, and then moves the clock on to
+ * the next message. Handlers take no time, unless they busy wait for the UART.
+ *
+ * With -r the clock follows the wall clock, and MessageLoop() waits for input in
+ * poll() until the next message is due.
+ *
+ * With several modules each has its own queue and clock, and sim_node.c moves them
+ * on together with sim_run_until().
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <message.h>
+#include <panic.h>
+#include <vm.h>
+
+#include "sim.h"
+
+static SIM_LOCAL sim_msg *queue;
+static SIM_LOCAL sim_time now;
+static SIM_LOCAL uint32 sent;
+static SIM_LOCAL bool stopping;
+static SIM_LOCAL sim_time stop_at;
+static SIM_LOCAL uint32 random_state = 1;
+static struct timespec start;
+
+int sim_verbose;
+bool sim_realtime;
+uint32 sim_linger = 1000;
+uint32 sim_seed_base = 1;
+SIM_LOCAL uint32 sim_messages;
+
+/*************************************************************************
+NAME
+    wall_clock
+
+DESCRIPTION
+    Get the time on the wall clock since the simulation started.
+
+RETURNS
+    Microseconds.
+*/
+static sim_time wall_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (!start.tv_sec && !start.tv_nsec)
+        start = ts;
+
+    return (sim_time)(ts.tv_sec - start.tv_sec) * 1000000 +
+           (ts.tv_nsec - start.tv_nsec) / 1000;
+}
+
+sim_time sim_clock(void)
+{
+    return now;
+}
+
+uint32 sim_now(void)
+{
+    return (uint32)(now / 1000);
+}
+
+void sim_spin_until(sim_time t)
+{
+    if (sim_realtime)
+    {
+        while (wall_clock() < t)
+            ;
+        now = wall_clock();
+    }
+    else if (t > now)
+    {
+        now = t;
+    }
+}
+
+void sim_stop_after(uint32 ms)
+{
+    stopping = TRUE;
+    stop_at = now + SIM_MS(ms);
+}
+
+void sim_seed(uint32 seed)
+{
+    random_state = seed ? seed : 1;
+}
+
+uint16 sim_random(void)
+{
+    /* xorshift32, the same sequence on every host */
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return (uint16)(random_state >> 16);
+}
+
+void sim_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!sim_verbose)
+        return;
+
+    if (sim_self)
+        fprintf(stderr, "[%10.6f] %u: ", now / 1000000.0, sim_self->index);
+    else
+        fprintf(stderr, "[%10.6f] ", now / 1000000.0);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/*************************************************************************
+NAME
+    sim_exit
+
+DESCRIPTION
+    End the simulation, writing out what is left of the UART output.
+
+RETURNS
+
+*/
+static void sim_exit(void)
+{
+    sim_uart_close();
+    sim_trace_close();
+
+    if (sim_uart_spin)
+        sim_log("UART busy waits: %.3f ms", sim_uart_spin / 1000.0);
+    sim_peer_stats();
+
+    exit(0);
+}
+
+sim_msg *sim_msg_new(Task task, MessageId id, void *message, sim_time due)
+{
+    sim_msg *m = PanicUnlessNew(sim_msg);
+
+    m->next = NULL;
+    m->task = task;
+    m->id = id;
+    m->payload = message;
+    m->due = (due < now) ? now : due;
+    m->src = sim_self ? sim_self->index : 0;
+    m->seq = sent++;
+    return m;
+}
+
+void sim_msg_queue(sim_msg *m)
+{
+    sim_msg **p = &queue;
+
+    /* After every message due earlier, or at the same time and sent before it. */
+    while (*p && ((*p)->due < m->due ||
+                  ((*p)->due == m->due &&
+                   ((*p)->src < m->src || ((*p)->src == m->src && (*p)->seq < m->seq)))))
+        p = &(*p)->next;
+
+    m->next = *p;
+    *p = m;
+}
+
+void sim_send_at(Task task, MessageId id, void *message, sim_time due)
+{
+    if (sim_tracing && sim_trace_drop(id))
+    {
+        free(message);
+        return;
+    }
+    sim_msg_queue(sim_msg_new(task, id, message, due));
+}
+
+void MessageSend(Task task, MessageId id, void *message)
+{
+    sim_send_at(task, id, message, now);
+}
+
+void MessageSendLater(Task task, MessageId id, void *message, uint32 delay)
+{
+    sim_send_at(task, id, message, now + SIM_MS(delay));
+}
+
+uint16 MessageCancelAll(Task task, MessageId id)
+{
+    sim_msg **p = &queue;
+    uint16 n = 0;
+
+    while (*p)
+    {
+        sim_msg *m = *p;
+
+        if (m->task == task && m->id == id)
+        {
+            *p = m->next;
+            free(m->payload);
+            free(m);
+            n++;
+        }
+        else
+        {
+            p = &m->next;
+        }
+    }
+    return n;
+}
+
+bool MessageCancelFirst(Task task, MessageId id)
+{
+    sim_msg **p;
+
+    for (p = &queue; *p; p = &(*p)->next)
+    {
+        sim_msg *m = *p;
+
+        if (m->task == task && m->id == id)
+        {
+            *p = m->next;
+            free(m->payload);
+            free(m);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+uint16 MessagesPendingForTask(Task task, int32 *first_due)
+{
+    sim_msg *m;
+    uint16 n = 0;
+
+    if (first_due)
+        *first_due = -1;
+
+    for (m = queue; m; m = m->next)
+    {
+        if (m->task == task)
+        {
+            if (!n && first_due)
+                *first_due = (int32)((m->due - now) / 1000);
+            n++;
+        }
+    }
+    return n;
+}
+
+/*************************************************************************
+NAME
+    deliver_due
+
+DESCRIPTION
+    Deliver every message that is due now.
+
+RETURNS
+
+*/
+static void deliver_due(void)
+{
+    sim_msg *m;
+
+    while ((m = queue) && m->due <= now)
+    {
+        queue = m->next;
+
+        sim_stream_delivered(m->id, m->payload);
+        if (sim_tracing)
+            sim_trace_deliver(m);
+        else if (m->task && m->task->handler)
+            m->task->handler(m->task, m->id, m->payload);
+        sim_messages++;
+
+        free(m->payload);
+        free(m);
+    }
+}
+
+sim_time sim_next(void)
+{
+    sim_time next = queue ? queue->due : SIM_NEVER;
+
+    return (sim_uart_resume() < next) ? sim_uart_resume() : next;
+}
+
+void sim_run_until(sim_time end)
+{
+    for (;;)
+    {
+        sim_time next;
+
+        deliver_due();
+        if (sim_uart_feed())
+            continue;
+
+        next = sim_next();
+        if (next >= end)
+            break;
+        now = next;
+    }
+}
+
+void MessageLoop(void)
+{
+    if (sim_node_count)
+        sim_node_loop();
+
+    for (;;)
+    {
+        sim_time next;
+
+        if (sim_realtime)
+            now = wall_clock();
+
+        deliver_due();
+
+        if (sim_uart_feed())
+            continue;
+
+        /* The input has ended, let what it started finish. */
+        if (sim_uart_ended() && sim_trace_ended() && !stopping)
+            sim_stop_after(sim_linger);
+
+        next = sim_next();
+        if (stopping && stop_at < next)
+            next = stop_at;
+
+        if (stopping && now >= stop_at)
+            sim_exit();
+
+        if (sim_realtime)
+            sim_uart_wait(next);
+        else if (next == SIM_NEVER)
+            sim_exit();     /* Nothing is ever going to happen. */
+        else
+            now = next;
+    }
+}
+
+void Panic(void)
+{
+    if (sim_tracing)
+        sim_trace_close();
+    if (sim_self)
+        fprintf(stderr, "fwsim: Panic() in module %u at %.6f s\n", sim_self->index,
+                now / 1000000.0);
+    else
+        fprintf(stderr, "fwsim: Panic() at %.6f s\n", now / 1000000.0);
+    abort();
+}
+
+void *PanicNull(void *p)
+{
+    if (!p)
+        Panic();
+    return p;
+}
+
+void *PanicUnlessMalloc(size_t size)
+{
+    return PanicNull(malloc(size));
+}
+
+uint32 VmGetClock(void)
+{
+    return sim_now();
+}
+
+uint32 VmGetTimerTime(void)
+{
+    return (uint32)now;
+}
+
+/* End-of-File */
@@ -0,0 +1,332 @@
+/*!
+ * @file sim_node.c
+ *
+ * @brief Many modules at once, for whole deployments of masters and slaves.
+ *
+ * Every module runs the firmware in a thread of its own, with its own app and
+ * simulator state (NODE_LOCAL and SIM_LOCAL), its own message queue and clock,
+ * and its UART input from a script. The modules find and connect to each other
+ * through sim_conn.c.
+ *
+ * The clocks move on together in windows, a conservative parallel discrete event
+ * simulation. Nothing a module does reaches another one sooner than the link
+ * latency L, so when the earliest thing still to happen anywhere is at T, every
+ * module can deliver what it has before T + L without waiting for the others: no
+ * message that would have to come first can still turn up. The modules run their
+ * windows side by side, on up to -j cores, and then all wait for the slowest one
+ * before the next window.
+ *
+ * Messages to other modules go into their inbox, and are only taken out once every
+ * module has finished the window. As the queue orders messages due at the same
+ * time by the module that sent them, a run does not depend on the number of cores
+ * or on the order the threads happen to run in.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <panic.h>
+
+#include "sim.h"
+
+/* Stack of each module thread, the firmware needs far less. */
+#define SIM_NODE_STACK      (256 * 1024)
+
+/* Longest script file. */
+#define SIM_SCRIPT_MAX      (64 * 1024)
+
+int fw_main(void);
+
+uint16 sim_node_count;
+sim_node *sim_nodes;
+SIM_LOCAL sim_node *sim_self;
+
+/* Earliest message this module has sent another one in this window. */
+static SIM_LOCAL sim_time posted;
+
+static const char *out_dir;
+static sim_time end_time;
+static sem_t cores;
+
+/* Window barrier: the last module to get there works out the next window. */
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+static uint16 sync_waiting;
+static uint32 sync_round;
+static sim_time sync_min = SIM_NEVER;
+static sim_time window_end;
+static sim_time reached;
+static uint32 windows;
+
+bool sim_node_add(uint16 count, const char *script_path)
+{
+    FILE *f = fopen(script_path, "r");
+    char *text;
+    size_t len;
+    uint16 i;
+
+    if (!f)
+        return FALSE;
+
+    text = (char *)PanicUnlessMalloc(SIM_SCRIPT_MAX);
+    len = fread(text, 1, SIM_SCRIPT_MAX, f);
+    fclose(f);
+
+    sim_nodes = (sim_node *)PanicNull(realloc(sim_nodes,
+                                              (sim_node_count + count) * sizeof(sim_node)));
+
+    for (i=0; i<count; i++)
+    {
+        sim_node *node = &sim_nodes[sim_node_count];
+
+        memset(node, 0, sizeof(*node));
+        node->index = sim_node_count++;
+        node->addr.nap = 0x0002;
+        node->addr.uap = 0x5B;
+        node->addr.lap = 0x100000 + node->index;
+        node->script = text;
+        node->script_len = len;
+    }
+    return TRUE;
+}
+
+sim_node *sim_node_find(const bdaddr *addr)
+{
+    uint32 i = addr->lap - 0x100000;
+
+    if (addr->nap != 0x0002 || addr->uap != 0x5B || i >= sim_node_count)
+        return NULL;
+    return &sim_nodes[i];
+}
+
+void sim_post(sim_node *node, Task task, MessageId id, void *message, sim_time due)
+{
+    sim_msg *m;
+
+    if (!node || node == sim_self)
+    {
+        sim_send_at(task, id, message, due);
+        return;
+    }
+
+    /* The lookahead the windows rely on. */
+    if (due < sim_clock() + sim_link_default.latency)
+        due = sim_clock() + sim_link_default.latency;
+
+    m = sim_msg_new(task, id, message, due);
+    if (due < posted)
+        posted = due;
+
+    pthread_mutex_lock(&node->lock);
+    m->next = node->inbox;
+    node->inbox = m;
+    pthread_mutex_unlock(&node->lock);
+}
+
+/*************************************************************************
+NAME
+    node_sync
+
+DESCRIPTION
+    Wait for every module to finish the window, giving when the next thing
+    happens here.
+
+RETURNS
+    The end of the next window, SIM_NEVER to stop.
+*/
+static sim_time node_sync(sim_time next)
+{
+    uint32 round;
+    sim_time end;
+
+    pthread_mutex_lock(&sync_lock);
+
+    round = sync_round;
+    if (next < sync_min)
+        sync_min = next;
+
+    if (++sync_waiting == sim_node_count)
+    {
+        if (sync_min == SIM_NEVER || sync_min >= end_time)
+        {
+            window_end = SIM_NEVER;
+        }
+        else
+        {
+            window_end = sync_min + sim_link_default.latency;
+            if (window_end > end_time)
+                window_end = end_time;
+            reached = sync_min;
+            windows++;
+        }
+        sync_min = SIM_NEVER;
+        sync_waiting = 0;
+        sync_round++;
+        pthread_cond_broadcast(&sync_cond);
+    }
+    else
+    {
+        while (round == sync_round)
+            pthread_cond_wait(&sync_cond, &sync_lock);
+    }
+
+    end = window_end;
+    pthread_mutex_unlock(&sync_lock);
+    return end;
+}
+
+/*************************************************************************
+NAME
+    node_inbox
+
+DESCRIPTION
+    Queue the messages from other modules.
+
+RETURNS
+
+*/
+static void node_inbox(void)
+{
+    sim_msg *m;
+
+    pthread_mutex_lock(&sim_self->lock);
+    m = sim_self->inbox;
+    sim_self->inbox = NULL;
+    pthread_mutex_unlock(&sim_self->lock);
+
+    while (m)
+    {
+        sim_msg *next = m->next;
+
+        sim_msg_queue(m);
+        m = next;
+    }
+}
+
+void sim_node_loop(void)
+{
+    for (;;)
+    {
+        sim_time next = sim_next();
+        sim_time end;
+
+        /* What this module sent others in the window counts as theirs. */
+        if (posted < next)
+            next = posted;
+        posted = SIM_NEVER;
+
+        end = node_sync(next);
+        if (end == SIM_NEVER)
+            break;
+
+        sem_wait(&cores);
+        node_inbox();
+        sim_run_until(end);
+        sem_post(&cores);
+    }
+
+    sim_uart_close();
+    sim_self->messages = sim_messages;
+    pthread_exit(NULL);
+}
+
+/*************************************************************************
+NAME
+    node_thread
+
+DESCRIPTION
+    Thread of a module: set it up and run the firmware.
+
+RETURNS
+
+*/
+static void *node_thread(void *arg)
+{
+    sim_node *node = (sim_node *)arg;
+    int out = -1;
+
+    sim_self = node;
+    posted = SIM_NEVER;
+    sim_seed(sim_seed_base + node->index * 0x9E3779B9UL);
+
+    if (out_dir)
+    {
+        char path[1024];
+
+        snprintf(path, sizeof(path), "%s/node%03u.log", out_dir, node->index);
+        if ((out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+            perror(path);
+    }
+
+    sim_uart_open(-1, out);
+    sim_uart_script(node->script, node->script_len);
+
+    fw_main();
+    return NULL;
+}
+
+/*************************************************************************
+NAME
+    wall_seconds
+
+DESCRIPTION
+    Read the wall clock.
+
+RETURNS
+    Seconds.
+*/
+static double wall_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void sim_node_run(uint16 threads, uint32 end_ms, const char *dir)
+{
+    pthread_attr_t attr;
+    unsigned long messages = 0;
+    double start;
+    uint16 i;
+
+    out_dir = dir;
+    end_time = SIM_MS(end_ms);
+    sem_init(&cores, 0, threads);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SIM_NODE_STACK);
+
+    start = wall_seconds();
+
+    for (i=0; i<sim_node_count; i++)
+    {
+        pthread_mutex_init(&sim_nodes[i].lock, NULL);
+        if (pthread_create(&sim_nodes[i].thread, &attr, node_thread, &sim_nodes[i]))
+        {
+            perror("fwsim: thread");
+            exit(1);
+        }
+    }
+
+    for (i=0; i<sim_node_count; i++)
+    {
+        pthread_join(sim_nodes[i].thread, NULL);
+        messages += sim_nodes[i].messages;
+    }
+
+    fprintf(stderr, "fwsim: %u modules on %u cores: %.3f s simulated in %.3f s, "
+            "%lu windows, %lu messages\n", sim_node_count, threads,
+            reached / 1000000.0, wall_seconds() - start, (unsigned long)windows,
+            messages);
+    exit(0);
+}
+
+/* End-of-File */
@@ -0,0 +1,130 @@
+/*!
+ * @file sim_ps.c
+ *
+ * @brief Simulated persistent store.
+ *
+ * The user keys are kept in memory, and written to a file on every PsStore() if the
+ * simulator was started with one, so that what the application stores survives a
+ * restart like it survives a reset on the chip. The file has a line per key: the key
+ * and then its words, all in hex.
+ *
+ * With several modules each has a store of its own, which starts empty.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ps.h>
+
+#include "sim.h"
+
+/* User keys of the chip. */
+#define SIM_PS_KEYS     50
+
+/* Longest PS key. */
+#define SIM_PS_WORDS    64
+
+typedef struct
+{
+    uint16  words;      /* 0 when the key is not set */
+    uint16  data[SIM_PS_WORDS];
+} sim_ps_key;
+
+static SIM_LOCAL sim_ps_key keys[SIM_PS_KEYS];
+static const char *ps_path;
+
+/*************************************************************************
+NAME
+    ps_save
+
+DESCRIPTION
+    Write every key that is set to the file.
+
+RETURNS
+
+*/
+static void ps_save(void)
+{
+    FILE *f;
+    uint16 key;
+    uint16 i;
+
+    if (!ps_path || !(f = fopen(ps_path, "w")))
+        return;
+
+    for (key=0; key<SIM_PS_KEYS; key++)
+    {
+        if (!keys[key].words)
+            continue;
+
+        fprintf(f, "%04x", key);
+        for (i=0; i<keys[key].words; i++)
+            fprintf(f, " %04x", keys[key].data[i]);
+        fputc('\n', f);
+    }
+    fclose(f);
+}
+
+void sim_ps_open(const char *path)
+{
+    FILE *f;
+    char line[SIM_PS_WORDS * 5 + 16];
+
+    ps_path = path;
+
+    if (!(f = fopen(path, "r")))
+        return;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char *p = line;
+        char *end;
+        unsigned long key = strtoul(p, &end, 16);
+        sim_ps_key *k;
+
+        if (end == p || key >= SIM_PS_KEYS)
+            continue;
+
+        k = &keys[key];
+        k->words = 0;
+
+        for (p = end; k->words < SIM_PS_WORDS; p = end)
+        {
+            unsigned long w = strtoul(p, &end, 16);
+
+            if (end == p)
+                break;
+            k->data[k->words++] = (uint16)w;
+        }
+    }
+    fclose(f);
+}
+
+uint16 PsStore(uint16 key, const void *buff, uint16 words)
+{
+    if (key >= SIM_PS_KEYS || words > SIM_PS_WORDS)
+        return 0;
+
+    keys[key].words = words;
+    if (words)
+        memmove(keys[key].data, buff, words * sizeof(uint16));
+
+    ps_save();
+    return words;
+}
+
+uint16 PsRetrieve(uint16 key, void *buff, uint16 words)
+{
+    if (key >= SIM_PS_KEYS || !keys[key].words)
+        return 0;
+
+    /* With no buffer, only the size is asked for. */
+    if (buff && words)
+        memmove(buff, keys[key].data,
+                ((words < keys[key].words) ? words : keys[key].words) * sizeof(uint16));
+
+    return keys[key].words;
+}
+
+/* End-of-File */
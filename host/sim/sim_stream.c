@@ -0,0 +1,921 @@
+/*!
+ * @file sim_stream.c
+ *
+ * @brief Simulated sinks and sources, and the radio link model.
+ *
+ * Every end point has a sink buffer, which the application claims space in and
+ * flushes, and a source buffer it reads and drops from.
+ *
+ * Data flushed into an RFCOMM sink is cut into packets of up to the frame size, one
+ * per credit. Each packet takes its turn on the link to the peer, for as long as its
+ * size at the link rate takes, is sent again if it is lost, and is delivered to the
+ * source of the other end after the link latency. Once the application there has
+ * dropped the whole packet, the credit goes back. So a slow reader holds back the
+ * writer like RFCOMM credit flow control does on the chip, and the sink only has
+ * room again as fast as the link and the reader allow.
+ *
+ * The UART sink is drained at the UART bit rate. Output written while the sink is
+ * full busy waits in the firmware, and the clock moves on while it does.
+ *
+ * The two ends of a channel between modules are in different threads. Packets and
+ * credits go to the other end with sim_post(), and each end only ever touches its
+ * own end point, finding out that the other end has closed from sim_conn.c.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <message.h>
+#include <panic.h>
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+
+#include "sim.h"
+
+/* Bytes on the air for each packet, next to the payload: baseband, L2CAP and
+ * RFCOMM headers.
+ */
+#define SIM_PACKET_OVERHEAD     14
+
+/* Time before a lost packet is sent again: the next master and slave slots. */
+#define SIM_RETRANSMIT          1250
+
+/* A baseband slot. */
+#define SIM_SLOT                625
+
+/* Time after a sniff anchor that master and slave listen for: four attempts of a
+ * master and a slave slot each.
+ */
+#define SIM_SNIFF_WINDOW        (4 * 2 * SIM_SLOT)
+
+/* Bytes the UART sends out in one go. */
+#define SIM_UART_CHUNK          16
+
+/* Time before trying again when the UART can not be written. */
+#define SIM_UART_RETRY          1000
+
+/* Messages of the link task. */
+enum
+{
+    SIM_LINK_PACKET = 0x7100,   /* a packet arrives */
+    SIM_LINK_CREDIT,            /* a credit comes back */
+    SIM_UART_DRAIN              /* the UART has sent a chunk */
+};
+
+typedef struct
+{
+    sim_ep *to;
+    uint16  len;
+    uint8   data[1];
+} SIM_LINK_PACKET_T;
+
+typedef struct
+{
+    sim_ep *to;
+} SIM_LINK_CREDIT_T;
+
+static SIM_LOCAL sim_ep *uart;
+static SIM_LOCAL int uart_in = -1;
+static SIM_LOCAL int uart_out = -1;
+static SIM_LOCAL bool uart_eof;
+static SIM_LOCAL uint16 uart_chunk;     /* being sent, 0 if the UART is idle */
+static SIM_LOCAL sim_time uart_done;    /* when it has been */
+
+/* UART input from memory, what is left of it. */
+static SIM_LOCAL const char *script;
+static SIM_LOCAL size_t script_left;
+
+/* UART input not fed to the application yet. */
+static SIM_LOCAL uint8 input[SIM_UART_BUFFER];
+static SIM_LOCAL uint16 input_len;
+static SIM_LOCAL sim_time input_resume = SIM_NEVER;
+
+uint32 sim_uart_baud = 115200;
+SIM_LOCAL sim_time sim_uart_spin;
+
+static void ep_transmit(sim_ep *ep, bool notify);
+static void link_handler(Task task, MessageId id, Message message);
+
+static TaskData link_task = { link_handler };
+
+/*************************************************************************
+NAME
+    pump
+
+DESCRIPTION
+    Move data from a source to the sink it is StreamConnect()ed to, as far
+    as it fits.
+
+RETURNS
+
+*/
+static void pump(sim_ep *ep)
+{
+    while (ep->connect && ep->rx_len)
+    {
+        sim_ep *to = ep->connect;
+        uint16 n = SinkSlack(SIM_SINK(to));
+        uint16 off;
+
+        if (n > ep->rx_len)
+            n = ep->rx_len;
+        if (!n || (off = SinkClaim(SIM_SINK(to), n)) == 0xFFFF)
+            break;
+
+        memmove(SinkMap(SIM_SINK(to)) + off, ep->rx, n);
+        SourceDrop(SIM_SOURCE(ep), n);
+        SinkFlush(SIM_SINK(to), n);
+    }
+}
+
+/*************************************************************************
+NAME
+    stream_handler
+
+DESCRIPTION
+    Handler of the task that moves StreamConnect()ed data. Moving it from a
+    message, rather than straight away, keeps two connected streams feeding
+    each other from recursing, and takes time like it does on the chip.
+
+RETURNS
+
+*/
+static void stream_handler(Task task, MessageId id, Message message)
+{
+    if (id == MESSAGE_MORE_DATA)
+        pump(SIM_EP(((const MessageMoreData *)message)->source));
+}
+
+static TaskData stream_task = { stream_handler };
+
+/*************************************************************************
+NAME
+    data_arrived
+
+DESCRIPTION
+    New data is in the source of an end point. Tell the task that owns it,
+    or the stream task if the source is StreamConnect()ed.
+
+RETURNS
+
+*/
+static void data_arrived(sim_ep *ep)
+{
+    Task task = ep->connect ? &stream_task : ep->task;
+
+    if (ep->rx_len && task && !ep->more_data)
+    {
+        MessageMoreData *m = PanicUnlessNew(MessageMoreData);
+
+        m->source = SIM_SOURCE(ep);
+        ep->more_data = TRUE;
+        MessageSend(task, MESSAGE_MORE_DATA, m);
+    }
+}
+
+/*************************************************************************
+NAME
+    link_schedule
+
+DESCRIPTION
+    Send a packet of len bytes on a link, after the ones already on it, and
+    again for as long as it is lost. A link in sniff only sends just after
+    its sniff anchors.
+
+RETURNS
+    When it gets to the other end, SIM_NEVER if the peer is out of range for
+    good.
+*/
+static sim_time link_schedule(sim_link *link, uint16 len)
+{
+    sim_time t = sim_clock();
+    sim_time air = link->rate ?
+                   (sim_time)(len + SIM_PACKET_OVERHEAD) * 8 * 1000000 / link->rate : 0;
+
+    if (link->busy_until > t)
+        t = link->busy_until;
+
+    for (;;)
+    {
+        if (t >= link->outage_start && t < link->outage_end)
+        {
+            if (link->outage_end == SIM_NEVER)
+                return SIM_NEVER;
+            t = link->outage_end;
+        }
+
+        if (link->sniff)
+        {
+            sim_time period = (sim_time)link->sniff * SIM_SLOT;
+            sim_time into = (t - link->anchor) % period;
+
+            if (into >= SIM_SNIFF_WINDOW)
+                t += period - into;
+        }
+
+        t += air;
+        if (!link->loss || sim_random() >= link->loss)
+            break;
+
+        link->retries++;
+        t += SIM_RETRANSMIT;
+    }
+
+    link->busy_until = t;
+    link->packets++;
+    return t + link->latency;
+}
+
+/*************************************************************************
+NAME
+    ep_notify
+
+DESCRIPTION
+    Space has been freed in the sink of an end point. Use it to move more
+    data from a source StreamConnect()ed to the sink, or announce it with
+    MESSAGE_MORE_SPACE.
+
+RETURNS
+
+*/
+static void ep_notify(sim_ep *ep)
+{
+    if (ep->connect_from)
+    {
+        data_arrived(ep->connect_from);
+    }
+    else if (ep->task && !ep->more_space)
+    {
+        MessageMoreSpace *m = PanicUnlessNew(MessageMoreSpace);
+
+        m->sink = SIM_SINK(ep);
+        ep->more_space = TRUE;
+        MessageSend(ep->task, MESSAGE_MORE_SPACE, m);
+    }
+}
+
+/*************************************************************************
+NAME
+    uart_start
+
+DESCRIPTION
+    Start sending the next chunk of UART output, if the UART is idle.
+
+RETURNS
+
+*/
+static void uart_start(void)
+{
+    if (uart_chunk || !uart->tx_queued)
+        return;
+
+    uart_chunk = (uart->tx_queued < SIM_UART_CHUNK) ? uart->tx_queued : SIM_UART_CHUNK;
+    uart_done = sim_clock();
+    if (sim_uart_baud)
+        uart_done += (sim_time)uart_chunk * 10 * 1000000 / sim_uart_baud;
+
+    sim_send_at(&link_task, SIM_UART_DRAIN, NULL, uart_done);
+}
+
+/*************************************************************************
+NAME
+    uart_drain
+
+DESCRIPTION
+    The chunk of UART output being sent has been: write it out and start
+    on the next.
+
+RETURNS
+
+*/
+static void uart_drain(void)
+{
+    ssize_t w = uart_chunk;
+
+    if (uart_out >= 0)
+    {
+        w = write(uart_out, uart->tx, uart_chunk);
+
+        if (w < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            /* The terminal is not keeping up, which the chip does not see. */
+            uart_done = sim_clock() + SIM_UART_RETRY;
+            sim_send_at(&link_task, SIM_UART_DRAIN, NULL, uart_done);
+            return;
+        }
+        if (w <= 0)
+            w = uart_chunk;     /* Nobody listening, it is lost. */
+    }
+
+    memmove(uart->tx, uart->tx + w, uart->tx_queued + uart->tx_claimed - w);
+    uart->tx_queued -= (uint16)w;
+    uart_chunk = 0;
+
+    uart_start();
+    ep_notify(uart);
+}
+
+/*************************************************************************
+NAME
+    ep_transmit
+
+DESCRIPTION
+    Move flushed data out of the sink of an end point: onto the link to
+    its peer as far as there are credits, or out of the UART.
+
+    With notify set, space that is freed is announced.
+
+RETURNS
+
+*/
+static void ep_transmit(sim_ep *ep, bool notify)
+{
+    uint16 moved = 0;
+
+    if (!ep->open)
+        return;
+
+    if (ep->type == SIM_EP_UART)
+    {
+        uart_start();
+        return;
+    }
+
+    /* The other end of a channel to another module can not be looked at. */
+    while (ep->tx_queued && ep->credits && ep->peer &&
+           (ep->peer->node != ep->node || ep->peer->open))
+    {
+        uint16 n = (ep->tx_queued < ep->frame) ? ep->tx_queued : ep->frame;
+        sim_time due = link_schedule(ep->link, n);
+
+        if (due != SIM_NEVER)
+        {
+            SIM_LINK_PACKET_T *m = (SIM_LINK_PACKET_T *)
+                                   PanicUnlessMalloc(sizeof(SIM_LINK_PACKET_T) + n);
+
+            m->to = ep->peer;
+            m->len = n;
+            memmove(m->data, ep->tx, n);
+            sim_post(ep->peer->node, &link_task, SIM_LINK_PACKET, m, due);
+        }
+
+        /* Claimed data moves down with the rest. */
+        memmove(ep->tx, ep->tx + n, ep->tx_queued + ep->tx_claimed - n);
+        ep->tx_queued -= n;
+        ep->credits--;
+        moved += n;
+    }
+
+    if (moved && notify)
+        ep_notify(ep);
+}
+
+/*************************************************************************
+NAME
+    credits_return
+
+DESCRIPTION
+    The application has dropped data from the source of an end point. For
+    every packet it has dropped all of, send the credit back.
+
+RETURNS
+
+*/
+static void credits_return(sim_ep *ep, uint16 amount)
+{
+    while (amount && ep->rx_count)
+    {
+        uint16 left = ep->rx_frames[ep->rx_head] - ep->rx_used;
+        uint16 n = (amount < left) ? amount : left;
+
+        amount -= n;
+        ep->rx_used += n;
+
+        if (ep->rx_used == ep->rx_frames[ep->rx_head])
+        {
+            ep->rx_head = (ep->rx_head + 1) % SIM_MAX_CREDITS;
+            ep->rx_count--;
+            ep->rx_used = 0;
+
+            if (ep->peer && ep->link)
+            {
+                SIM_LINK_CREDIT_T *m = PanicUnlessNew(SIM_LINK_CREDIT_T);
+
+                m->to = ep->peer;
+                sim_post(ep->peer->node, &link_task, SIM_LINK_CREDIT, m,
+                         sim_clock() + ep->link->latency);
+            }
+        }
+    }
+}
+
+/*************************************************************************
+NAME
+    link_handler
+
+DESCRIPTION
+    Message handler of the link model.
+
+RETURNS
+
+*/
+static void link_handler(Task task, MessageId id, Message message)
+{
+    switch (id)
+    {
+        case SIM_LINK_PACKET:
+        {
+            const SIM_LINK_PACKET_T *m = (const SIM_LINK_PACKET_T *)message;
+
+            /* Credits make sure there is room, unless the channel has gone while
+             * the packet was on its way.
+             */
+            if (!sim_ep_receive(m->to, m->data, m->len) && m->to->open)
+                Panic();
+            break;
+        }
+
+        case SIM_LINK_CREDIT:
+        {
+            sim_ep *to = ((const SIM_LINK_CREDIT_T *)message)->to;
+
+            if (to->open)
+            {
+                to->credits++;
+                ep_transmit(to, TRUE);
+            }
+            break;
+        }
+
+        case SIM_UART_DRAIN:
+            uart_drain();
+            break;
+
+        default:
+            break;
+    }
+}
+
+sim_ep *sim_ep_new(sim_ep_type type, uint16 size)
+{
+    sim_ep *ep = (sim_ep *)PanicNull(calloc(1, sizeof(sim_ep)));
+
+    ep->type = type;
+    ep->open = TRUE;
+    ep->node = sim_self;
+    ep->tx = (uint8 *)PanicUnlessMalloc(size);
+    ep->tx_size = size;
+    ep->rx = (uint8 *)PanicUnlessMalloc(size);
+    ep->rx_size = size;
+    return ep;
+}
+
+bool sim_ep_receive(sim_ep *ep, const uint8 *data, uint16 len)
+{
+    if (!ep->open || len > ep->rx_size - ep->rx_len ||
+        (ep->type == SIM_EP_RFCOMM && ep->rx_count == SIM_MAX_CREDITS))
+        return FALSE;
+
+    memmove(ep->rx + ep->rx_len, data, len);
+    ep->rx_len += len;
+
+    /* RFCOMM sends a credit back for every packet once it has been read. */
+    if (ep->type == SIM_EP_RFCOMM)
+    {
+        ep->rx_frames[(ep->rx_head + ep->rx_count) % SIM_MAX_CREDITS] = len;
+        ep->rx_count++;
+    }
+
+    if (sim_tracing)
+        sim_trace_input(ep, data, len);
+    data_arrived(ep);
+    return TRUE;
+}
+
+void sim_ep_pair(sim_ep *a, sim_ep *b)
+{
+    a->peer = b;
+    b->peer = a;
+}
+
+void sim_ep_link(sim_ep *ep, sim_link *link, uint16 frame, uint16 credits)
+{
+    ep->link = link;
+    ep->frame = frame;
+    ep->credits = credits;
+
+    /* The other end has room for every packet there are credits for. */
+    if (frame * credits > ep->rx_size)
+    {
+        free(ep->rx);
+        ep->rx_size = frame * credits;
+        ep->rx = (uint8 *)PanicUnlessMalloc(ep->rx_size);
+    }
+}
+
+void sim_ep_close(sim_ep *ep)
+{
+    sim_ep *ends[2];
+    uint16 i;
+
+    ends[0] = ep;
+    ends[1] = (ep->peer && ep->peer->node == ep->node) ? ep->peer : NULL;
+
+    for (i=0; i<2; i++)
+    {
+        sim_ep *e = ends[i];
+
+        if (!e)
+            continue;
+
+        e->open = FALSE;
+        e->tx_queued = 0;
+        e->tx_claimed = 0;
+        e->rx_len = 0;
+        e->rx_count = 0;
+        e->rx_used = 0;
+
+        if (e->connect)
+            e->connect->connect_from = NULL;
+        if (e->connect_from)
+            e->connect_from->connect = NULL;
+        e->connect = NULL;
+        e->connect_from = NULL;
+    }
+
+    /*
+     * The end points are not freed: the application may still hold the sink, and
+     * on the chip a closed sink stays an invalid one rather than a dangling one.
+     */
+}
+
+uint16 SinkSlack(Sink sink)
+{
+    sim_ep *ep = SIM_EP(sink);
+
+    if (!ep || !ep->open)
+        return 0;
+    return ep->tx_size - ep->tx_queued - ep->tx_claimed;
+}
+
+uint16 SinkClaim(Sink sink, uint16 extra)
+{
+    sim_ep *ep = SIM_EP(sink);
+    uint16 off;
+
+    if (!ep || !ep->open || extra > SinkSlack(sink))
+        return 0xFFFF;
+
+    off = ep->tx_claimed;
+    ep->tx_claimed += extra;
+    return off;
+}
+
+uint8 *SinkMap(Sink sink)
+{
+    sim_ep *ep = SIM_EP(sink);
+
+    if (!ep || !ep->open)
+        return NULL;
+    return ep->tx + ep->tx_queued;
+}
+
+bool SinkFlush(Sink sink, uint16 amount)
+{
+    sim_ep *ep = SIM_EP(sink);
+
+    if (!ep || !ep->open)
+        return FALSE;
+
+    if (amount > ep->tx_claimed)
+    {
+        /*
+         * Nothing to flush. ui.c does this in a loop while the UART sink is full,
+         * so that is the firmware busy waiting for the chunk being sent.
+         */
+        if (ep == uart && uart_chunk)
+        {
+            sim_uart_spin += (uart_done > sim_clock()) ? uart_done - sim_clock() : 0;
+            MessageCancelFirst(&link_task, SIM_UART_DRAIN);
+            sim_spin_until(uart_done);
+            uart_drain();
+        }
+        return FALSE;
+    }
+
+    ep->tx_claimed -= amount;
+    ep->tx_queued += amount;
+    sim_out_bytes += amount;
+    ep_transmit(ep, FALSE);
+    return TRUE;
+}
+
+bool SinkConfigure(Sink sink, uint16 key, uint16 value)
+{
+    return SIM_EP(sink) != NULL;
+}
+
+bool SinkIsValid(Sink sink)
+{
+    sim_ep *ep = SIM_EP(sink);
+
+    return ep && ep->open;
+}
+
+bool SinkClose(Sink sink)
+{
+    sim_ep *ep = SIM_EP(sink);
+
+    if (!ep || !ep->open || ep->type == SIM_EP_UART)
+        return FALSE;
+
+    sim_ep_close(ep);
+    return TRUE;
+}
+
+uint16 SourceSize(Source source)
+{
+    sim_ep *ep = SIM_EP(source);
+
+    if (!ep || !ep->open)
+        return 0;
+    return ep->rx_len;
+}
+
+const uint8 *SourceMap(Source source)
+{
+    sim_ep *ep = SIM_EP(source);
+
+    if (!ep || !ep->open)
+        return NULL;
+    return ep->rx;
+}
+
+void SourceDrop(Source source, uint16 amount)
+{
+    sim_ep *ep = SIM_EP(source);
+
+    if (!ep || !ep->open)
+        return;
+
+    if (amount > ep->rx_len)
+        amount = ep->rx_len;
+
+    memmove(ep->rx, ep->rx + amount, ep->rx_len - amount);
+    ep->rx_len -= amount;
+
+    credits_return(ep, amount);
+}
+
+uint16 SourceBoundary(Source source)
+{
+    return SourceSize(source);
+}
+
+Sink StreamUartSink(void)
+{
+    if (!uart)
+        uart = sim_ep_new(SIM_EP_UART, SIM_UART_BUFFER);
+    return SIM_SINK(uart);
+}
+
+Source StreamSourceFromSink(Sink sink)
+{
+    return (Source)(void *)sink;
+}
+
+Sink StreamSinkFromSource(Source source)
+{
+    return (Sink)(void *)source;
+}
+
+bool StreamConnect(Source source, Sink sink)
+{
+    sim_ep *from = SIM_EP(source);
+    sim_ep *to = SIM_EP(sink);
+
+    if (!from || !to || !from->open || !to->open || from->connect || to->connect_from)
+        return FALSE;
+
+    from->connect = to;
+    to->connect_from = from;
+
+    pump(from);
+    return TRUE;
+}
+
+void StreamDisconnect(Source source, Sink sink)
+{
+    sim_ep *from = SIM_EP(source);
+    sim_ep *to = SIM_EP(sink);
+
+    if (from && from->connect)
+    {
+        from->connect->connect_from = NULL;
+        from->connect = NULL;
+    }
+    if (to && to->connect_from)
+    {
+        to->connect_from->connect = NULL;
+        to->connect_from = NULL;
+    }
+}
+
+Task MessageSinkTask(Sink sink, Task task)
+{
+    sim_ep *ep = SIM_EP(sink);
+    Task old;
+
+    if (!ep)
+        return NULL;
+
+    old = ep->task;
+    ep->task = task;
+
+    /* Data that came in before there was a task to tell. */
+    data_arrived(ep);
+    return old;
+}
+
+void sim_stream_delivered(MessageId id, Message message)
+{
+    if (id == MESSAGE_MORE_DATA)
+        SIM_EP(((const MessageMoreData *)message)->source)->more_data = FALSE;
+    else if (id == MESSAGE_MORE_SPACE)
+        SIM_EP(((const MessageMoreSpace *)message)->sink)->more_space = FALSE;
+}
+
+void sim_uart_open(int in_fd, int out_fd)
+{
+    uart_in = in_fd;
+    uart_out = out_fd;
+    uart_eof = FALSE;
+    StreamUartSink();
+}
+
+void sim_uart_script(const char *text, size_t len)
+{
+    script = text;
+    script_left = len;
+    uart_eof = !len;
+}
+
+/*************************************************************************
+NAME
+    input_read
+
+DESCRIPTION
+    Read more UART input, waiting for it if block is set.
+
+RETURNS
+    TRUE if there was more input, or it has ended.
+*/
+static bool input_read(bool block)
+{
+    struct pollfd fd;
+    ssize_t r;
+
+    if (uart_eof || input_len == sizeof(input))
+        return FALSE;
+
+    if (script)
+    {
+        size_t n = sizeof(input) - input_len;
+
+        if (n > script_left)
+            n = script_left;
+        memmove(input + input_len, script, n);
+        input_len += (uint16)n;
+        script += n;
+        script_left -= n;
+        uart_eof = !script_left;
+        return TRUE;
+    }
+
+    fd.fd = uart_in;
+    fd.events = POLLIN;
+    if (poll(&fd, 1, block ? -1 : 0) <= 0)
+        return FALSE;
+
+    r = read(uart_in, input + input_len, sizeof(input) - input_len);
+    if (r > 0)
+        input_len += (uint16)r;
+    else if (r == 0 || (errno != EAGAIN && errno != EINTR))
+        uart_eof = TRUE;
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+bool sim_uart_feed(void)
+{
+    bool fed = FALSE;
+
+    if (uart_in < 0 && !script)
+        return FALSE;
+
+    for (;;)
+    {
+        uint16 len;
+
+        if (input_resume != SIM_NEVER)
+        {
+            if (sim_clock() < input_resume)
+                break;
+            input_resume = SIM_NEVER;
+        }
+
+        for (len=0; len<input_len && input[len] != '\r' && input[len] != '\n'; len++)
+            ;
+
+        /* A line is complete with its end, at the end of the input, or when it
+         * fills the buffer.
+         */
+        if (len < input_len)
+            len++;
+        else if (!uart_eof && input_len < sizeof(input))
+        {
+            if (input_read(!sim_realtime))
+                continue;
+            break;
+        }
+
+        if (!len)
+            break;
+
+        if (input[0] == '@')
+        {
+            uint16 i;
+            uint32 ms = 0;
+
+            for (i=1; i<len && input[i] >= '0' && input[i] <= '9'; i++)
+                ms = ms * 10 + (input[i] - '0');
+
+            input_resume = sim_clock() + SIM_MS(ms);
+        }
+        else if (sim_ep_receive(uart, input, len))
+        {
+            fed = TRUE;
+        }
+        else
+        {
+            /* Wait for the application to read what it has. */
+            break;
+        }
+
+        memmove(input, input + len, input_len - len);
+        input_len -= len;
+    }
+
+    return fed;
+}
+
+sim_time sim_uart_resume(void)
+{
+    return input_resume;
+}
+
+bool sim_uart_ended(void)
+{
+    return ((uart_in < 0 && !script) || uart_eof) && !input_len &&
+           input_resume == SIM_NEVER;
+}
+
+void sim_uart_wait(sim_time until)
+{
+    sim_time now = sim_clock();
+    struct pollfd fd;
+    int timeout = -1;
+
+    if (until != SIM_NEVER)
+        timeout = (until > now) ? (int)((until - now + 999) / 1000) : 0;
+
+    fd.fd = uart_in;
+    fd.events = POLLIN;
+
+    /* Nothing to wait for but the time. */
+    if (uart_in < 0 || uart_eof || input_len == sizeof(input))
+        fd.fd = -1;
+
+    if (poll(&fd, 1, timeout) > 0)
+        input_read(FALSE);
+}
+
+void sim_uart_close(void)
+{
+    if (uart && uart_out >= 0 && uart->tx_queued)
+    {
+        ssize_t w = write(uart_out, uart->tx, uart->tx_queued);
+
+        (void)w;
+    }
+}
+
+/* End-of-File */
@@ -0,0 +1,689 @@
+/*!
+ * @file sim_trace.c
+ *
+ * @brief Recording a run of the firmware, and replaying it on another build.
+ *
+ * With -R the simulator records everything the application gets from outside:
+ * every message delivered to its task, the UART input, and the data coming in on
+ * each RFCOMM channel, with the time it came. With -P it replays such a trace
+ * instead of simulating the Connection library and the peers. The recorded
+ * Connection library messages and the input go to the application when they did,
+ * and the application does the rest: its own messages, MESSAGE_MORE_DATA and
+ * MESSAGE_MORE_SPACE come from what it does, not from the trace. So two builds
+ * can be compared on exactly the same workload, and at the end of a replay the
+ * time taken in the handler and the bytes output are reported for every message.
+ *
+ * A record is only replayed once the application has done everything that was due
+ * before it, so that what it does about one record comes before the next even when
+ * they were recorded at the same time.
+ *
+ * Sinks in the trace are numbered in the order they first turn up. On replay
+ * each becomes a channel whose other end drops what it gets, over a link with
+ * the rate and latency of the recording.
+ *
+ * The file starts with "FWTR", a version byte and the UART and link settings.
+ * Then every record is a kind byte, the microseconds since the record before,
+ * and what it holds, all numbers as LEB128 varints:
+ *
+ *     'M' id, size, payload   a message to the application task
+ *     'U' size, data          UART input
+ *     'R' sink, size, data    data in from an RFCOMM channel
+ */
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <message.h>
+#include <panic.h>
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+
+#include "sim.h"
+
+#define SIM_TRACE_MAGIC     "FWTR"
+#define SIM_TRACE_VERSION   1
+
+/* Sinks a trace can hold. */
+#define SIM_TRACE_SINKS     256
+
+/* Message ids that have statistics kept. */
+#define SIM_TRACE_IDS       64
+
+/* Message of the replay task: the next record is due. */
+#define SIM_TRACE_NEXT      0x7300
+
+/*!
+ * @brief Statistics of the messages with one id.
+ */
+typedef struct
+{
+    MessageId   id;
+    uint32      count;
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint32      out_bytes;
+} sim_trace_stat;
+
+/*!
+ * @brief Where the sink of a Connection library message is.
+ */
+typedef struct
+{
+    MessageId   id;
+    size_t      offset;
+} sim_trace_sink_field;
+
+static const sim_trace_sink_field sink_fields[] =
+{
+    { CL_RFCOMM_CONNECT_IND,        offsetof(CL_RFCOMM_CONNECT_IND_T, sink) },
+    { CL_RFCOMM_SERVER_CONNECT_CFM, offsetof(CL_RFCOMM_SERVER_CONNECT_CFM_T, sink) },
+    { CL_RFCOMM_CLIENT_CONNECT_CFM, offsetof(CL_RFCOMM_CLIENT_CONNECT_CFM_T, sink) },
+    { CL_RFCOMM_DISCONNECT_CFM,     offsetof(CL_RFCOMM_DISCONNECT_CFM_T, sink) },
+    { CL_RFCOMM_DISCONNECT_IND,     offsetof(CL_RFCOMM_DISCONNECT_IND_T, sink) },
+    { CL_RFCOMM_CONTROL_IND,        offsetof(CL_RFCOMM_CONTROL_IND_T, sink) },
+    { CL_RFCOMM_LINE_STATUS_IND,    offsetof(CL_RFCOMM_LINE_STATUS_IND_T, sink) },
+    { CL_DM_RSSI_CFM,               offsetof(CL_DM_RSSI_CFM_T, sink) },
+    { CL_DM_LINK_QUALITY_CFM,       offsetof(CL_DM_LINK_QUALITY_CFM_T, sink) }
+};
+
+static const char *const cl_names[] =
+{
+    "CL_INIT_CFM", "CL_DM_LOCAL_BD_ADDR_CFM", "CL_DM_LOCAL_NAME_COMPLETE",
+    "CL_RFCOMM_REGISTER_CFM", "CL_SDP_REGISTER_CFM", "CL_SDP_UNREGISTER_CFM",
+    "CL_SM_REMOTE_IO_CAPABILITY_IND", "CL_SM_IO_CAPABILITY_REQ_IND",
+    "CL_SM_AUTHORISE_IND", "CL_RFCOMM_CONNECT_IND", "CL_RFCOMM_SERVER_CONNECT_CFM",
+    "CL_DM_INQUIRE_RESULT", "CL_SM_REGISTER_OUTGOING_SERVICE_CFM",
+    "CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM", "CL_RFCOMM_CLIENT_CONNECT_CFM",
+    "CL_DM_ACL_OPENED_IND", "CL_RFCOMM_DISCONNECT_CFM", "CL_RFCOMM_DISCONNECT_IND",
+    "CL_DM_ACL_CLOSED_IND", "CL_SM_AUTHENTICATE_CFM", "CL_RFCOMM_CONTROL_IND",
+    "CL_RFCOMM_LINE_STATUS_IND", "CL_SM_ENCRYPTION_KEY_REFRESH_IND",
+    "CL_SM_ENCRYPTION_CHANGE_IND", "CL_DM_MODE_CHANGE_EVENT", "CL_DM_RSSI_CFM",
+    "CL_DM_LINK_QUALITY_CFM"
+};
+
+bool sim_tracing;
+SIM_LOCAL uint32 sim_out_bytes;
+
+static Task app_task;
+
+/* Recording. */
+static FILE *rec;
+static sim_time rec_last;
+static Sink rec_sinks[SIM_TRACE_SINKS];
+static uint16 rec_sink_count;
+
+/* Replaying. */
+static const char *play_path;
+static uint8 *play;
+static size_t play_len;
+static size_t play_pos;
+static sim_time play_last;
+static uint32 play_records;
+static uint32 play_dropped;     /* input bytes the application had no room for */
+static sim_ep *play_sinks[SIM_TRACE_SINKS];
+static sim_link play_link;
+
+static sim_trace_stat stats[SIM_TRACE_IDS];
+static uint16 stat_count;
+
+static void play_handler(Task task, MessageId id, Message message);
+
+static TaskData play_task = { play_handler };
+
+/*************************************************************************
+NAME
+    put_varint
+
+DESCRIPTION
+    Write a number to the trace, seven bits a byte, lowest first.
+
+RETURNS
+
+*/
+static void put_varint(uint64_t n)
+{
+    while (n >= 0x80)
+    {
+        fputc((int)(n & 0x7F) | 0x80, rec);
+        n >>= 7;
+    }
+    fputc((int)n, rec);
+}
+
+/*************************************************************************
+NAME
+    play_need
+
+DESCRIPTION
+    Check that the trace being replayed has n more bytes.
+
+RETURNS
+    Only if it has, a trace that ends early panics.
+*/
+static void play_need(uint64_t n)
+{
+    if (n > play_len - play_pos)
+    {
+        fprintf(stderr, "fwsim: %s is cut short\n", play_path);
+        Panic();
+    }
+}
+
+/*************************************************************************
+NAME
+    get_varint
+
+DESCRIPTION
+    Read a number from the trace being replayed.
+
+RETURNS
+    The number. A trace that ends early panics.
+*/
+static uint64_t get_varint(void)
+{
+    uint64_t n = 0;
+    uint16 shift = 0;
+
+    for (;;)
+    {
+        uint8 b;
+
+        play_need(1);
+        if (shift > 63)
+            Panic();
+        b = play[play_pos++];
+        n |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return n;
+        shift += 7;
+    }
+}
+
+/*************************************************************************
+NAME
+    put_record
+
+DESCRIPTION
+    Start a record: its kind and the time since the one before.
+
+RETURNS
+
+*/
+static void put_record(char kind)
+{
+    sim_time now = sim_clock();
+
+    fputc(kind, rec);
+    put_varint(now - rec_last);
+    rec_last = now;
+}
+
+/*************************************************************************
+NAME
+    rec_sink
+
+DESCRIPTION
+    Number a sink for the trace, the first time it turns up.
+
+RETURNS
+    Its number.
+*/
+static uint16 rec_sink(Sink sink)
+{
+    uint16 i;
+
+    for (i=0; i<rec_sink_count; i++)
+    {
+        if (rec_sinks[i] == sink)
+            return i;
+    }
+    if (rec_sink_count == SIM_TRACE_SINKS)
+    {
+        fprintf(stderr, "fwsim: more than %d sinks to trace\n", SIM_TRACE_SINKS);
+        Panic();
+    }
+    rec_sinks[rec_sink_count] = sink;
+    return rec_sink_count++;
+}
+
+/*************************************************************************
+NAME
+    sink_field
+
+DESCRIPTION
+    Find the sink in a Connection library message.
+
+RETURNS
+    Its offset, or (size_t)-1 if the message has none.
+*/
+static size_t sink_field(MessageId id)
+{
+    uint16 i;
+
+    for (i=0; i<sizeof(sink_fields)/sizeof(sink_fields[0]); i++)
+    {
+        if (sink_fields[i].id == id)
+            return sink_fields[i].offset;
+    }
+    return (size_t)-1;
+}
+
+/*************************************************************************
+NAME
+    is_cl
+
+DESCRIPTION
+    Check for a Connection library message, which the trace replays.
+
+RETURNS
+    TRUE if it is one.
+*/
+static bool is_cl(MessageId id)
+{
+    return id >= CL_MESSAGE_BASE &&
+           id < CL_MESSAGE_BASE + sizeof(cl_names) / sizeof(cl_names[0]);
+}
+
+void sim_trace_record(const char *path)
+{
+    if (!(rec = fopen(path, "wb")))
+    {
+        perror(path);
+        exit(1);
+    }
+
+    fputs(SIM_TRACE_MAGIC, rec);
+    fputc(SIM_TRACE_VERSION, rec);
+    put_varint(sim_uart_baud);
+    put_varint(sim_link_default.rate);
+    put_varint(sim_link_default.latency);
+    put_varint(sim_credits);
+    sim_tracing = TRUE;
+}
+
+void sim_trace_replay(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    size_t size = 0;
+
+    if (!f)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    for (;;)
+    {
+        play = (uint8 *)PanicNull(realloc(play, size + 65536));
+        play_len += fread(play + play_len, 1, 65536, f);
+        size += 65536;
+        if (play_len < size)
+            break;
+    }
+    fclose(f);
+
+    play_path = path;
+    if (play_len < 5 || memcmp(play, SIM_TRACE_MAGIC, 4) || play[4] != SIM_TRACE_VERSION)
+    {
+        fprintf(stderr, "fwsim: %s is not a trace\n", path);
+        exit(1);
+    }
+    play_pos = 5;
+
+    /* Output takes as long as it did when it was recorded. */
+    sim_uart_baud = (uint32)get_varint();
+    play_link = sim_link_default;
+    play_link.rate = (uint32)get_varint();
+    play_link.latency = get_varint();
+    play_link.loss = 0;
+    sim_credits = (uint16)get_varint();
+
+    sim_tracing = TRUE;
+    sim_send_at(&play_task, SIM_TRACE_NEXT, 0, 0);
+}
+
+void sim_trace_app(Task task)
+{
+    app_task = task;
+}
+
+bool sim_trace_drop(MessageId id)
+{
+    /* The Connection library of a replay is the trace. */
+    return play && is_cl(id);
+}
+
+bool sim_trace_ended(void)
+{
+    return !play || play_pos >= play_len;
+}
+
+void sim_trace_input(sim_ep *ep, const uint8 *data, uint16 len)
+{
+    if (!rec || ep->task != app_task)
+        return;
+
+    if (ep->type == SIM_EP_UART)
+    {
+        put_record('U');
+    }
+    else
+    {
+        put_record('R');
+        put_varint(rec_sink(SIM_SINK(ep)));
+    }
+    put_varint(len);
+    fwrite(data, 1, len, rec);
+}
+
+/*************************************************************************
+NAME
+    stat_find
+
+DESCRIPTION
+    Find the statistics of a message id, adding them if they are new.
+
+RETURNS
+    The statistics, or NULL if there is no room for more.
+*/
+static sim_trace_stat *stat_find(MessageId id)
+{
+    uint16 i;
+
+    for (i=0; i<stat_count; i++)
+    {
+        if (stats[i].id == id)
+            return &stats[i];
+    }
+    if (stat_count == SIM_TRACE_IDS)
+        return NULL;
+
+    memset(&stats[stat_count], 0, sizeof(stats[0]));
+    stats[stat_count].id = id;
+    return &stats[stat_count++];
+}
+
+/*************************************************************************
+NAME
+    wall_ns
+
+DESCRIPTION
+    Read the wall clock.
+
+RETURNS
+    Nanoseconds.
+*/
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void sim_trace_deliver(sim_msg *m)
+{
+    sim_trace_stat *stat;
+    uint64_t start;
+    uint32 out;
+
+    if (m->task != app_task || !app_task)
+    {
+        if (m->task && m->task->handler)
+            m->task->handler(m->task, m->id, m->payload);
+        return;
+    }
+
+    if (rec)
+    {
+        size_t size = m->payload ? malloc_usable_size(m->payload) : 0;
+        size_t off = is_cl(m->id) ? sink_field(m->id) : (size_t)-1;
+
+        put_record('M');
+        put_varint(m->id);
+        put_varint(size);
+
+        /* The sink goes in as its number. */
+        if (off != (size_t)-1 && off + sizeof(Sink) <= size)
+        {
+            Sink sink;
+            Sink number;
+
+            memmove(&sink, (const uint8 *)m->payload + off, sizeof(Sink));
+            number = (Sink)(uintptr_t)rec_sink(sink);
+            fwrite(m->payload, 1, off, rec);
+            fwrite(&number, 1, sizeof(Sink), rec);
+            fwrite((const uint8 *)m->payload + off + sizeof(Sink), 1,
+                   size - off - sizeof(Sink), rec);
+        }
+        else if (size)
+        {
+            fwrite(m->payload, 1, size, rec);
+        }
+    }
+
+    out = sim_out_bytes;
+    start = wall_ns();
+
+    m->task->handler(m->task, m->id, m->payload);
+
+    if (play && (stat = stat_find(m->id)) != NULL)
+    {
+        uint64_t ns = wall_ns() - start;
+
+        stat->count++;
+        stat->total_ns += ns;
+        if (ns > stat->max_ns)
+            stat->max_ns = ns;
+        stat->out_bytes += sim_out_bytes - out;
+    }
+}
+
+/*************************************************************************
+NAME
+    play_sink
+
+DESCRIPTION
+    Get the channel a sink number of the trace stands for, creating it the
+    first time. Its other end drops what it gets.
+
+RETURNS
+    The application end.
+*/
+static sim_ep *play_sink(uint64_t number)
+{
+    sim_ep *ep;
+    sim_ep *far;
+
+    if (number >= SIM_TRACE_SINKS)
+    {
+        fprintf(stderr, "fwsim: %s has bad sink %lu\n", play_path, (unsigned long)number);
+        Panic();
+    }
+    if (play_sinks[number])
+        return play_sinks[number];
+
+    ep = sim_ep_new(SIM_EP_RFCOMM, SIM_RFCOMM_BUFFER);
+    far = sim_ep_new(SIM_EP_RFCOMM, SIM_RFCOMM_BUFFER);
+    sim_ep_pair(ep, far);
+    sim_ep_link(ep, &play_link, 127, sim_credits);
+    sim_ep_link(far, &play_link, 127, sim_credits);
+    ep->task = app_task;
+    far->task = &play_task;
+
+    play_sinks[number] = ep;
+    return ep;
+}
+
+/*************************************************************************
+NAME
+    play_next
+
+DESCRIPTION
+    Replay the records that are due, and wait for the next one.
+
+RETURNS
+
+*/
+static void play_next(void)
+{
+    while (play_pos < play_len)
+    {
+        size_t pos = play_pos;
+        uint8 kind = play[play_pos++];
+        sim_time due = play_last + get_varint();
+        uint64_t n;
+
+        /* What the last record set off goes first, as it did when recorded. */
+        if (due > sim_clock() || sim_next() <= sim_clock())
+        {
+            play_pos = pos;
+            sim_send_at(&play_task, SIM_TRACE_NEXT, 0, due);
+            return;
+        }
+        play_last = due;
+        play_records++;
+
+        if (kind == 'M')
+        {
+            MessageId id = (MessageId)get_varint();
+            uint64_t size = get_varint();
+            size_t off = sink_field(id);
+            uint8 *payload;
+
+            play_need(size);
+
+            /* What the application sends itself, it does again. */
+            if (!is_cl(id))
+            {
+                play_pos += size;
+                continue;
+            }
+
+            payload = size ? (uint8 *)PanicUnlessMalloc(size) : NULL;
+            memmove(payload, play + play_pos, size);
+            play_pos += size;
+
+            if (off != (size_t)-1 && off + sizeof(Sink) <= size)
+            {
+                Sink number;
+                Sink sink;
+
+                memmove(&number, payload + off, sizeof(Sink));
+                sink = SIM_SINK(play_sink((uintptr_t)number));
+                memmove(payload + off, &sink, sizeof(Sink));
+            }
+            sim_msg_queue(sim_msg_new(app_task, id, payload, sim_clock()));
+        }
+        else if (kind == 'U' || kind == 'R')
+        {
+            sim_ep *ep = (kind == 'U') ? SIM_EP(StreamUartSink()) : play_sink(get_varint());
+
+            n = get_varint();
+            play_need(n);
+
+            if (!sim_ep_receive(ep, play + play_pos, (uint16)n))
+                play_dropped += (uint32)n;
+            play_pos += n;
+        }
+        else
+        {
+            fprintf(stderr, "fwsim: %s has bad record '%c'\n", play_path, kind);
+            Panic();
+        }
+    }
+}
+
+/*************************************************************************
+NAME
+    play_handler
+
+DESCRIPTION
+    Message handler of the replay: the records, and the far ends of the
+    channels, which drop their data.
+
+RETURNS
+
+*/
+static void play_handler(Task task, MessageId id, Message message)
+{
+    if (id == SIM_TRACE_NEXT)
+    {
+        play_next();
+    }
+    else if (id == MESSAGE_MORE_DATA)
+    {
+        Source src = ((const MessageMoreData *)message)->source;
+
+        SourceDrop(src, SourceSize(src));
+    }
+}
+
+/*************************************************************************
+NAME
+    stat_name
+
+DESCRIPTION
+    Name a message id for the report.
+
+RETURNS
+    The name, in a static buffer for an application message.
+*/
+static const char *stat_name(MessageId id)
+{
+    static char name[32];
+
+    if (is_cl(id))
+        return cl_names[id - CL_MESSAGE_BASE];
+    if (id == MESSAGE_MORE_DATA)
+        return "MESSAGE_MORE_DATA";
+    if (id == MESSAGE_MORE_SPACE)
+        return "MESSAGE_MORE_SPACE";
+
+    sprintf(name, "application %u", id);
+    return name;
+}
+
+static int stat_compare(const void *a, const void *b)
+{
+    return (int)((const sim_trace_stat *)a)->id - (int)((const sim_trace_stat *)b)->id;
+}
+
+void sim_trace_close(void)
+{
+    uint16 i;
+
+    if (rec)
+    {
+        fclose(rec);
+        rec = NULL;
+    }
+    if (!play)
+        return;
+
+    qsort(stats, stat_count, sizeof(stats[0]), stat_compare);
+
+    fprintf(stderr, "fwsim: replayed %lu records of %s, %lu input bytes dropped\n",
+            (unsigned long)play_records, play_path, (unsigned long)play_dropped);
+    fprintf(stderr, "%-6s %-36s %8s %10s %8s %8s %9s\n",
+            "id", "message", "count", "total us", "mean us", "max us", "out bytes");
+
+    for (i=0; i<stat_count; i++)
+    {
+        const sim_trace_stat *s = &stats[i];
+
+        fprintf(stderr, "0x%04x %-36s %8lu %10.1f %8.2f %8.1f %9lu\n",
+                s->id, stat_name(s->id), (unsigned long)s->count, s->total_ns / 1000.0,
+                s->total_ns / 1000.0 / s->count, s->max_ns / 1000.0,
+                (unsigned long)s->out_bytes);
+    }
+}
+
+/* End-of-File */
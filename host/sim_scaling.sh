@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Scaling benchmark of the multi-module simulator.
+#
+# Runs a deployment of masters, each connecting to seven slaves and then sending
+# to all of them, on 1 to N cores, and prints the wall time and the speedup over
+# one core. The output of every run is the same, only the time changes.
+#
+# Usage: sim_scaling.sh [max_cores] [masters]
+#
+# max_cores defaults to the cores of the host, masters to 50.
+
+FWSIM=${FWSIM:-$(dirname "$0")/fwsim}
+CORES=${1:-$(nproc)}
+MASTERS=${2:-50}
+SLAVES=$((MASTERS * 7))
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# A master connects to a slave every 12 s, long enough for a page timeout, then
+# routes link 0 to all of them and sends.
+{
+    i=0
+    while [ $i -lt 7 ]; do
+        printf 'connect master\n@12000\n'
+        i=$((i + 1))
+    done
+    printf 'route 0 all\n@1000\n'
+    i=0
+    while [ $i -lt 20 ]; do
+        printf 'tx all "status report %d from the master"\n@500\n' $i
+        i=$((i + 1))
+    done
+    printf 'state\n'
+} > "$DIR/master.txt"
+
+# A slave echoes what it gets, and waits to be found again if nobody came.
+printf 'echo on\nconnect slave\n@31000\nconnect slave\n@31000\nconnect slave\n' \
+    > "$DIR/slave.txt"
+
+echo "$MASTERS masters, $SLAVES slaves"
+echo "cores  wall s  speedup"
+
+base=
+j=1
+while [ $j -le "$CORES" ]; do
+    wall=$("$FWSIM" -n "$MASTERS:$DIR/master.txt" -n "$SLAVES:$DIR/slave.txt" \
+                    -d 120000 -j $j 2>&1 | sed -n 's/.* in \([0-9.]*\) s,.*/\1/p')
+    if [ -z "$wall" ]; then
+        echo "fwsim failed on $j cores" >&2
+        exit 1
+    fi
+    [ -z "$base" ] && base=$wall
+    awk -v j=$j -v w="$wall" -v b="$base" 'BEGIN { printf "%5d  %6.3f  %7.2f\n", j, w, b / w }'
+    j=$((j + 1))
+done
@@ -0,0 +1,60 @@
+/*!
+ * @file link.c
+ *
+ * @brief State machine of a link.
+ *
+ * Every change of link state goes through link_event(), which looks up the next state
+ * in a table of state by event generated from LINK_STATES. The handlers of the
+ * Connection library messages only turn a message into an event for a link, and act
+ * on it if the link takes it.
+ */
+
+#include "rfcomm_multi_slave.h"
+
+/* Table entries that are not states. */
+#define STATE___            0xFF    /* Unexpected, counted and ignored. */
+#define STATE_IGN           0xFE    /* Ignored. */
+
+#define LINK_STATE_ROW(state, name, e0, e1, e2, e3, e4, e5, e6, e7, e8, e9, e10) \
+    { STATE_##e0, STATE_##e1, STATE_##e2, STATE_##e3, STATE_##e4, STATE_##e5, \
+      STATE_##e6, STATE_##e7, STATE_##e8, STATE_##e9, STATE_##e10 },
+#define LINK_STATE_NAME(state, name, e0, e1, e2, e3, e4, e5, e6, e7, e8, e9, e10)  name,
+
+static const uint8 link_table[STATE_LAST][LINK_EVENT_LAST] = { LINK_STATES(LINK_STATE_ROW) };
+static const char *const link_names[] = { LINK_STATES(LINK_STATE_NAME) };
+
+bool link_event(MAIN_APP_T *app, uint16 link_id, LINK_EVENT_T event)
+{
+    CONN_STATE_T *conn;
+    uint8 next;
+
+    if (link_id >= MAX_CONNECTIONS)
+    {
+        app->unexpected++;
+        if (app->debug) print("DBG: Event %d for no link\r\n", event);
+        return FALSE;
+    }
+
+    conn = &app->connection[link_id];
+    next = link_table[conn->state][event];
+
+    if (next == STATE___)
+    {
+        conn->unexpected++;
+        if (app->debug) print("DBG: Link %d %s, event %d unexpected\r\n",
+                              link_id, link_names[conn->state], event);
+        return FALSE;
+    }
+    if (next == STATE_IGN)
+        return FALSE;
+
+    conn->state = (STATE_ENUM_T)next;
+    return TRUE;
+}
+
+const char *link_state_name(STATE_ENUM_T state)
+{
+    return link_names[state];
+}
+
+/* End-of-File */
@@ -27,7 +27,7 @@
 /*!
  * @brief The application state.
  */
-MAIN_APP_T app;
+NODE_LOCAL MAIN_APP_T app;
 
 /*!
  * @brief RFCOMM Service Record - used when in slave mode.
@@ -39,7 +39,7 @@ MAIN_APP_T app;
  * This application uses the Service Class Name UUID 0x1201 for 'GenericNetworking' - 
  * this has no specific profile or protocol specified for its use.
  */
-static uint8 rfcomm_slave_sr [] =
+static NODE_LOCAL uint8 rfcomm_slave_sr [] =
 {
     0x09, 0x00, 0x01,   /* ServiceClassIDList(0x0001) */
     0x35, 0x03,         /* DataElSeq 3 bytes */
@@ -58,9 +58,16 @@ static uint8 rfcomm_slave_sr [] =
     0x09, 0x01, 0x00,   /* uint16 0x0100 */
     0x09, 0x01, 0x00,   /* ServiceName(0x0100) = "RFCOMM Echo" */
     0x25, 0x0b,         /* String length 11 */
-    'R','F','C','O','M', 'M', ' ', 'E', 'c', 'h', 'o'
+    'R','F','C','O','M', 'M', ' ', 'E', 'c', 'h', 'o',
+    0x09, 0x02, 0x00,   /* Control channel for remote commands (0x0200), custom */
+    0x08, 0x00          /* uint8 0x00 <- Control channel - to be over-written */
 };
 
+/*!
+ * @brief Offset of the control channel in rfcomm_slave_sr.
+ */
+#define SR_CONTROL_CHANNEL (sizeof(rfcomm_slave_sr) - 1)
+
 /* RFCOMM Echo service search request */
 static const uint8 RfcommMultiServiceRequest [] =
 {
@@ -71,8 +78,9 @@ static const uint8 RfcommMultiServiceRequest [] =
 /* Protocol search request */
 static const uint8 ProtocolAttributeRequest [] =
 {
-    0x35, 0x03,         /* type = DataElSeq, 3 bytes in DataElSeq */
-    0x09, 0x00, 0x04    /* 2 byte UINT attrID ProtocolDescriptorList */    
+    0x35, 0x06,         /* type = DataElSeq, 6 bytes in DataElSeq */
+    0x09, 0x00, 0x04,   /* 2 byte UINT attrID ProtocolDescriptorList */    
+    0x09, 0x02, 0x00    /* 2 byte UINT attrID control channel, custom */
 };
 
 /*!
@@ -92,6 +100,23 @@ static uint16 LinkFromSink(Sink sink)
     return NO_ACTIVE;    
 }
 
+/*!
+ * @brief Given a sink id, return the link id whose control channel that sink is.
+ *
+ * @param app The application state.
+ * @param sink The sink.
+ *
+ * @returns link_id or NO_ACTIVE (0xFF)
+ */
+static uint16 LinkFromCtrlSink(MAIN_APP_T *app, Sink sink) 
+{
+    uint16 i;
+    for (i=0; i<MAX_CONNECTIONS; i++)
+        if (app->connection[i].ctrl_sink && sink == app->connection[i].ctrl_sink)
+            return i;
+    return NO_ACTIVE;    
+}
+
 /*!
  * @brief Handled CL_INIT_CFM from Connection library in response to ConnectionInit().
  *
@@ -192,6 +217,9 @@ static void cl_dm_local_name_complete(MAIN_APP_T *app, const CL_DM_LOCAL_NAME_CO
  *
  * Updates the app's rfcomm_slave_sr Service Record with the allocated server channel
  * ID and then register the Service Record with the SDP protocol in the FW.
+ *
+ * Two channels are allocated, one after the other. The first carries data, the
+ * second remote commands from the master (see remote.c).
  * 
  * @param app The application state.
  * @param m The CL_RFCOMM_REGISTER_CFM message pointer.
@@ -204,23 +232,33 @@ static void cl_rfcomm_register_cfm(MAIN_APP_T *app, const CL_RFCOMM_REGISTER_CFM
     
     if (m->status != success)
     {
-        print("ERROR: Failed to register RFCOMM server channel!\r\n");
+        print_error(RESULT_FAILED, "Failed to register RFCOMM server channel!\r\n");
         Panic();
     }
     
-    if (!SdpParseInsertRfcommServerChannel(
-             sizeof(rfcomm_slave_sr), 
-             rfcomm_slave_sr,
-             m->server_channel
-             )
-        )
+    /* The first channel is for data, the second for remote commands. */
+    if (!app->rfcomm_server_channel)
     {
-        print("ERROR: Could not update RFCOMM Service record!\r\n");
-        Panic();
-    }  
+        if (!SdpParseInsertRfcommServerChannel(
+                 sizeof(rfcomm_slave_sr), 
+                 rfcomm_slave_sr,
+                 m->server_channel
+                 )
+            )
+        {
+            print_error(RESULT_FAILED, "Could not update RFCOMM Service record!\r\n");
+            Panic();
+        }  
+        
+        /* Cache this for later when setting up security and the SDP Service Record.*/
+        app->rfcomm_server_channel = m->server_channel; 
+        
+        ConnectionRfcommAllocateChannel(&app->task, 0);
+        return;
+    }
     
-    /* Cache this for later when setting up security and the SDP Service Record.*/
-    app->rfcomm_server_channel = m->server_channel; 
+    app->ctrl_server_channel = m->server_channel;
+    rfcomm_slave_sr[SR_CONTROL_CHANNEL] = m->server_channel;
     
     /* Set up security for incoming connections - Secure Simple Pairing */
     ConnectionSmRegisterIncomingService( 
@@ -228,11 +266,21 @@ static void cl_rfcomm_register_cfm(MAIN_APP_T *app, const CL_RFCOMM_REGISTER_CFM
         app->rfcomm_server_channel,
         sec4_in_level_1 
         );
+    ConnectionSmRegisterIncomingService( 
+        protocol_rfcomm,
+        app->ctrl_server_channel,
+        sec4_in_level_1 
+        );
 
     /* Turn off security for SDP browsing. */
     ConnectionSmSetSdpSecurityIn((bool) TRUE);   
 
-    print("Ready.\r\n");
+    print_ready();
+    
+    script_boot(app);
+    
+    /* From here on buffers come and go with the traffic. */
+    pool_ready();
 }
 
 /*!
@@ -246,10 +294,11 @@ static void cl_rfcomm_register_cfm(MAIN_APP_T *app, const CL_RFCOMM_REGISTER_CFM
  * - Start paging so that the device is discoverable for connection.
  * 
  * @param app The application state.
+ * @param m The MSG_CONNECT_SLAVE message pointer.
  *
  * @returns void.
  */
-static void connect_slave(MAIN_APP_T *app) 
+static void connect_slave(MAIN_APP_T *app, const MSG_CONNECT_T *m) 
 {
     uint8 *service_record = NULL;
     uint16 service_record_size = (uint16)sizeof(rfcomm_slave_sr); 
@@ -257,12 +306,18 @@ static void connect_slave(MAIN_APP_T *app)
     if (app->debug) print("DBG: connect_slave\r\n");
      
     /* A slave can only have one connection, to its master. */
+    if (!link_event(app, 0, LINK_LISTEN))
+    {
+        app->tag = m->tag;
+        print_error(RESULT_BUSY, "Link 0 is busy.\r\n");
+        return;
+    }
     app->active = 0;
+    app->active_tag = m->tag;
     
     /* This device is a Slave and the connection is, hopefully, a master.*/
     app->role = ROLE_SLAVE;
     ACTIVE.role = ROLE_MASTER;
-    ACTIVE.state = STATE_CONNECTING;
     
     /* Allocate memory for a copy of the service record, which will be sent to the FW
      * to register it for SDP.
@@ -300,7 +355,7 @@ static void cl_sdp_register_cfm(MAIN_APP_T *app, const CL_SDP_REGISTER_CFM_T *m)
     
     if (m->status != success)
     {
-        print("ERROR: Failed to register SDP Service Record!\r\n");
+        print_error(RESULT_FAILED, "Failed to register SDP Service Record!\r\n");
         Panic();
     }
 
@@ -319,7 +374,75 @@ static void cl_sdp_register_cfm(MAIN_APP_T *app, const CL_SDP_REGISTER_CFM_T *m)
 }
 
 /*!
- * @brief For an active connection that is conneting or disconnecting, reset its state.
+ * @brief Get the RFCOMM configuration to open a data channel with.
+ *
+ * Only the frame size is ever changed, the rest is what the Connection library uses
+ * by default. The control channel always uses the defaults, its lines are short.
+ * 
+ * @param app The application state.
+ * @param link_id The link being connected.
+ * @param config Filled in, when the link asks for a frame size.
+ *
+ * @returns config, or NULL for the defaults.
+ */
+static const rfcomm_config_params *link_config(
+        const MAIN_APP_T *app, 
+        uint16 link_id, 
+        rfcomm_config_params *config
+        )
+{
+    if (!app->connection[link_id].frame_max)
+        return NULL;
+    
+    config->max_payload_size = app->connection[link_id].frame_max;
+    config->modem_signal = FRAME_MODEM_SIGNAL;
+    config->break_signal = 0;
+    config->msc_timeout = FRAME_MSC_TIMEOUT;
+    return config;
+}
+
+/*!
+ * @brief As a master, open the control channel of the next link that needs one.
+ *
+ * Control channels are opened one at a time, and not while a data channel is being
+ * connected, so the connect confirmations can be told apart.
+ * 
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+static void ctrl_connect_next(MAIN_APP_T *app) 
+{
+    uint16 i;
+    
+    if (app->role != ROLE_MASTER || app->ctrl_link != NO_ACTIVE || app->active != NO_ACTIVE)
+        return;
+    
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        CONN_STATE_T *conn = &app->connection[i];
+        
+        if (conn->state == STATE_CONNECTED && conn->ctrl_channel && !conn->ctrl_sink)
+        {
+            if (app->debug) print("DBG: Opening control channel of link %d\r\n", i);
+            
+            app->ctrl_link = i;
+            ConnectionRfcommConnectRequest(
+                            &app->task,
+                            &conn->addr,
+                            app->rfcomm_server_channel,
+                            conn->ctrl_channel,
+                            0                   /* default payload size */
+                            );
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief For an active connection that has failed or been disconnected, reset its state.
+ *
+ * The link is already in the disconnected state, from link_event().
  * 
  * @param app The application state.
  *
@@ -327,6 +450,8 @@ static void cl_sdp_register_cfm(MAIN_APP_T *app, const CL_SDP_REGISTER_CFM_T *m)
  */
 static void reset_active_connection(MAIN_APP_T *app) 
 {
+    uint16 i;
+
     if (app->debug) print("DBG: reset_active_connection\r\n");
     
     if (app->active == NO_ACTIVE) 
@@ -335,7 +460,17 @@ static void reset_active_connection(MAIN_APP_T *app)
         return;
     }
     
-    ACTIVE.state = STATE_DISCONNECTED;
+    ping_link_lost(app, app->active);
+    tx_flush_queue(app, app->active);
+    ACTIVE.rx_pending = FALSE;
+    ACTIVE.rx_stalled = FALSE;
+    ACTIVE.rx_fc = FALSE;
+    ACTIVE.tag = NO_TAG;
+    ACTIVE.ctrl_sink = 0;       /* Goes with the data channel. */
+    ACTIVE.mode = lp_active;
+    ACTIVE.sniff = FALSE;
+    ACTIVE.frame = 0;
+    
     BdaddrSetZero(&ACTIVE.addr);
     ACTIVE.role = ROLE_NONE;
     ACTIVE.sink = 0;
@@ -346,12 +481,36 @@ static void reset_active_connection(MAIN_APP_T *app)
     else
         if (app->debug) print("DBG: conn_count is already 0!\r\n");
             
-    if (app->connection[0].state == STATE_DISCONNECTED &&
-        app->connection[1].state == STATE_DISCONNECTED)
-        {
-            app->role = ROLE_NONE;
-        }
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (app->connection[i].state != STATE_DISCONNECTED)
+            break;
     }
+    if (i == MAX_CONNECTIONS)
+        app->role = ROLE_NONE;
+    
+    /* A control channel may have been waiting for the connection to finish. */
+    ctrl_connect_next(app);
+}
+
+/*!
+ * @brief A master connection has failed before RFCOMM was asked for, report it and
+ * reset the link, unless the link does not take the failure.
+ *
+ * @param app The application state.
+ * @param text What failed, for human mode.
+ *
+ * @returns void.
+ */
+static void connect_master_failed(MAIN_APP_T *app, const char *text)
+{
+    if (!link_event(app, app->active, LINK_FAILED))
+        return;
+    
+    print_completion(COMPLETION_CONNECT_FAILED, app->active, text);
+    reset_active_connection(app);
+    print_ready();
+}
 
 /*!
  * @brief Stop any potentional slave connection.
@@ -382,12 +541,13 @@ static void stop_slave_connection(MAIN_APP_T *app)
  */
 static void cl_sdp_unregister_cfm(MAIN_APP_T *app, const CL_SDP_UNREGISTER_CFM_T *m) 
 {
+    app->tag = app->active_tag;
     if (app->debug) print("DBG: cl_sdp_unregister_cfm\r\n");
     
     /* There can be a 'PENDING' message before success. */
     if (m->status == success) 
     {
-         print("Ready.\r\n");
+         print_ready();
     }
 }
 
@@ -402,25 +562,56 @@ static void cl_sdp_unregister_cfm(MAIN_APP_T *app, const CL_SDP_UNREGISTER_CFM_T
  */
 static void cl_rfcomm_connect_ind(MAIN_APP_T *app, const CL_RFCOMM_CONNECT_IND_T *m) 
 {
+    rfcomm_config_params config;
+    
+    app->tag = app->active_tag;
     if (app->debug) print("DBG: cl_rfcomm_connect_ind\r\n");  
     
-    if (app->role == ROLE_SLAVE 
-        && app->active != NO_ACTIVE 
-        && app->connection[app->active].state == STATE_CONNECTING)
+    /* Only the master of our link can open the control channel. */
+    if (app->role == ROLE_SLAVE && m->server_channel == app->ctrl_server_channel)
+    {
+        ConnectionRfcommConnectResponse(
+                &app->task,
+                (bool) (
+                    app->connection[0].state == STATE_CONNECTED &&
+                    !app->connection[0].ctrl_sink &&
+                    BdaddrIsSame(&m->bd_addr, &app->connection[0].addr)
+                    ),
+                m->sink,
+                app->ctrl_server_channel,
+                0);                              /* Default config */
+        return;
+    }
+    
+    if (link_event(app, app->active, LINK_CONNECT_IND))
     {
-        print("Slave connection %d started.\r\n", app->active);
+        /* Two masters found us at once, the first one gets the connection. */
+        if (app->connection[app->active].sink)
+        {
+            ConnectionRfcommConnectResponse(
+                    &app->task,
+                    (bool) FALSE,               /* Refuse the connection */
+                    m->sink,
+                    app->rfcomm_server_channel,
+                    0);                         /* Default config */
+            return;
+        }
+
+        print_completion(COMPLETION_STARTED, app->active, "Slave connection %d started.\r\n", app->active);
         
         /* Cancel the timeout message, we have a connection. */
         MessageCancelAll(&app->task, MSG_SLAVE_CONNECTION_TIMEOUT);
  
         memmove(&app->connection[app->active].addr, &m->bd_addr, sizeof(bdaddr));
         app->connection[app->active].sink = m->sink;
+        if (app->debug) print("DBG: Master asks for frame size %d\r\n", m->frame_size);
+        
         ConnectionRfcommConnectResponse(
                 &app->task,
                 (bool) TRUE,                     /* Accept the connection */
                 m->sink,
                 app->rfcomm_server_channel,
-                0);                              /* Default config */
+                link_config(app, app->active, &config));
     }
 }
 
@@ -438,20 +629,40 @@ static void cl_rfcomm_server_connect_cfm(
         const CL_RFCOMM_SERVER_CONNECT_CFM_T *m
         )
 {
+    app->tag = app->active_tag;
     if (app->debug) print("DBG: cl_rfcomm_server_connect_cfm\r\n");  
 
-    if (app->role == ROLE_SLAVE 
-        && app->active != NO_ACTIVE 
-        && app->connection[app->active].state == STATE_CONNECTING)
+    if (app->role == ROLE_SLAVE && m->server_channel == app->ctrl_server_channel)
     {
-        if (m->status == success) 
+        CONN_STATE_T *conn = &app->connection[0];
+        
+        if (m->status == success && conn->state == STATE_CONNECTED)
         {
-            print("Slave connection %d complete.\r\n", app->active);
+            if (app->debug) print("DBG: Control channel open\r\n");
+            
+            conn->ctrl_sink = m->sink;
+            conn->ctrl_ctx.pos = 0;
+            conn->ctrl_ctx.discard = FALSE;
+            conn->ctrl_ctx.out = m->sink;
+            conn->ctrl_ctx.echo = FALSE;
+        }
+        return;
+    }
+    
+    /* Only a slave that is being connected to expects one. */
+    if (m->status == success) 
+    {
+        if (link_event(app, app->active, LINK_ACCEPTED))
+        {
+            print_completion(COMPLETION_CONNECTED, app->active, "Slave connection %d complete.\r\n", app->active);
 
             PanicNull(m->sink);         /* Shouldn't happen. */
             ACTIVE.sink = m->sink;
-            ACTIVE.state = STATE_CONNECTED;
+            ACTIVE.frame = m->payload_size;
             app->conn_count += 1;
+            echo_update(app, app->active);
+            sniff_link_up(app, app->active);
+            quality_link_up(app, app->active);
             app->active = NO_ACTIVE;
             
             /* Now the connection is established, stop paging and take down the 
@@ -459,16 +670,11 @@ static void cl_rfcomm_server_connect_cfm(
              */
             stop_slave_connection(app);
         }
-        else
-        {
-            print("ERROR: Slave connection %d failed.\r\n", app->active);
-            reset_active_connection(app);
-        }
     }
-    else 
+    else if (link_event(app, app->active, LINK_ACCEPT_FAILED))
     {
-        print("ERROR: Unexpected RFCOMM Server Cfm\r\n");
-        Panic();
+        print_completion(COMPLETION_CONNECT_FAILED, app->active, "ERROR: Slave connection %d failed.\r\n", app->active);
+        reset_active_connection(app);
     }
 }
 
@@ -480,35 +686,38 @@ static void cl_rfcomm_server_connect_cfm(
  * Inquire for a devices that match our class of device. Try and connect to them!
  * 
  * @param app The application state.
+ * @param m The MSG_CONNECT_MASTER message pointer.
  *
  * @returns void.
  */
-static void connect_master(MAIN_APP_T *app) 
+static void connect_master(MAIN_APP_T *app, const MSG_CONNECT_T *m) 
 {
-    int i;
+    uint16 link_id = NO_ACTIVE;
+    uint16 i;
     
     if (app->debug) print("DBG: connect_master\r\n");
     
-    /* The master can have up to two slave connections. */
+    /* The master can have up to MAX_CONNECTIONS slave connections, on free links. */
     for (i=0; i<MAX_CONNECTIONS; i++) 
     {
-        if (app->connection[i].role == ROLE_NONE)
+        if (app->connection[i].state == STATE_DISCONNECTED)
         {
-            app->active = i;
+            link_id = i;
             break;
         }
     } 
-       
-    /* This shouldn't happen. */    
-    if (app->active == NO_ACTIVE)
+    
+    if (!link_event(app, link_id, LINK_CONNECT))
     {
-        print("DBG: app->active not set - something went wrong!");
-        Panic();
+        app->tag = m->tag;
+        print_error(RESULT_BUSY, "No free link.\r\n");
+        return;
     }
     
     /* We are the master and the active connection is to a slave. */
+    app->active = link_id;
+    app->active_tag = m->tag;
     app->role = ROLE_MASTER;
-    ACTIVE.state = STATE_CONNECTING;
     ACTIVE.role = ROLE_SLAVE;
     
     /* Inquire to look for devices in inquiry scan mode. Look for one at a time.*/
@@ -533,6 +742,7 @@ static void connect_master(MAIN_APP_T *app)
  */
 static void cl_dm_inquire_result(MAIN_APP_T *app, const CL_DM_INQUIRE_RESULT_T *m) 
 {
+    app->tag = app->active_tag;
     if (app->debug) print("DBG: cl_dm_inquire_result\r\n"); 
     
     /* 'inquiry_status_result' indicates we got a hit. Cache the address until inquiry is
@@ -546,9 +756,7 @@ static void cl_dm_inquire_result(MAIN_APP_T *app, const CL_DM_INQUIRE_RESULT_T *
     {
         if (BdaddrIsZero(&app->connection[app->active].addr))
         {
-            print("No slave devices found.\r\n");
-            reset_active_connection(app);
-            print("Ready.\r\n");
+            connect_master_failed(app, "No slave devices found.\r\n");
         }
         else
         {
@@ -595,6 +803,27 @@ static void cl_sm_register_outgoing_service_cfm(
             );
 }
 
+/*!
+ * @brief Find the control channel in the attributes of a slave's service record.
+ *
+ * @param attrs The attributes.
+ * @param size Size of the attributes.
+ *
+ * @returns The server channel, or 0 if the slave does not have one.
+ */
+static uint16 sdp_control_channel(const uint8 *attrs, uint16 size)
+{
+    uint16 i;
+    
+    /* attrID 0x0200 followed by a uint8 */
+    for (i=0; i+4 < size; i++)
+    {
+        if (attrs[i] == 0x09 && attrs[i+1] == 0x02 && attrs[i+2] == 0x00 && attrs[i+3] == 0x08)
+            return attrs[i+4];
+    }
+    return 0;
+}
+
 /*!
  * @brief Process the SDP Search Attribute Confirmations 
  *
@@ -611,15 +840,17 @@ static void cl_sdp_service_search_attribute_cfm(
         const CL_SDP_SERVICE_SEARCH_ATTRIBUTE_CFM_T *m
         )
 {
+    rfcomm_config_params config;
+    
+    app->tag = app->active_tag;
     if (app->debug) print("DBG: cl_sdp_service_search_attribute_cfm\r\n");
     
     if (m->status == success)
     {
-        uint8* rfcomm_channels;	
+        uint8 channel;
+        uint8* rfcomm_channels = &channel;
         uint8 size_rfcomm_channels = 1;
         uint8 channels_found = 0;
-
-        rfcomm_channels = PanicUnlessMalloc(size_rfcomm_channels * sizeof(uint8)) ;
                 
         /* See if the received data contains an rfcomm channel. */
         if ( SdpParseGetMultipleRfcommServerChannels(
@@ -630,31 +861,71 @@ static void cl_sdp_service_search_attribute_cfm(
                             &channels_found)
             )
         {
+            /* Slaves without a control channel still work, without remote commands. */
+            ACTIVE.ctrl_channel = sdp_control_channel(
+                            (const uint8 *)m->attributes,
+                            m->size_attributes
+                            );
+            
             /* An RFCOMM channel was found, proceed with connection */
             ConnectionRfcommConnectRequest(
                             &app->task,
                             &app->connection[app->active].addr,
                             app->rfcomm_server_channel,
                             rfcomm_channels[0],
-                            0                   /* default payload size */
+                            link_config(app, app->active, &config)
                             );  
         }
         else
         {
-            print("Couldn't get an RFCOMM channel from Service Record Attributes\r\n");
-            reset_active_connection(app);
-            print("Ready.\r\n");
+            connect_master_failed(app, "Couldn't get an RFCOMM channel from Service Record Attributes\r\n");
         }
-        free(rfcomm_channels);
     }
     else
     {
-        print("SDP Service Search for Attributes failed.\r\n");
-        reset_active_connection(app);
-        print("Ready.\r\n");
+        connect_master_failed(app, "SDP Service Search for Attributes failed.\r\n");
     }
 }
 
+/*!
+ * @brief Process RFCOMM Client Connect Confirmation for a control channel.
+ *
+ * @param app The application state.
+ * @param m The CL_RFCOMM_CLIENT_CONNECT_CFM message pointer.
+ *
+ * @returns void.
+ */
+static void ctrl_client_connect_cfm(
+        MAIN_APP_T *app,
+        const CL_RFCOMM_CLIENT_CONNECT_CFM_T *m
+        )
+{
+    CONN_STATE_T *conn = &app->connection[app->ctrl_link];
+    
+    if (m->status == rfcomm_connect_pending)
+        return;
+    
+    if (m->status == success && conn->state == STATE_CONNECTED)
+    {
+        if (app->debug) print("DBG: Control channel of link %d open\r\n", app->ctrl_link);
+        conn->ctrl_sink = m->sink;
+    }
+    else
+    {
+        if (app->debug) print("DBG: Control channel of link %d failed\r\n", app->ctrl_link);
+        
+        /* The link went while the control channel was being opened. */
+        if (m->status == success)
+            ConnectionRfcommDisconnectRequest(&app->task, m->sink);
+        
+        /* Do not try again. */
+        conn->ctrl_channel = 0;
+    }
+    
+    app->ctrl_link = NO_ACTIVE;
+    ctrl_connect_next(app);
+}
+
 /*!
  * @brief Process RFCOMM Client Connect Confirmation
  *
@@ -670,27 +941,42 @@ static void cl_rfcomm_client_connect_cfm(
         const CL_RFCOMM_CLIENT_CONNECT_CFM_T *m
         )
 {
+    app->tag = app->active_tag;
     if (app->debug) print("DBG: cl_rfcomm_client_connect_cfm\r\n");
     
-    if (m->status == rfcomm_connect_pending)
+    if (
+        app->ctrl_link != NO_ACTIVE && 
+        m->server_channel == app->connection[app->ctrl_link].ctrl_channel
+        )
+    {
+        ctrl_client_connect_cfm(app, m);
+    }
+    else if (m->status == rfcomm_connect_pending)
     {
         /* We can disconnect at any point now. */
         ACTIVE.sink = m->sink;      
     }        
     else if (m->status == success)
     {
-        print("Master connection complete.\r\n");
+        if (!link_event(app, app->active, LINK_OPENED))
+            return;
+        
+        print_completion(COMPLETION_CONNECTED, app->active, "Master connection complete.\r\n");
 
         PanicNull(m->sink);         /* Shouldn't happen. */
         ACTIVE.sink = m->sink; 
-        ACTIVE.state = STATE_CONNECTED;
+        ACTIVE.frame = m->payload_size;
         app->conn_count += 1;
+        sniff_link_up(app, app->active);
+        quality_link_up(app, app->active);
         app->active = NO_ACTIVE;    /* No longer connecting. */
-        print("Ready.\r\n");        /* TO DO: move this. */
+        print_ready();        /* TO DO: move this. */
+        
+        ctrl_connect_next(app);
     }
-    else
+    else if (link_event(app, app->active, LINK_FAILED))
     {
-        print("RFCOMM connection failed.\r\n");
+        print_completion(COMPLETION_CONNECT_FAILED, app->active, "RFCOMM connection failed.\r\n");
         reset_active_connection(app);
     }
 }
@@ -707,16 +993,20 @@ static void cl_rfcomm_client_connect_cfm(
  */
 static void disconnect(MAIN_APP_T *app, const MSG_DISCONNECT_T *m)
 {
+    app->tag = m->tag;
     if (app->debug) print("DBG: disconnect %d\r\n", m->link_id);
     
     /* Between the command being issues and actually requesting, the link could 
      * already have gone. So always, check.
      */
-    if (app->connection[m->link_id].state == STATE_CONNECTED)
+    if (link_event(app, m->link_id, LINK_DISCONNECT))
     {
         app->active = m->link_id;
-        ACTIVE.state = STATE_DISCONNECTING;
-        print("Disconnecting link %d\r\n", m->link_id);
+        ACTIVE.tag = m->tag;
+        print_completion(COMPLETION_DISCONNECTING, m->link_id, "Disconnecting link %d\r\n", m->link_id);
+        
+        if (ACTIVE.ctrl_sink)
+            ConnectionRfcommDisconnectRequest(&app->task, ACTIVE.ctrl_sink);
         
         ConnectionRfcommDisconnectRequest(
                 &app->task, 
@@ -726,7 +1016,7 @@ static void disconnect(MAIN_APP_T *app, const MSG_DISCONNECT_T *m)
     }
     else
     {
-        print("ERROR: Link %d is not in the connected state.\r\n", m->link_id);
+        print_error(RESULT_NOT_CONNECTED, "Link %d is not in the connected state.\r\n", m->link_id);
     }
 }
     
@@ -744,12 +1034,32 @@ static void cl_rfcomm_disconnect_cfm(
         MAIN_APP_T *app, 
         const CL_RFCOMM_DISCONNECT_CFM_T *m)
 {
+    uint16 link_id;
+    
     if (app->debug) print("DBG: cl_rfcomm_disconnect_cfm 0x%x\r\n", m->status);
     
+    link_id = LinkFromCtrlSink(app, m->sink);
+    if (link_id != NO_ACTIVE)
+    {
+        app->connection[link_id].ctrl_sink = 0;
+        return;
+    }
+    
     /* Find the sink, find the link to disconnect. */
-    app->active = LinkFromSink(m->sink);
+    link_id = LinkFromSink(m->sink);
+    if (link_id == NO_ACTIVE)
+    {
+        /* A control channel that went with its link. */
+        if (app->debug) print("DBG: Unknown sink 0x%x\r\n", m->sink);
+        return;
+    }
+    if (!link_event(app, link_id, LINK_CLOSED))
+        return;
+    
+    app->active = link_id;
+    app->tag = ACTIVE.tag;
     
-    print("Disconnected link %d\r\n", app->active);
+    print_completion(COMPLETION_DISCONNECTED, app->active, "Disconnected link %d\r\n", app->active);
     reset_active_connection(app);        
 }
 
@@ -769,28 +1079,31 @@ static void cl_rfcomm_disconnect_ind(
         MAIN_APP_T *app, 
         const CL_RFCOMM_DISCONNECT_IND_T *m)
 {
-    int link_id;
+    uint16 link_id;
     if (app->debug) print("DBG: cl_rfcomm_disconnect_ind 0x%x\r\n", m->status);
     
-    /* Go through all the RFCOMM connections to find a matching sink. */
-    for (link_id=0; link_id<MAX_CONNECTIONS; link_id++) 
+    link_id = LinkFromCtrlSink(app, m->sink);
+    if (link_id != NO_ACTIVE)
     {
-        if (
-            app->connection[link_id].state == STATE_CONNECTED &&
-            m->sink == app->connection[link_id].sink
-            )
-        {
-            app->active = link_id;
-            break;
-        }
+        app->connection[link_id].ctrl_sink = 0;
+        ConnectionRfcommDisconnectResponse(m->sink);
+        return;
     }
     
-    if (link_id <MAX_CONNECTIONS)
+    link_id = LinkFromSink(m->sink);
+    
+    if (link_id != NO_ACTIVE && link_event(app, link_id, LINK_REMOTE_CLOSED))
     {
-        print("Remote has disconnected link %d\r\n", link_id);
+        app->active = link_id;
+        print_completion(COMPLETION_REMOTE_CLOSED, link_id, "Remote has disconnected link %d\r\n", link_id);
         ConnectionRfcommDisconnectResponse(m->sink);
         reset_active_connection(app);        
     }
+    else
+    {
+        /* A control channel that went with its link. */
+        ConnectionRfcommDisconnectResponse(m->sink);
+    }
 }
 
 /*!
@@ -814,7 +1127,7 @@ static void cl_dm_acl_opened_ind(MAIN_APP_T *app, const CL_DM_ACL_OPENED_IND_T *
         print("     status:   0x%x\r\n", m->status); 
     }
     
-    if (ACTIVE.role == ROLE_MASTER && BdaddrIsZero(&ACTIVE.addr)) 
+    if (app->active != NO_ACTIVE && ACTIVE.state == STATE_LISTENING && BdaddrIsZero(&ACTIVE.addr)) 
     {
         ACTIVE.addr = m->bd_addr;
     }
@@ -846,13 +1159,15 @@ static void cl_dm_acl_closed_ind(MAIN_APP_T *app, const CL_DM_ACL_CLOSED_IND_T *
      * either RFCOMM_DISCONNECT_IND has been received all the 'disconnect' command from
      * the ui.
      */
-    if (app->active != NO_ACTIVE && ACTIVE.state == STATE_DISCONNECTING)
+    if (
+        app->active != NO_ACTIVE &&
+        BdaddrIsSame(&m->bd_addr, &ACTIVE.addr) &&
+        link_event(app, app->active, LINK_ACL_CLOSED)
+        )
     {        
-        if (BdaddrIsSame(&m->bd_addr, &ACTIVE.addr))
-        {
-            print("Link %d disconnected\r\n", app->active);
-            reset_active_connection(app);            
-        }
+        app->tag = ACTIVE.tag;
+        print_completion(COMPLETION_DISCONNECTED, app->active, "Link %d disconnected\r\n", app->active);
+        reset_active_connection(app);            
     }  
     /* This could be link loss. In which case the ACL Closed is either before or after 
        the disconnect indication.
@@ -974,33 +1289,65 @@ static void message_more_data(MAIN_APP_T *app, const MessageMoreData *m)
         for (i=0; i<MAX_CONNECTIONS; i++)
         {
             if (
+                app->connection[i].ctrl_sink &&
+                m->source == StreamSourceFromSink(app->connection[i].ctrl_sink)
+                )
+            {
+                sniff_activity(app, i);
+                remote_more_data(app, i);
+            }
+            else if (
                 app->connection[i].state == STATE_CONNECTED &&
                 m->source == StreamSourceFromSink(app->connection[i].sink)
                 )
             {
-                const uint8 *data = SourceMap(m->source);
-                uint16 len = SourceSize(m->source);
-                    
-                /* If there is data in the source, copy it and make it a NULL terminated
-                 * string.
-                 */
-                if (len)
+                sniff_activity(app, i);
+                
+                /* Echoed ping probes are not output. */
+                if (app->ping.link_id == i)
+                {
+                    ping_more_data(app, m->source);
+                }
+                /* Routed data goes to other links, not the UART. */
+                else if (!route_forward(app, i))
                 {
-                    uint8 *string = PanicUnlessMalloc((len+1) * sizeof(uint8));
-                    
-                    memmove(string, data, len);
-                    string[len] = '\0';
-                    print("Rx %d \"%s\"\r\n", i, string);
-                    
-                    /* clean up */
-                    free(string); 
-                    SourceDrop(m->source, len);
+                    rx_schedule(app, i);
                 }
             }
         }
     }
 }
 
+/*!
+ * @brief Handled MESSAGE_MORE_SPACE from Firmware
+ *
+ * An RFCOMM sink has space again, carry on sending whatever is queued on that link.
+ * The UART sink has space again, output Rx data that was held back.
+ * 
+ * @param app The application state.
+ * @param m The MESSAGE_MORE_SPACE message pointer.
+ *
+ * @returns void.
+ */
+static void message_more_space(MAIN_APP_T *app, const MessageMoreSpace *m)
+{
+    uint16 link_id = LinkFromSink(m->sink);
+    
+    if (m->sink == StreamUartSink())
+    {
+        rx_resume(app);
+    }
+    else if (link_id != NO_ACTIVE && app->connection[link_id].state == STATE_CONNECTED)
+    {
+        tx_drain(app, link_id);
+        route_more_space(app, link_id);
+    }
+    else if (app->debug)
+    {
+        print("DBG: MESSAGE_MORE_SPACE 0x%x\r\n", m->sink);
+    }
+}
+
 /*!
  * @brief Message handler for messages from the connection libary OR application itself.
  *
@@ -1014,6 +1361,8 @@ static void message_handler(Task task, MessageId id, Message msg)
 {
     MAIN_APP_T *app = (MAIN_APP_T *)task;
     
+    PROF_BEGIN(app);
+    
     switch( id ) 
     {
         case CL_INIT_CFM:
@@ -1108,27 +1457,63 @@ static void message_handler(Task task, MessageId id, Message msg)
             message_more_data(app, (MessageMoreData *)msg);
             break;   
             
+        case MESSAGE_MORE_SPACE:
+            message_more_space(app, (MessageMoreSpace *)msg);
+            break;
+            
         /* 
          * Application specific messages 
          */
         case MSG_CONNECT_SLAVE:                 /* UI Command: connect slave */
-           connect_slave(app);
+           connect_slave(app, (MSG_CONNECT_T *)msg);
            break;
            
         case MSG_SLAVE_CONNECTION_TIMEOUT:
-           print("Slave connection timed out.\r\n");
-           stop_slave_connection(app);
-           reset_active_connection(app);
+           app->tag = app->active_tag;
+           if (link_event(app, app->active, LINK_FAILED))
+           {
+               print_completion(COMPLETION_CONNECT_FAILED, app->active, "Slave connection timed out.\r\n");
+               stop_slave_connection(app);
+               reset_active_connection(app);
+           }
            break;
            
         case MSG_CONNECT_MASTER:
-           connect_master(app);
+           connect_master(app, (MSG_CONNECT_T *)msg);
            break;
 
         case MSG_DISCONNECT:
            disconnect(app, (MSG_DISCONNECT_T *)msg);
            break;
            
+        case MSG_PING_TIMEOUT:
+           ping_timeout(app);
+           break;
+           
+        case MSG_RX_ROUND:
+           rx_round(app);
+           break;
+           
+        case MSG_SNIFF_CHECK:
+           sniff_check(app);
+           break;
+           
+        case CL_DM_MODE_CHANGE_EVENT:
+           sniff_mode_change(app, (CL_DM_MODE_CHANGE_EVENT_T *)msg);
+           break;
+           
+        case MSG_QUALITY_SAMPLE:
+           quality_sample(app);
+           break;
+           
+        case CL_DM_RSSI_CFM:
+           quality_rssi(app, (CL_DM_RSSI_CFM_T *)msg);
+           break;
+           
+        case CL_DM_LINK_QUALITY_CFM:
+           quality_link(app, (CL_DM_LINK_QUALITY_CFM_T *)msg);
+           break;
+           
         /* 
          * The following messages are not handled but can be useful when debugging. 
          */
@@ -1175,14 +1560,6 @@ static void message_handler(Task task, MessageId id, Message msg)
             }
             break;
             
-        case MESSAGE_MORE_SPACE:
-            if (app->debug)
-            {
-                MessageMoreSpace *m = (MessageMoreSpace *)msg;
-                print("DBG: MESSAGE_MORE_SPACE 0x%x\r\n", m->sink);
-            }
-            break;
-            
         case CL_SM_ENCRYPTION_KEY_REFRESH_IND:
             if (app->debug) print("DBG: CL_SM_ENCRYPTION_KEY_REFRESH_IND\r\n");
             break;
@@ -1192,9 +1569,14 @@ static void message_handler(Task task, MessageId id, Message msg)
             break;
             
         default:
-            print("ERROR: Unhandled message id 0x%x\r\n", id);
+            print_error(RESULT_FAILED, "Unhandled message id 0x%x\r\n", id);
             break;
     }
+    
+    /* Output of anything else is not for a tagged command. */
+    app->tag = NO_TAG;
+    
+    PROF_END(id);
 }
 
 /*!
@@ -1207,11 +1589,39 @@ static void message_handler(Task task, MessageId id, Message msg)
  */
 int main(void)
 {
-    print(SALUTATION);
+    uint16 mode = 0;
+    
+    pool_init();
+    
+#ifdef COMMAND_CHECK
+    command_check();
+#endif
+    
+    /* Nothing has been output yet, so all of the UART buffer is free. */
+    app.uart_size = SinkSlack(StreamUartSink());
+    app.uart_hwm = app.uart_size - app.uart_size / 4;
+    app.rx_stalls = 0;
+    app.rx_round = FALSE;
+    app.rx_next = 0;
+    app.unexpected = 0;
+    app.quality_interval = 0;
+    app.tag = NO_TAG;
+    app.result = RESULT_OK;
+    
+    /* The output mode survives a reset. */
+    app.machine = (PsRetrieve(PS_KEY_MODE, &mode, 1) && mode);
+    
+    if (!app.machine)
+        print(SALUTATION);
     
     app.task.handler = message_handler;
     app.debug = FALSE;
+    app.echo = FALSE;
+    app.mux = FALSE;
+    app.ping.link_id = NO_ACTIVE;
     app.active = NO_ACTIVE;
+    app.active_tag = NO_TAG;
+    app.ctrl_link = NO_ACTIVE;
     app.conn_count = 0;
     app.role = ROLE_NONE;
     
@@ -1220,16 +1630,26 @@ int main(void)
         for (i=0; i<MAX_CONNECTIONS; i++) 
         {
             memset(&app.connection[i], 0, sizeof(CONN_STATE_T));
+            app.route[i] = 0;
+            app.connection[i].rx_hwm = RX_HWM_NONE;
+            app.connection[i].rx_weight = 1;
+            app.connection[i].rx_enc = RX_ENC_TEXT;
+            app.connection[i].tag = NO_TAG;
         }
     }
     
+    /* No sniff until asked for. */
+    sniff_set(&app, 0, SNIFF_INTERVAL, SNIFF_INTERVAL);
+    
     MessageSinkTask(StreamUartSink(), (Task)&app);
-    SinkConfigure(StreamUartSink(), VM_SINK_MESSAGES, VM_MESSAGES_NONE);
+    /* MESSAGE_MORE_SPACE resumes Rx data held back while the UART was busy. */
+    SinkConfigure(StreamUartSink(), VM_SINK_MESSAGES, VM_MESSAGES_SOME);
     app.uart_source = StreamSourceFromSink(StreamUartSink());
  
     ConnectionInit((Task)&app);
     
-    print("Intialising.\r\n");
+    if (!app.machine)
+        print("Intialising.\r\n");
     MessageLoop();    
 
     /* Never gets here. */    
@@ -0,0 +1,256 @@
+/*!
+ * @file ping.c
+ *
+ * @brief Echo mode and round trip latency probes.
+ *
+ * A slave in echo mode has the RFCOMM source of its link stream connected to the
+ * sink of the same link, so the firmware loops the data back without the application
+ * being involved. The master sends numbered probes to such a slave, one at a time, and
+ * times how long it takes for each probe to be echoed back in full.
+ */
+
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+#include <string.h>
+#include <vm.h>
+
+#include "rfcomm_multi_slave.h"
+
+/*************************************************************************
+NAME
+    ping_send_probe
+
+DESCRIPTION
+    Fill the link sink with the next probe and start the probe timer.
+
+    Probe byte n is (seq + n), so the first byte identifies the probe. A
+    late echo of an earlier probe is (seq + n) from some byte on as well,
+    but always breaks off before size bytes, as no probe is longer than 256.
+
+RETURNS
+
+*/
+static void ping_send_probe(MAIN_APP_T *app)
+{
+    PING_STATE_T *ping = &app->ping;
+    Sink sink = app->connection[ping->link_id].sink;
+    uint16 offs;
+    uint8 *data;
+    uint16 i;
+
+    ping->rx = 0;
+    ping->sent = VmGetTimerTime();
+
+    if (
+        SinkSlack(sink) >= ping->size &&
+        (offs = SinkClaim(sink, ping->size)) != 0xffff &&
+        (data = SinkMap(sink))
+        )
+    {
+        data += offs;
+        for (i=0; i<ping->size; i++)
+            data[i] = (uint8)((ping->seq + i) & 0xff);
+
+        SinkFlush(sink, ping->size);
+        sniff_activity(app, ping->link_id);
+    }
+    else
+    {
+        /* Count it as lost when the timer fires. */
+        if (app->debug) print("DBG: Ping probe %d not sent, no space\r\n", ping->seq);
+    }
+
+    MessageSendLater(&app->task, MSG_PING_TIMEOUT, 0, PING_TIMEOUT);
+}
+
+/*************************************************************************
+NAME
+    ping_report
+
+DESCRIPTION
+    Output the round trip time statistics and mark the ping as idle.
+
+RETURNS
+
+*/
+static void ping_report(MAIN_APP_T *app)
+{
+    PING_STATE_T *ping = &app->ping;
+    uint16 tag = app->tag;
+    uint32 sum = 0;
+    uint32 rtt;
+    uint16 i, j;
+
+    /* The report completes the 'ping' command, whatever event it follows. */
+    app->tag = ping->tag;
+
+    print("Ping %d: %d sent, %d received, %d lost\r\n",
+          ping->link_id,
+          ping->done + ping->lost,
+          ping->done,
+          ping->lost
+          );
+
+    if (ping->done)
+    {
+        /* Insertion sort, there are at most PING_MAX_COUNT samples. */
+        for (i=1; i<ping->done; i++)
+        {
+            rtt = ping->rtt[i];
+            for (j=i; j>0 && ping->rtt[j-1] > rtt; j--)
+                ping->rtt[j] = ping->rtt[j-1];
+            ping->rtt[j] = rtt;
+        }
+
+        for (i=0; i<ping->done; i++)
+            sum += ping->rtt[i];
+
+        print("rtt min/avg/max/p99 = %l/%l/%l/%l us\r\n",
+              ping->rtt[0],
+              sum / ping->done,
+              ping->rtt[ping->done - 1],
+              ping->rtt[(ping->done * 99 + 99) / 100 - 1]
+              );
+    }
+
+    ping->link_id = NO_ACTIVE;
+    app->tag = tag;
+}
+
+/*************************************************************************
+NAME
+    ping_next
+
+DESCRIPTION
+    Send the next probe, or report if all probes are accounted for.
+
+RETURNS
+
+*/
+static void ping_next(MAIN_APP_T *app)
+{
+    PING_STATE_T *ping = &app->ping;
+
+    if (ping->done + ping->lost >= ping->count)
+    {
+        ping_report(app);
+    }
+    else
+    {
+        ping->seq += 1;
+        ping_send_probe(app);
+    }
+}
+
+void echo_update(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+    Source src;
+
+    /* Only the slave echoes, the master is the one sending probes. */
+    if (app->role != ROLE_SLAVE || conn->state != STATE_CONNECTED)
+        return;
+
+    src = StreamSourceFromSink(conn->sink);
+
+    if (app->echo)
+    {
+        if (!StreamConnect(src, conn->sink))
+            print_error(RESULT_FAILED, "Echo on link %d failed.\r\n", link_id);
+    }
+    else
+    {
+        StreamDisconnect(src, conn->sink);
+
+        /* Data that arrives from now on must come back to the application. */
+        MessageSinkTask(conn->sink, &app->task);
+    }
+}
+
+void ping_start(MAIN_APP_T *app, uint16 link_id, uint16 count, uint16 size)
+{
+    PING_STATE_T *ping = &app->ping;
+
+    ping->link_id = link_id;
+    ping->count = count;
+    ping->size = size;
+    ping->seq = 0;
+    ping->done = 0;
+    ping->lost = 0;
+    ping->tag = app->tag;
+
+    print("Pinging link %d with %d probes of %d bytes.\r\n", link_id, count, size);
+
+    /* Anything already waiting in the source is not a probe. */
+    SourceDrop(
+            StreamSourceFromSink(app->connection[link_id].sink),
+            SourceSize(StreamSourceFromSink(app->connection[link_id].sink))
+            );
+
+    ping_send_probe(app);
+}
+
+void ping_more_data(MAIN_APP_T *app, Source src)
+{
+    PING_STATE_T *ping = &app->ping;
+    const uint8 *data = SourceMap(src);
+    uint16 len = SourceSize(src);
+    uint16 i;
+
+    for (i=0; i<len; i++)
+    {
+        /*
+         * Every byte has to be the next one of the current probe. A byte that is
+         * not ends a late echo, and may be where the current probe starts.
+         */
+        if (data[i] != ((ping->seq + ping->rx) & 0xff))
+        {
+            ping->rx = 0;
+            if (data[i] != (ping->seq & 0xff))
+                continue;
+        }
+
+        if (++ping->rx == ping->size)
+        {
+            MessageCancelAll(&app->task, MSG_PING_TIMEOUT);
+            ping->rtt[ping->done++] = VmGetTimerTime() - ping->sent;
+
+            /* Nothing more is expected until the next probe is sent. */
+            SourceDrop(src, len);
+            ping_next(app);
+            return;
+        }
+    }
+
+    SourceDrop(src, len);
+}
+
+void ping_timeout(MAIN_APP_T *app)
+{
+    if (app->ping.link_id == NO_ACTIVE)
+        return;
+
+    if (app->debug) print("DBG: Ping probe %d timed out\r\n", app->ping.seq);
+
+    app->ping.lost += 1;
+    ping_next(app);
+}
+
+void ping_link_lost(MAIN_APP_T *app, uint16 link_id)
+{
+    uint16 tag = app->tag;
+    
+    if (app->ping.link_id != link_id)
+        return;
+
+    MessageCancelAll(&app->task, MSG_PING_TIMEOUT);
+    
+    app->tag = app->ping.tag;
+    print("Ping %d aborted, link lost.\r\n", link_id);
+    app->tag = tag;
+    
+    ping_report(app);
+}
+
+/* End-of-File */
@@ -0,0 +1,193 @@
+/*!
+ * @file pool.c
+ *
+ * @brief Fixed size block pools for the buffers the application allocates.
+ *
+ * The VM heap has few slots, and buffers of every size coming and going fragment
+ * it until an allocation panics. Instead the blocks are set aside once, in the size
+ * classes of POOLS, and each class keeps a free list of its blocks. An allocation
+ * takes a block of the smallest class it fits in, or of a larger class when that
+ * one has run out. Only when no class has a block does it go to the heap.
+ *
+ * Every class counts its blocks in use, the most ever in use and the times it had
+ * run out, for the 'pool' command, so that the classes can be sized for the load.
+ * With POOL_STRICT defined, going to the heap once initialisation is done panics,
+ * to catch a steady state that is not served by the pools in test builds.
+ */
+
+#include <panic.h>
+#include <stdlib.h>
+
+#include "rfcomm_multi_slave.h"
+
+/*!
+ * @brief Unit the blocks are made of, so that every block is aligned for anything
+ * the application keeps in it, and can hold the free list link.
+ */
+typedef union POOL_UNIT
+{
+    union POOL_UNIT *next;      /* Next free block, in the first unit of a free block. */
+    uint32          align;
+} POOL_UNIT_T;
+
+#define POOL_UNITS(size)            (((size) + sizeof(POOL_UNIT_T) - 1) / sizeof(POOL_UNIT_T))
+
+#define POOL_ARENA(size, blocks)    + (blocks) * POOL_UNITS(size)
+#define POOL_ONE(size, blocks)      + 1
+#define POOL_CONFIG(size, blocks)   { (size), (blocks) },
+
+#define POOL_COUNT                  (0 POOLS(POOL_ONE))
+
+/*!
+ * @brief Size class, as given in POOLS.
+ */
+typedef struct
+{
+    uint16          size;       /* Largest allocation a block holds. */
+    uint16          blocks;
+} POOL_CONFIG_T;
+
+/*!
+ * @brief State of a size class.
+ */
+typedef struct
+{
+    POOL_UNIT_T    *start;      /* First block. */
+    POOL_UNIT_T    *end;        /* Just past the last block. */
+    POOL_UNIT_T    *free;       /* Free list. */
+    uint16          used;       /* Blocks in use. */
+    uint16          hwm;        /* Most blocks ever in use. */
+    uint32          allocs;     /* Blocks handed out. */
+    uint16          misses;     /* Allocations this class was out of blocks for. */
+} POOL_T;
+
+static const POOL_CONFIG_T pool_config[] = { POOLS(POOL_CONFIG) };
+
+static NODE_LOCAL POOL_UNIT_T pool_arena[0 POOLS(POOL_ARENA)];
+static NODE_LOCAL POOL_T pool[POOL_COUNT];
+static NODE_LOCAL uint16 pool_heap;     /* Allocations on the heap in use. */
+static NODE_LOCAL uint32 pool_heap_allocs;
+static NODE_LOCAL bool pool_steady;
+
+void pool_init(void)
+{
+    POOL_UNIT_T *u = pool_arena;
+    uint16 i;
+    uint16 b;
+
+    for (i=0; i<POOL_COUNT; i++)
+    {
+        POOL_T *p = &pool[i];
+        uint16 units = POOL_UNITS(pool_config[i].size);
+
+        p->start = u;
+        p->free = NULL;
+        for (b=0; b<pool_config[i].blocks; b++, u+=units)
+        {
+            u->next = p->free;
+            p->free = u;
+        }
+        p->end = u;
+    }
+}
+
+void pool_ready(void)
+{
+    pool_steady = TRUE;
+}
+
+void *pool_alloc(uint16 size)
+{
+    bool missed = FALSE;
+    uint16 i;
+
+    for (i=0; i<POOL_COUNT; i++)
+    {
+        POOL_T *p = &pool[i];
+        POOL_UNIT_T *block = p->free;
+
+        if (size > pool_config[i].size)
+            continue;
+
+        if (!block)
+        {
+            /* Only the class that should have had it counts a miss. */
+            if (!missed) p->misses++;
+            missed = TRUE;
+            continue;
+        }
+
+        p->free = block->next;
+        p->allocs++;
+        if (++p->used > p->hwm)
+            p->hwm = p->used;
+        return block;
+    }
+
+#ifdef POOL_STRICT
+    if (pool_steady)
+        Panic();
+#endif
+
+    pool_heap++;
+    pool_heap_allocs++;
+    return PanicUnlessMalloc(size);
+}
+
+void pool_free(void *ptr)
+{
+    POOL_UNIT_T *block = (POOL_UNIT_T *)ptr;
+    uint16 i;
+
+    for (i=0; i<POOL_COUNT; i++)
+    {
+        POOL_T *p = &pool[i];
+
+        if (block >= p->start && block < p->end)
+        {
+            block->next = p->free;
+            p->free = block;
+            p->used--;
+            return;
+        }
+    }
+
+    pool_heap--;
+    free(ptr);
+}
+
+void pool_report(void)
+{
+    uint16 i;
+
+    for (i=0; i<POOL_COUNT; i++)
+    {
+        const POOL_T *p = &pool[i];
+
+        print("Pool %d: %d x %d, %d used, %d max, %l allocs, %d misses\r\n",
+              i,
+              pool_config[i].blocks,
+              pool_config[i].size,
+              p->used,
+              p->hwm,
+              p->allocs,
+              p->misses
+              );
+    }
+    print("Heap: %d used, %l allocs\r\n", pool_heap, pool_heap_allocs);
+}
+
+void pool_reset(void)
+{
+    uint16 i;
+
+    for (i=0; i<POOL_COUNT; i++)
+    {
+        pool[i].hwm = pool[i].used;
+        pool[i].allocs = 0;
+        pool[i].misses = 0;
+    }
+    pool_heap_allocs = 0;
+}
+
+/* End-of-File */
@@ -0,0 +1,147 @@
+/*!
+ * @file prof.c
+ *
+ * @brief Profile of the messages delivered to the application.
+ *
+ * Only built with ENABLE_PROFILE defined. message_handler() calls prof_begin() and
+ * prof_end() around every message, which count the deliveries of each message id,
+ * add up the time spent handling them and keep the longest. The number of messages
+ * still queued for the application is sampled at every delivery, to show how far
+ * behind it gets. Without ENABLE_PROFILE the calls are compiled out and this file
+ * is empty.
+ */
+
+#include <message.h>
+#include <string.h>
+#include <vm.h>
+
+#include "rfcomm_multi_slave.h"
+
+#ifdef ENABLE_PROFILE
+
+/*!
+ * @brief Handling statistics of one message id.
+ */
+typedef struct
+{
+    MessageId       id;
+    uint32          count;      /* Deliveries. */
+    uint32          total;      /* Time spent in the handler, in us. */
+    uint32          max;        /* Longest time in the handler, in us. */
+} PROF_ENTRY_T;
+
+/*!
+ * @brief Profile since the last reset.
+ */
+typedef struct
+{
+    PROF_ENTRY_T    entry[PROF_IDS];
+    uint16          used;       /* Entries in use. */
+    uint32          other;      /* Deliveries of ids that did not fit in the table. */
+    uint32          since;      /* Time of the last reset, in ms. */
+    uint32          start;      /* Time the message being handled was delivered, in us. */
+    uint16          depth_max;  /* Most messages queued at a delivery. */
+    uint32          depth_sum;  /* Messages queued at all deliveries, for the mean. */
+} PROF_STATE_T;
+
+static NODE_LOCAL PROF_STATE_T prof;
+
+/*************************************************************************
+NAME
+    prof_entry
+
+DESCRIPTION
+    Find the entry of a message id, adding it if it is new and there is
+    room for it.
+
+RETURNS
+    The entry, NULL if the table is full.
+*/
+static PROF_ENTRY_T *prof_entry(MessageId id)
+{
+    uint16 i;
+
+    for (i=0; i<prof.used; i++)
+    {
+        if (prof.entry[i].id == id)
+            return &prof.entry[i];
+    }
+
+    if (prof.used == PROF_IDS)
+        return NULL;
+
+    prof.entry[prof.used].id = id;
+    return &prof.entry[prof.used++];
+}
+
+void prof_begin(MAIN_APP_T *app)
+{
+    /* The message being delivered has been taken off the queue already. */
+    uint16 depth = MessagesPendingForTask(&app->task, NULL);
+
+    if (depth > prof.depth_max)
+        prof.depth_max = depth;
+    prof.depth_sum += depth;
+
+    prof.start = VmGetTimerTime();
+}
+
+void prof_end(MessageId id)
+{
+    uint32 elapsed = VmGetTimerTime() - prof.start;
+    PROF_ENTRY_T *e = prof_entry(id);
+
+    if (!e)
+    {
+        prof.other++;
+        return;
+    }
+
+    e->count++;
+    e->total += elapsed;
+    if (elapsed > e->max)
+        e->max = elapsed;
+}
+
+void prof_report(void)
+{
+    uint32 busy = 0;
+    uint32 count = 0;
+    uint16 i;
+
+    for (i=0; i<prof.used; i++)
+    {
+        const PROF_ENTRY_T *e = &prof.entry[i];
+
+        print("Id 0x%x: %l msgs, %l us total, %l us max\r\n",
+              e->id, e->count, e->total, e->max);
+        busy += e->total;
+        count += e->count;
+    }
+
+    if (prof.other)
+        print("Other ids: %l msgs\r\n", prof.other);
+    count += prof.other;
+
+    print("%l msgs in %l ms, %l us handling, queue %d max %l mean\r\n",
+          count,
+          VmGetClock() - prof.since,
+          busy,
+          prof.depth_max,
+          (count) ? prof.depth_sum / count : 0
+          );
+}
+
+void prof_reset(void)
+{
+    /* Called from a handler, whose time still counts. */
+    uint32 start = prof.start;
+
+    memset(&prof, 0, sizeof(prof));
+    prof.since = VmGetClock();
+    prof.start = start;
+}
+
+#endif /* ENABLE_PROFILE */
+
+/* End-of-File */
@@ -0,0 +1,112 @@
+/*!
+ * @file quality.c
+ *
+ * @brief Link quality sampling of the links.
+ *
+ * While sampling is on, MSG_QUALITY_SAMPLE comes every quality_interval ms and the
+ * RSSI and the link quality of every connected link are read. The last samples of
+ * each link are kept for the 'quality' command, so that the host can see which links
+ * are in trouble.
+ */
+
+#include <connection.h>
+#include <message.h>
+#include <sink.h>
+
+#include "rfcomm_multi_slave.h"
+
+/*************************************************************************
+NAME
+    quality_find
+
+DESCRIPTION
+    Find the connected link of a sink.
+
+RETURNS
+    The link id, NO_ACTIVE if there is none.
+*/
+static uint16 quality_find(const MAIN_APP_T *app, Sink sink)
+{
+    uint16 i;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (app->connection[i].state == STATE_CONNECTED && app->connection[i].sink == sink)
+            return i;
+    }
+    return NO_ACTIVE;
+}
+
+void quality_link_up(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+
+    conn->rssi = 0;
+    conn->history_head = 0;
+    conn->history_count = 0;
+}
+
+void quality_sample(MAIN_APP_T *app)
+{
+    uint16 i;
+
+    if (!app->quality_interval)
+        return;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (app->connection[i].state != STATE_CONNECTED)
+            continue;
+
+        /* The confirmations come in this order. */
+        ConnectionGetRssi(&app->task, app->connection[i].sink);
+        ConnectionGetLinkQuality(&app->task, app->connection[i].sink);
+    }
+
+    MessageSendLater(&app->task, MSG_QUALITY_SAMPLE, 0, app->quality_interval);
+}
+
+void quality_set(MAIN_APP_T *app, uint16 interval)
+{
+    MessageCancelAll(&app->task, MSG_QUALITY_SAMPLE);
+    app->quality_interval = interval;
+
+    if (interval)
+        MessageSend(&app->task, MSG_QUALITY_SAMPLE, 0);
+}
+
+void quality_rssi(MAIN_APP_T *app, const CL_DM_RSSI_CFM_T *m)
+{
+    uint16 link_id = quality_find(app, m->sink);
+
+    if (link_id != NO_ACTIVE && m->status == hci_success)
+        app->connection[link_id].rssi = m->rssi;
+}
+
+void quality_link(MAIN_APP_T *app, const CL_DM_LINK_QUALITY_CFM_T *m)
+{
+    uint16 link_id = quality_find(app, m->sink);
+    CONN_STATE_T *conn;
+    QUALITY_SAMPLE_T *s;
+
+    if (link_id == NO_ACTIVE || m->status != hci_success)
+        return;
+
+    conn = &app->connection[link_id];
+
+    /* Once the history is full, the oldest sample makes way. */
+    if (conn->history_count < QUALITY_HISTORY)
+    {
+        s = &conn->history[(conn->history_head + conn->history_count) % QUALITY_HISTORY];
+        conn->history_count++;
+    }
+    else
+    {
+        s = &conn->history[conn->history_head];
+        conn->history_head = (conn->history_head + 1) % QUALITY_HISTORY;
+    }
+    s->rssi = conn->rssi;
+    s->quality = m->link_quality;
+}
+
+/* End-of-File */
@@ -0,0 +1,137 @@
+/*!
+ * @file remote.c
+ *
+ * @brief Remote commands, from a master to its slaves.
+ *
+ * Next to the data channel, every link has a second RFCOMM channel for control. The
+ * slave advertises its server channel in a custom attribute (0x0200) of its service
+ * record, and the master opens it once the data channel is up. The master sends
+ * command lines on it with the 'remote' command and the slave runs them as if they
+ * had been typed on its UART, replying on the same channel. The data channel is left
+ * untouched, so remote commands can be used while data is flowing.
+ *
+ * The tag of a 'remote' command goes to the slave at the start of the command line,
+ * so the slave tags its reply lines with it, and the master outputs each line with
+ * the tag it came with. Several tagged commands can be in flight on one link.
+ */
+
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+#include <string.h>
+#include <util.h>
+
+#include "rfcomm_multi_slave.h"
+
+/*************************************************************************
+NAME
+    remote_output
+
+DESCRIPTION
+    Output the complete reply lines from a slave, each prefixed with the
+    link it came from and tagged with the tag the slave gave it.
+
+RETURNS
+
+*/
+static void remote_output(MAIN_APP_T *app, uint16 link_id, Source src)
+{
+    const uint8 *data = SourceMap(src);
+    uint16 len = SourceSize(src);
+    uint16 tag = app->tag;
+    uint16 start = 0;
+    uint16 line_tag;
+    const uint8 *text;
+    uint16 i;
+
+    if (!data)
+        return;
+
+    for (i=0; i<len; i++)
+    {
+        if (data[i] != '\r' && data[i] != '\n')
+            continue;
+
+        if (i > start)
+        {
+            text = &data[start];
+            app->tag = NO_TAG;
+
+            /* A '#tag ' the slave put in front of the line is the tag of the line here. */
+            if (*text == '#')
+            {
+                const uint8 *p = UtilGetNumber(text + 1, &data[i], &line_tag);
+
+                if (p && p < &data[i] && *p == ' ')
+                {
+                    app->tag = line_tag;
+                    text = p + 1;
+                }
+            }
+
+            print("Remote %d: ", link_id);
+            print_text(text, &data[i] - text);
+            print("\r\n");
+        }
+        start = i + 1;
+    }
+
+    /* A part line waits for the rest. */
+    SourceDrop(src, start);
+    app->tag = tag;
+}
+
+void remote_more_data(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+    Source src = StreamSourceFromSink(conn->ctrl_sink);
+
+    if (app->role == ROLE_SLAVE)
+        ui_source(app, &conn->ctrl_ctx, src);
+    else
+        remote_output(app, link_id, src);
+}
+
+bool remote_send(MAIN_APP_T *app, uint16 link_id, const uint8 *cmd, uint16 len)
+{
+    Sink sink = app->connection[link_id].ctrl_sink;
+    uint8 prefix[7]; /* '#', up to 5 digits and ' ' */
+    uint16 plen = 0;
+    uint16 tag = app->tag;
+    uint16 offs;
+    uint8 *data;
+
+    if (tag != NO_TAG)
+    {
+        uint8 *p = &prefix[7];
+
+        *(--p) = ' ';
+        do
+        {
+            *(--p) = '0' + (tag % 10);
+            tag /= 10;
+        } while (tag);
+        *(--p) = '#';
+
+        plen = 7 - (p - prefix);
+        memmove(prefix, p, plen);
+    }
+
+    if (
+        SinkSlack(sink) < plen + len + 1 ||
+        (offs = SinkClaim(sink, plen + len + 1)) == 0xffff ||
+        !(data = SinkMap(sink))
+        )
+    {
+        return FALSE;
+    }
+
+    memmove(data + offs, prefix, plen);
+    memmove(data + offs + plen, cmd, len);
+    data[offs + plen + len] = '\r';
+    SinkFlush(sink, plen + len + 1);
+    sniff_activity(app, link_id);
+    return TRUE;
+}
+
+/* End-of-File */
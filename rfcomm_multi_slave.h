@@ -49,8 +49,53 @@
  *
  * If Master, can have two slave connections.
  * If slave, can only have one master connection.
+ *
+ * The host simulator builds with up to 7, a full piconet.
  */
+#ifndef MAX_CONNECTIONS
 #define MAX_CONNECTIONS 2
+#endif
+
+/*!
+ * @brief Storage class of the state of the module that is not constant.
+ *
+ * Empty on the chip. The host simulator runs a module per thread and defines
+ * it as thread local, so that every module has its own app.
+ */
+#ifndef NODE_LOCAL
+#define NODE_LOCAL
+#endif
+
+/*!
+ * @brief Bit mask with a bit set for every link id.
+ */
+#define ALL_LINKS ((1 << MAX_CONNECTIONS) - 1)
+
+/*!
+ * @brief Bytes an 'Rx <link_id> "..."' or 'Rx <link_id> h:...' line adds to the
+ * received data, before encoding.
+ */
+#define RX_OVERHEAD 10
+
+/*!
+ * @brief Per-link UART high water mark meaning only the global one applies.
+ */
+#define RX_HWM_NONE 0xFFFF
+
+/*!
+ * @brief Rx bytes output per link per scheduling round, for a link weight of 1.
+ */
+#define RX_QUANTUM 32
+
+/*!
+ * @brief Maximum link weight for Rx scheduling.
+ */
+#define RX_MAX_WEIGHT 16
+
+/*!
+ * @brief Number of tx buffers that can be waiting on a single link.
+ */
+#define TX_QUEUE_DEPTH 4
 
 /*
  * @brief Indicates NO active connection setup.
@@ -58,14 +103,212 @@
 #define NO_ACTIVE 0xFF
 
 /*!
- * @brief Application task state.
+ * @brief Output is not tagged, see print().
+ */
+#define NO_TAG 0xFFFF
+
+/*!
+ * @brief Maximum number of probes for a single 'ping' command.
+ *
+ * Round trip times for every probe are kept so that the p99 can be calculated.
+ */
+#define PING_MAX_COUNT 100
+
+/*!
+ * @brief Maximum ping probe size in bytes.
+ */
+#define PING_MAX_SIZE 256
+
+/*!
+ * @brief Time to wait for a ping probe to be echoed back, in milliseconds.
+ */
+#define PING_TIMEOUT 2000
+
+/*!
+ * @brief Size classes of the block pools, see pool.c, as X(block size, blocks).
+ *
+ * Sizes are in sizeof units, smallest first. The largest class holds a tx buffer of
+ * a full command line, and a script buffer: enough blocks for the tx queues of every
+ * link to be full at once, and a script, so that a busy piconet never goes to the
+ * heap. A build can define its own classes.
+ *
+ * On the XAP a sizeof unit is a 16 bit word and blocks round up to 32 bits, so the
+ * arena takes 128 + 384 + 204 words per block of the largest class: 2348 words with
+ * two links, and 816 more for every further link. Lower TX_QUEUE_DEPTH or
+ * MAX_LINE_LEN if that does not fit.
+ */
+#ifndef POOLS
+#define POOLS(X) \
+    X(32,                                   4) \
+    X(96,                                   4) \
+    X(sizeof(TX_BUFFER_T) + MAX_LINE_LEN,   MAX_CONNECTIONS * TX_QUEUE_DEPTH + 1)
+#endif
+
+/*!
+ * @brief Message ids the profile keeps statistics for, see prof.c.
+ *
+ * Deliveries of any more ids are only counted.
+ */
+#define PROF_IDS 32
+
+/*!
+ * @brief Default sniff interval of an idle link, in 625 us slots (500 ms).
+ */
+#define SNIFF_INTERVAL 800
+
+/*!
+ * @brief Range of the sniff intervals, in slots. They must be even.
+ */
+#define SNIFF_MIN_SLOTS 6
+#define SNIFF_MAX_SLOTS 2048
+
+/*!
+ * @brief Sniff attempt and timeout, in slots: how long a sniffing link listens at each
+ * anchor point, and for how long after it last got a packet.
+ */
+#define SNIFF_ATTEMPT 4
+#define SNIFF_TIMEOUT 1
+
+/*!
+ * @brief Default and shortest time between link quality samples, in ms.
+ */
+#define QUALITY_INTERVAL 1000
+#define QUALITY_MIN_INTERVAL 100
+
+/*!
+ * @brief Link quality samples kept per link, for the 'quality' command.
+ */
+#define QUALITY_HISTORY 8
+
+/*!
+ * @brief Range of the RFCOMM frame size a link can ask for, in bytes.
+ *
+ * 23 is the smallest frame RFCOMM allows. A 1000 byte frame fills three DH5 packets,
+ * a larger one only takes up more of the stream buffers.
+ */
+#define FRAME_MIN 23
+#define FRAME_MAX 1000
+
+/*!
+ * @brief Modem status and its timeout in ms, sent when a link asks for a frame size,
+ * as the Connection library sends them by default: DV, RTR and RTC set.
+ */
+#define FRAME_MODEM_SIGNAL 0x8C
+#define FRAME_MSC_TIMEOUT 500
+
+/*!
+ * @brief Maximum length of a command line, without its line ending.
+ *
+ * A longer line is dropped as it arrives, with an error, so that it can not fill
+ * the UART source buffer. Must be less than the size of that buffer.
+ */
+#ifndef MAX_LINE_LEN
+#define MAX_LINE_LEN 200
+#endif
+
+/*!
+ * @brief First user PS key holding a script, the others follow.
+ */
+#define PS_KEY_SCRIPT 0
+
+/*!
+ * @brief Number of scripts that can be stored.
+ */
+#define SCRIPT_SLOTS 4
+
+/*!
+ * @brief Maximum characters in a script, including its name.
+ */
+#define SCRIPT_MAX_LEN 96
+
+/*!
+ * @brief User PS key holding the output mode, non-zero for machine mode.
+ */
+#define PS_KEY_MODE (PS_KEY_SCRIPT + SCRIPT_SLOTS)
+
+/*!
+ * @brief Result of a command.
+ *
+ * In machine mode a command ends with 'OK' or with 'E' and one of these codes in
+ * decimal, instead of an 'ERROR: ...' message. Errors that are not the result of a
+ * command are output the same way.
+ */
+typedef enum {
+    RESULT_OK,              /*!< 0 - Done, or started for commands that complete later. */
+    RESULT_UNKNOWN_COMMAND, /*!< 1 - No such command. */
+    RESULT_INVALID_PARAMS,  /*!< 2 - Invalid parameters or tag. */
+    RESULT_OUT_OF_RANGE,    /*!< 3 - A link id, link mask or value is out of range. */
+    RESULT_NOT_CONNECTED,   /*!< 4 - The link is not connected, or there are no links. */
+    RESULT_BUSY,            /*!< 5 - Already doing that, or no more links. */
+    RESULT_FULL,            /*!< 6 - No room in a queue, channel or PS. */
+    RESULT_NOT_ALLOWED,     /*!< 7 - Not possible in this role or state. */
+    RESULT_NOT_FOUND,       /*!< 8 - No such script or control channel. */
+    RESULT_FAILED,          /*!< 9 - A Bluetooth operation failed. */
+    RESULT_LINE_TOO_LONG    /*!< 10 - Command line longer than MAX_LINE_LEN. */
+} RESULT_ENUM_T;
+
+/*!
+ * @brief Progress of a connection or disconnection, after its command has ended.
+ *
+ * In machine mode these are output as 'C', one of these codes and the link id, in
+ * decimal and with the tag of the command, instead of a message for people.
+ */
+typedef enum {
+    COMPLETION_STARTED,         /*!< 0 - A master has started connecting to us. */
+    COMPLETION_CONNECTED,       /*!< 1 - The link is connected. */
+    COMPLETION_CONNECT_FAILED,  /*!< 2 - The link could not be connected. */
+    COMPLETION_DISCONNECTING,   /*!< 3 - Disconnecting the link has started. */
+    COMPLETION_DISCONNECTED,    /*!< 4 - The link is disconnected. */
+    COMPLETION_REMOTE_CLOSED    /*!< 5 - The remote has disconnected the link. */
+} COMPLETION_ENUM_T;
+
+/*!
+ * @brief Events that move a link from one state to another, see link_event().
+ */
+typedef enum {
+    LINK_CONNECT,           /*!< We (master) start connecting to a slave on the link. */
+    LINK_LISTEN,            /*!< We (slave) start waiting for a master on the link. */
+    LINK_CONNECT_IND,       /*!< A master is connecting to us. */
+    LINK_OPENED,            /*!< The RFCOMM connection to the slave is up. */
+    LINK_ACCEPTED,          /*!< The RFCOMM connection from the master is up. */
+    LINK_FAILED,            /*!< The connection could not be made, or timed out. */
+    LINK_ACCEPT_FAILED,     /*!< The connection from the master could not be made. */
+    LINK_DISCONNECT,        /*!< We start a disconnection. */
+    LINK_CLOSED,            /*!< A disconnection we started is done. */
+    LINK_REMOTE_CLOSED,     /*!< The remote has disconnected. */
+    LINK_ACL_CLOSED,        /*!< The ACL to the remote has gone. */
+    LINK_EVENT_LAST         /*!< This must always be the last event. */
+} LINK_EVENT_T;
+
+/*!
+ * @brief State machine of a link: a row per state, with its name and the state each
+ * event leads to, in the order of LINK_EVENT_T.
+ *
+ * __ is an event that is not expected in the state, it is counted and ignored. IGN is
+ * an event that can happen in the state but does not change anything.
+ *
+ * A master connecting to a slave and a slave waiting for its master are different
+ * states, though both show as "Connecting", so that the table and not the handlers
+ * tell the events of the two roles apart.
+ *
+ * The table is STATE_LAST by LINK_EVENT_LAST bytes of constant data, and dispatch is
+ * one lookup.
+ */
+#define LINK_STATES(X) \
+    /* state         name             CONNECT     LISTEN     CONNECT_IND OPENED     ACCEPTED   FAILED        ACCEPT_FAILED DISCONNECT     CLOSED        REMOTE_CLOSED ACL_CLOSED */ \
+    X(DISCONNECTED,  "Disconnected",  CONNECTING, LISTENING, __,         __,        __,        __,           __,           __,            IGN,          IGN,          IGN) \
+    X(DISCONNECTING, "Disconnecting", __,         __,        __,         __,        __,        __,           __,           __,            DISCONNECTED, IGN,          DISCONNECTED) \
+    X(CONNECTING,    "Connecting",    __,         __,        IGN,        CONNECTED, __,        DISCONNECTED, IGN,          __,            DISCONNECTED, IGN,          IGN) \
+    X(LISTENING,     "Connecting",    __,         __,        LISTENING,  __,        CONNECTED, DISCONNECTED, DISCONNECTED, __,            DISCONNECTED, IGN,          IGN) \
+    X(CONNECTED,     "Connected",     __,         __,        __,         __,        __,        __,           __,           DISCONNECTING, DISCONNECTED, DISCONNECTED, IGN)
+
+#define LINK_STATE_ENUM(state, name, e0, e1, e2, e3, e4, e5, e6, e7, e8, e9, e10)  STATE_##state,
+
+/*!
+ * @brief Link state.
  */
 typedef enum {
-    STATE_DISCONNECTED,     /*!< Disconnected - default state.*/
-    STATE_DISCONNECTING,    /*!< Disconnecting. */
-    STATE_CONNECTING,       /*!< Connecting. */
-    STATE_PAIRING,          /*!< Pairing. */
-    STATE_CONNECTED,        /*!< Connected. */
+    LINK_STATES(LINK_STATE_ENUM)
     STATE_LAST              /*!< This must always be the last enumeration value.*/
 } STATE_ENUM_T;
 
@@ -77,6 +320,15 @@ typedef enum {
     ROLE_MASTER,
     ROLE_SLAVE
 } ROLE_ENUM_T;
+/*!
+ * @brief How data received on a link is output in text mode.
+ */
+typedef enum {
+    RX_ENC_TEXT,            /*!< 'Rx <link_id> "..."', the data as it is. */
+    RX_ENC_HEX,             /*!< 'Rx <link_id> h:...', two hex digits a byte. */
+    RX_ENC_BASE64           /*!< 'Rx <link_id> b:...', base64 with padding. */
+} RX_ENC_ENUM_T;
+
 /*!
  * @brief Application internal messages, indicating events or state change.
  */
@@ -85,17 +337,66 @@ typedef enum {
     MSG_CONNECT_MASTER,
     MSG_SLAVE_CONNECTION_TIMEOUT,
     MSG_DISCONNECT,
+    MSG_PING_TIMEOUT,
+    MSG_RX_ROUND,
+    MSG_SNIFF_CHECK,
+    MSG_QUALITY_SAMPLE,
     MSG_LAST                /*!< This must always be the last application message. */
 } APP_MESSAGES_IDS;
 
 
+/*!
+ * @brief Connect master or slave message
+ */
+typedef struct {
+    uint16  tag;            /* Tag of the 'connect' command. */
+} MSG_CONNECT_T;
+
 /*!
  * @brief Disconnect message
  */
 typedef struct {
     uint16  link_id;
+    uint16  tag;            /* Tag of the 'disconnect' command. */
 } MSG_DISCONNECT_T;
 
+/*!
+ * @brief Data to transmit, shared by all the links it is queued on.
+ *
+ * The buffer is freed when the last link has copied it into its sink.
+ */
+typedef struct
+{
+    uint16          refs;       /* Links (and creator) still holding the buffer. */
+    uint16          len;
+    uint8           data[1];
+} TX_BUFFER_T;
+
+/*!
+ * @brief Command parser context.
+ *
+ * Everything about one source of command lines, so that the UART, a remote link or a
+ * script can all feed the same command engine, each with a line of its own.
+ */
+typedef struct
+{
+    const uint8    *buf;        /* Start of the command line. */
+    const uint8    *end;        /* End of the command line. */
+    uint16          pos;        /* Bytes of the source already scanned for a line ending. */
+    Sink            out;        /* Where the output of the commands goes. */
+    bool            echo;       /* Input is echoed to the output as it is scanned. */
+    bool            discard;    /* Dropping the rest of a line that was too long. */
+} CMD_CONTEXT_T;
+
+/*!
+ * @brief A link quality sample.
+ */
+typedef struct
+{
+    int16           rssi;       /* dB from the golden receive power range. */
+    uint8           quality;    /* 255 is the best. */
+} QUALITY_SAMPLE_T;
+
 /*!
  * @brief Connection state information
  */
@@ -105,8 +406,52 @@ typedef struct
     ROLE_ENUM_T     role;       /* Slave or Master */
     STATE_ENUM_T    state;
     Sink            sink;
+    TX_BUFFER_T    *tx_queue[TX_QUEUE_DEPTH];
+    uint16          tx_head;    /* Queue index of the buffer being sent. */
+    uint16          tx_count;   /* Buffers in the queue. */
+    uint16          tx_offs;    /* Bytes of the head buffer already in the sink. */
+    uint16          rx_hwm;     /* UART occupancy above which Rx data is held back. */
+    uint16          rx_weight;  /* Multiple of RX_QUANTUM output per round. */
+    RX_ENC_ENUM_T   rx_enc;     /* Rx output encoding in text mode. */
+    bool            rx_pending; /* Rx data is waiting to be output. */
+    bool            rx_stalled; /* Rx data is waiting for space in the UART. */
+    bool            rx_fc;      /* Host has stopped Rx data (multiplexer mode). */
+    bool            tx_fc;      /* Host has been asked to stop tx data (multiplexer mode). */
+    uint32          rx_stalls;  /* Times Rx data has been held back. */
+    uint16          tag;        /* Tag of the command disconnecting the link. */
+    Sink            ctrl_sink;  /* Control channel for remote commands, 0 if not open. */
+    uint16          ctrl_channel; /* Server channel of the remote control channel (master). */
+    CMD_CONTEXT_T   ctrl_ctx;   /* Command lines from the master (slave). */
+    uint16          unexpected; /* Events the link did not expect in its state. */
+    lp_power_mode   mode;       /* Active or sniff, as the last CL_DM_MODE_CHANGE_EVENT said. */
+    uint16          interval;   /* Sniff interval in slots, in sniff mode. */
+    bool            sniff;      /* The link policy asks for sniff. */
+    uint32          last_active; /* Time of the last data on the link, in ms. */
+    uint16          frame_max;  /* RFCOMM frame size to ask for, 0 for the default. */
+    uint16          frame;      /* RFCOMM frame size the open link agreed on. */
+    int16           rssi;       /* Last RSSI read, until its link quality comes. */
+    QUALITY_SAMPLE_T history[QUALITY_HISTORY]; /* Last samples, oldest at history_head. */
+    uint16          history_head;
+    uint16          history_count;
 } CONN_STATE_T;
 
+/*!
+ * @brief Round trip latency probe state, for the 'ping' command.
+ */
+typedef struct
+{
+    uint16          link_id;    /* Link being probed or NO_ACTIVE if idle. */
+    uint16          count;      /* Number of probes to send. */
+    uint16          size;       /* Size of each probe in bytes. */
+    uint16          seq;        /* Sequence number of the outstanding probe. */
+    uint16          rx;         /* Bytes of the outstanding probe echoed so far. */
+    uint16          lost;       /* Probes that timed out. */
+    uint16          done;       /* Probes that were echoed back in full. */
+    uint32          sent;       /* Time the outstanding probe was sent, in us. */
+    uint16          tag;        /* Tag of the 'ping' command. */
+    uint32          rtt[PING_MAX_COUNT];
+} PING_STATE_T;
+
 /*!
  * @brief Main application data structure and state.
  */
@@ -115,18 +460,37 @@ typedef struct
     TaskData        task;
     Source          uart_source;
     bool            debug;
+    bool            echo;       /* Slave loops RFCOMM data back to the master. */
+    bool            mux;        /* UART traffic is framed per link, see ui.c. */
+    bool            machine;    /* Output for a host program, see cmd_mode(). */
+    RESULT_ENUM_T   result;     /* Result of the command being run. */
     bdaddr          own_addr;
     char            own_name[MAX_OWN_NAME];
     uint16          rfcomm_server_channel;
+    uint16          ctrl_server_channel; /* Our control channel for remote commands (slave). */
+    uint16          ctrl_link;  /* Link whose control channel is being opened (master). */
     uint32          service_record_handle;
     CONN_STATE_T    connection[MAX_CONNECTIONS];
     uint16          conn_count;
     uint16          active;
+    uint16          active_tag; /* Tag of the command that started the active connection. */
+    uint16          tag;        /* Tag output at the start of every line, or NO_TAG. */
     ROLE_ENUM_T     role;
+    PING_STATE_T    ping;
+    uint16          route[MAX_CONNECTIONS]; /* Mask of links each link is forwarded to. */
+    uint16          uart_size;  /* Size of the UART sink buffer. */
+    uint16          uart_hwm;   /* UART occupancy above which no Rx data is output. */
+    uint32          rx_stalls;  /* Times Rx data has been held back, all links. */
+    bool            rx_round;   /* MSG_RX_ROUND is queued. */
+    uint16          rx_next;    /* Link served first in the next round. */
+    uint16          unexpected; /* Link events that came when there was no link for them. */
+    uint16          sniff_idle; /* Time without data before a link goes to sniff, in ms, 0 for never. */
+    lp_power_table  sniff_table; /* Link policy of an idle link. */
+    bool            sniff_check; /* MSG_SNIFF_CHECK is queued. */
+    uint16          quality_interval; /* Time between link quality samples, in ms, 0 for none. */
 } MAIN_APP_T;
 
-extern MAIN_APP_T app;
-extern const uint8 *uart_end;
+extern NODE_LOCAL MAIN_APP_T app;
 
 /*!
  * @brief Shortcut macro to save typing.
@@ -145,10 +509,16 @@ extern const uint8 *uart_end;
  * - %B print Bluetooth Device Address
  * - %c print character
  * - %d print signed 16-bit number in decimal
+ * - %l print unsigned 32-bit number in decimal
  * - %s print NULL terminated string
  * - %x print unsigned 16-bit number in hex (4-digits)
  * - %X print unsigned 8-bit number in hex (2-digits)
  *
+ * Every line starts with '#<tag> ' while app.tag is set, so that the host can tell
+ * which command the output belongs to. command_parse() sets it for the output of a
+ * command and handlers of later completion events set it to the tag stored when the
+ * operation started.
+ *
  * @param fmt const char pointer to null terminated string, which can contain formatting.
  * @param ... variable number of arguments that are to be formatted into the string.
  *
@@ -156,6 +526,95 @@ extern const uint8 *uart_end;
  */
 void print(const char *fmt, ...);
 
+/*!
+ * @brief Output an error, as 'ERROR: ...' or in machine mode as 'E<code>'.
+ *
+ * Sets the result of the command being run.
+ *
+ * @param code The result code.
+ * @param fmt The message, without 'ERROR: ', formatted as for print().
+ * @param ... variable number of arguments that are to be formatted into the string.
+ *
+ * Returns void.
+ */
+void print_error(RESULT_ENUM_T code, const char *fmt, ...);
+
+/*!
+ * @brief Output the progress of a connection, as a message or in machine mode as
+ * 'C<code> <link_id>'.
+ *
+ * @param code The completion code.
+ * @param link_id The link.
+ * @param fmt The message, formatted as for print().
+ * @param ... variable number of arguments that are to be formatted into the string.
+ *
+ * Returns void.
+ */
+void print_completion(COMPLETION_ENUM_T code, uint16 link_id, const char *fmt, ...);
+
+/*!
+ * @brief Output 'Ready.', other than in machine mode.
+ *
+ * Returns void.
+ */
+void print_ready(void);
+
+/*!
+ * @brief Send the output of print() to another sink, e.g. that of a remote link.
+ *
+ * Multiplexer framing only applies to the UART.
+ *
+ * @param sink The sink, the UART sink to go back to normal.
+ *
+ * Returns the sink output was going to before.
+ */
+Sink print_sink(Sink sink);
+
+/*!
+ * @brief Output text that is not NULL terminated, the same way as print().
+ *
+ * @param s The text.
+ * @param len Number of characters.
+ *
+ * Returns void.
+ */
+void print_text(const uint8 *s, uint16 len);
+
+/*!
+ * @brief Output data received on a link.
+ *
+ * In text mode this is an 'Rx <link_id> "..."' line, or the h: or b: form for a link
+ * with hex or base64 Rx encoding. In multiplexer mode it is a frame on the channel
+ * of the link.
+ *
+ * @param link_id The link the data was received on.
+ * @param data The data.
+ * @param len Number of bytes, no more than print_rx_max() allows.
+ *
+ * Returns void.
+ */
+void print_rx(uint16 link_id, const uint8 *data, uint16 len);
+
+/*!
+ * @brief Work out how much received data print_rx() can output.
+ *
+ * @param link_id The link the data was received on, for its Rx encoding.
+ * @param space Bytes of UART sink space available.
+ *
+ * Returns number of bytes of data, 0 if there is not enough space.
+ */
+uint16 print_rx_max(uint16 link_id, uint16 space);
+
+/*!
+ * @brief In multiplexer mode, ask the host to stop or resume sending data for a link.
+ *
+ * @param link_id The link.
+ * @param stop TRUE to stop, FALSE to resume.
+ *
+ * Returns void.
+ */
+void mux_flow(uint16 link_id, bool stop);
+
 /*!
  * @brief Reads the raw UART source stream and parses commands with their parameters.
  *
@@ -171,15 +630,492 @@ void print(const char *fmt, ...);
 void ui_parser(MAIN_APP_T *app, Source src);
 
 /*!
- * @brief Parses the commands entered on the UART command line (ui_parser), and calls the
- * appropriate function to validate the command parameters.
+ * @brief Run every complete command line waiting in a source, other than the UART.
  *
  * @param app The application task structure.
- * @param cmd The command string parameters.
+ * @param ctx The parser context of the source.
+ * @param src The source.
  *
  * @Returns void.
  */
-void command_parse(MAIN_APP_T *app, const uint8 *cmd);
+void ui_source(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, Source src);
+
+/*!
+ * @brief Parses a command line, from the UART (ui_parser) or any other source, and calls
+ * the appropriate function to validate the command parameters.
+ *
+ * A line can hold several commands separated by ';', other than in a string, so that
+ * a host or a script can give a sequence of commands in one go. A tag at the start of
+ * the line applies to all of them.
+ *
+ * The output of the command goes to the output sink of the context.
+ *
+ * @param app The application task structure.
+ * @param ctx The parser context, with the command line from buf to end.
+ *
+ * @Returns void.
+ */
+void command_parse(MAIN_APP_T *app, CMD_CONTEXT_T *ctx);
+
+#ifdef COMMAND_CHECK
+/*!
+ * @brief Check that the command table is sorted, as the lookup relies on it.
+ *
+ * With COMMAND_CHECK defined, an unsorted table panics at start up.
+ *
+ * @returns void.
+ */
+void command_check(void);
+#endif
+
+/*!
+ * @brief A link has connected, start watching it for being idle.
+ *
+ * @param app The application state.
+ * @param link_id The link.
+ *
+ * @returns void.
+ */
+void sniff_link_up(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief There is data for or from a link, so it is not idle. A link in sniff is
+ * taken out of it straight away.
+ *
+ * Also for the host to wake a link up before sending on it.
+ *
+ * @param app The application state.
+ * @param link_id The link.
+ *
+ * @returns void.
+ */
+void sniff_activity(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Put the links that have been idle for long enough into sniff, on
+ * MSG_SNIFF_CHECK.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void sniff_check(MAIN_APP_T *app);
+
+/*!
+ * @brief Change when links go to sniff, and with what interval.
+ *
+ * @param app The application state.
+ * @param idle Time without data before a link goes to sniff, in ms, 0 to turn sniff
+ * off and take every link out of it.
+ * @param min_interval Shortest sniff interval, in slots.
+ * @param max_interval Longest sniff interval, in slots.
+ *
+ * @returns void.
+ */
+void sniff_set(MAIN_APP_T *app, uint16 idle, uint16 min_interval, uint16 max_interval);
+
+/*!
+ * @brief The mode of a link has changed, on CL_DM_MODE_CHANGE_EVENT.
+ *
+ * @param app The application state.
+ * @param m The message.
+ *
+ * @returns void.
+ */
+void sniff_mode_change(MAIN_APP_T *app, const CL_DM_MODE_CHANGE_EVENT_T *m);
+
+/*!
+ * @brief A link has connected, start its link quality history afresh.
+ *
+ * @param app The application state.
+ * @param link_id The link.
+ *
+ * @returns void.
+ */
+void quality_link_up(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Read the RSSI and link quality of every connected link, on
+ * MSG_QUALITY_SAMPLE.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void quality_sample(MAIN_APP_T *app);
+
+/*!
+ * @brief Start or stop sampling the link quality.
+ *
+ * @param app The application state.
+ * @param interval Time between samples, in ms, 0 to stop.
+ *
+ * @returns void.
+ */
+void quality_set(MAIN_APP_T *app, uint16 interval);
+
+/*!
+ * @brief The RSSI of a link has been read, on CL_DM_RSSI_CFM.
+ *
+ * @param app The application state.
+ * @param m The message.
+ *
+ * @returns void.
+ */
+void quality_rssi(MAIN_APP_T *app, const CL_DM_RSSI_CFM_T *m);
+
+/*!
+ * @brief The link quality of a link has been read, on CL_DM_LINK_QUALITY_CFM. Completes
+ * the sample, and adds it to the history of the link.
+ *
+ * @param app The application state.
+ * @param m The message.
+ *
+ * @returns void.
+ */
+void quality_link(MAIN_APP_T *app, const CL_DM_LINK_QUALITY_CFM_T *m);
+
+/*!
+ * @brief Move a link to the state an event leads to.
+ *
+ * An event the state does not expect is counted and ignored, as is one for no link,
+ * e.g. a confirmation that comes when no connection is being made.
+ *
+ * @param app The application state.
+ * @param link_id The link, or NO_ACTIVE.
+ * @param event The event.
+ *
+ * @returns TRUE if the link has moved on, FALSE if the event is to be ignored.
+ */
+bool link_event(MAIN_APP_T *app, uint16 link_id, LINK_EVENT_T event);
+
+/*!
+ * @brief Name of a link state, as the 'state' command outputs it.
+ *
+ * @param state The state.
+ *
+ * @returns The name.
+ */
+const char *link_state_name(STATE_ENUM_T state);
+
+/*!
+ * @brief Set up the block pools, before anything is allocated.
+ *
+ * @returns void.
+ */
+void pool_init(void);
+
+/*!
+ * @brief Initialisation is done, from now on the pools should serve every allocation.
+ *
+ * With POOL_STRICT defined, an allocation on the heap after this panics.
+ *
+ * @returns void.
+ */
+void pool_ready(void);
+
+/*!
+ * @brief Allocate a block from the pools, or from the heap if they have none.
+ *
+ * @param size Bytes needed, in sizeof units.
+ *
+ * @returns The block, panics if there is no memory.
+ */
+void *pool_alloc(uint16 size);
+
+/*!
+ * @brief Give back a block from pool_alloc().
+ *
+ * @param ptr The block.
+ *
+ * @returns void.
+ */
+void pool_free(void *ptr);
+
+/*!
+ * @brief Output the use of every size class and of the heap, a line each.
+ *
+ * @returns void.
+ */
+void pool_report(void);
+
+/*!
+ * @brief Start the statistics over, the high water marks from what is in use now.
+ *
+ * @returns void.
+ */
+void pool_reset(void);
+
+/*!
+ * @brief Allocate a tx buffer, holding one reference for the caller.
+ *
+ * @param len Maximum data size.
+ *
+ * @returns The new buffer, panics if there is no memory.
+ */
+TX_BUFFER_T *tx_buffer_new(uint16 len);
+
+/*!
+ * @brief Drop a reference to a tx buffer, freeing it when it was the last one.
+ *
+ * @param buf The tx buffer.
+ *
+ * @returns void.
+ */
+void tx_buffer_release(TX_BUFFER_T *buf);
+
+/*!
+ * @brief Queue a tx buffer on a connected link and start sending it.
+ *
+ * A link only sends what its sink has space for. The rest is sent on
+ * MESSAGE_MORE_SPACE, so a slow link never holds up the others.
+ *
+ * @param app The application state.
+ * @param link_id The link to send on.
+ * @param buf The data, a reference is taken for the link.
+ *
+ * @returns FALSE if the queue of the link is full.
+ */
+bool tx_queue(MAIN_APP_T *app, uint16 link_id, TX_BUFFER_T *buf);
+
+/*!
+ * @brief Copy as much queued data as the sink of a link has space for.
+ *
+ * @param app The application state.
+ * @param link_id The link to send on.
+ *
+ * @returns void.
+ */
+void tx_drain(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Discard everything queued on a link, e.g. when it is disconnected.
+ *
+ * @param app The application state.
+ * @param link_id The link.
+ *
+ * @returns void.
+ */
+void tx_flush_queue(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Schedule output of data received on a link to the UART.
+ *
+ * @param app The application state.
+ * @param link_id The link the data was received on.
+ *
+ * @returns void.
+ */
+void rx_schedule(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Run a scheduling round, on MSG_RX_ROUND.
+ *
+ * Every link with Rx data gets to output up to RX_QUANTUM times its weight, in turn.
+ * Data is only taken from the RFCOMM source while the UART occupancy is below both
+ * the global and the link's high water mark. What is left stays in the source, so
+ * RFCOMM flow control throttles the remote device, until the next round.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void rx_round(MAIN_APP_T *app);
+
+/*!
+ * @brief The UART has space again, output data that was held back.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void rx_resume(MAIN_APP_T *app);
+
+/*!
+ * @brief Forward data received on a link straight into the sinks of the links it is
+ * routed to.
+ *
+ * Only as much data is forwarded as every destination has space for, the rest stays
+ * in the source until route_more_space() is called for the destination.
+ *
+ * @param app The application state.
+ * @param link_id The link the data was received on.
+ *
+ * @returns FALSE if the link is not routed to any connected link.
+ */
+bool route_forward(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief A link has space in its sink again, forward data waiting for it.
+ *
+ * @param app The application state.
+ * @param link_id The destination link.
+ *
+ * @returns void.
+ */
+void route_more_space(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Loop the RFCOMM source of a link back into its sink, if echo mode is on.
+ *
+ * The echo is done by the firmware with a stream connection, the application does not
+ * see any of the data.
+ *
+ * @param app The application state.
+ * @param link_id The link to start or stop echoing.
+ *
+ * @returns void.
+ */
+void echo_update(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Start sending round trip latency probes on a link.
+ *
+ * @param app The application state.
+ * @param link_id The connected link to probe, the remote must be in echo mode.
+ * @param count Number of probes, 1..PING_MAX_COUNT.
+ * @param size Probe size in bytes, 1..PING_MAX_SIZE.
+ *
+ * @returns void.
+ */
+void ping_start(MAIN_APP_T *app, uint16 link_id, uint16 count, uint16 size);
+
+/*!
+ * @brief Consume echoed probe data from the RFCOMM source of the link being probed.
+ *
+ * @param app The application state.
+ * @param src The RFCOMM source of the link being probed.
+ *
+ * @returns void.
+ */
+void ping_more_data(MAIN_APP_T *app, Source src);
+
+/*!
+ * @brief The outstanding probe was not echoed back in time.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void ping_timeout(MAIN_APP_T *app);
+
+/*!
+ * @brief Abort the ping on a link that has gone away, reporting what was measured.
+ *
+ * @param app The application state.
+ * @param link_id The link that was disconnected.
+ *
+ * @returns void.
+ */
+void ping_link_lost(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Handle data on the control channel of a link.
+ *
+ * A slave runs the command lines from its master, replying on the same channel. A
+ * master outputs each reply line as 'Remote <link_id>: ...'.
+ *
+ * @param app The application state.
+ * @param link_id The link.
+ *
+ * @returns void.
+ */
+void remote_more_data(MAIN_APP_T *app, uint16 link_id);
+
+/*!
+ * @brief Send a command line to the slave on a link, over its control channel.
+ *
+ * The line goes with the tag of the current command, if it has one, so that the
+ * replies come back with it.
+ *
+ * @param app The application state.
+ * @param link_id The link.
+ * @param cmd The command line, without a line ending.
+ * @param len Length of the command line.
+ *
+ * @returns FALSE if the control channel has no space for it.
+ */
+bool remote_send(MAIN_APP_T *app, uint16 link_id, const uint8 *cmd, uint16 len);
+
+/*!
+ * @brief Output every stored script, as 'Script <name> <commands>'.
+ *
+ * @returns void.
+ */
+void script_list(void);
+
+/*!
+ * @brief Store a script in PS, replacing any script with the same name.
+ *
+ * @param name The name of the script.
+ * @param name_len Length of the name.
+ * @param cmds The commands, separated by ';'. No commands deletes the script.
+ * @param len Length of the commands.
+ *
+ * @returns FALSE if there is no room for the script.
+ */
+bool script_store(const uint8 *name, uint16 name_len, const uint8 *cmds, uint16 len);
+
+/*!
+ * @brief Run a stored script.
+ *
+ * @param app The application state.
+ * @param name The name of the script.
+ * @param len Length of the name.
+ * @param out Where the output of the commands goes.
+ *
+ * @returns FALSE if there is no such script.
+ */
+bool script_run(MAIN_APP_T *app, const uint8 *name, uint16 len, Sink out);
+
+/*!
+ * @brief Run the script named 'boot', if there is one, once initialisation is done.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void script_boot(MAIN_APP_T *app);
+
+#ifdef ENABLE_PROFILE
+/*!
+ * @brief A message is about to be handled, sample the queue and start timing it.
+ *
+ * @param app The application state.
+ *
+ * @returns void.
+ */
+void prof_begin(MAIN_APP_T *app);
+
+/*!
+ * @brief A message has been handled, add its time to the profile of its id.
+ *
+ * @param id The message id.
+ *
+ * @returns void.
+ */
+void prof_end(MessageId id);
+
+/*!
+ * @brief Output the profile, a line per message id and a summary line.
+ *
+ * @returns void.
+ */
+void prof_report(void);
+
+/*!
+ * @brief Clear the profile and start a new one.
+ *
+ * @returns void.
+ */
+void prof_reset(void);
+
+#define PROF_BEGIN(app)     prof_begin(app)
+#define PROF_END(id)        prof_end(id)
+#else
+#define PROF_BEGIN(app)
+#define PROF_END(id)
+#endif
 
 
 #endif
@@ -0,0 +1,120 @@
+/*!
+ * @file route.c
+ *
+ * @brief Forwarding of data between links on the master.
+ *
+ * Data received on a link that has a route is copied straight from its source into
+ * the sinks of the destination links, instead of being output on the UART. No memory
+ * is allocated, and the source is only dropped once every destination has taken the
+ * data, so RFCOMM flow control throttles the sender to the speed of the slowest
+ * destination.
+ */
+
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+#include <string.h>
+
+#include "rfcomm_multi_slave.h"
+
+/*************************************************************************
+NAME
+    route_destinations
+
+DESCRIPTION
+    Get the routed links that are connected.
+
+RETURNS
+    Mask of link ids.
+*/
+static uint16 route_destinations(MAIN_APP_T *app, uint16 link_id)
+{
+    uint16 mask = 0;
+    uint16 i;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (
+            (app->route[link_id] & (1 << i)) &&
+            app->connection[i].state == STATE_CONNECTED
+            )
+        {
+            mask |= 1 << i;
+        }
+    }
+
+    return mask;
+}
+
+bool route_forward(MAIN_APP_T *app, uint16 link_id)
+{
+    uint16 mask = route_destinations(app, link_id);
+    Source src = StreamSourceFromSink(app->connection[link_id].sink);
+    const uint8 *data;
+    uint16 len;
+    uint16 offs;
+    uint8 *dest;
+    uint16 i;
+
+    if (!mask)
+        return FALSE;
+
+    len = SourceSize(src);
+
+    for (i=0; i<MAX_CONNECTIONS && len; i++)
+    {
+        if (!(mask & (1 << i)))
+            continue;
+
+        /* Don't split data that is part way through being sent from a tx command. */
+        if (app->connection[i].tx_count)
+            len = 0;
+        else if (SinkSlack(app->connection[i].sink) < len)
+            len = SinkSlack(app->connection[i].sink);
+    }
+
+    if (!len || !(data = SourceMap(src)))
+        return TRUE;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (!(mask & (1 << i)))
+            continue;
+
+        if (
+            (offs = SinkClaim(app->connection[i].sink, len)) != 0xffff &&
+            (dest = SinkMap(app->connection[i].sink))
+            )
+        {
+            memmove(dest + offs, data, len);
+            SinkFlush(app->connection[i].sink, len);
+            sniff_activity(app, i);
+        }
+        else
+        {
+            if (app->debug) print("DBG: Route %d to %d failed!\r\n", link_id, i);
+        }
+    }
+
+    SourceDrop(src, len);
+    return TRUE;
+}
+
+void route_more_space(MAIN_APP_T *app, uint16 link_id)
+{
+    uint16 i;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (
+            (app->route[i] & (1 << link_id)) &&
+            app->connection[i].state == STATE_CONNECTED &&
+            SourceSize(StreamSourceFromSink(app->connection[i].sink))
+            )
+        {
+            route_forward(app, i);
+        }
+    }
+}
+
+/* End-of-File */
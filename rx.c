@@ -0,0 +1,199 @@
+/*!
+ * @file rx.c
+ *
+ * @brief Output of data received on the links to the UART.
+ *
+ * The UART is usually much slower than the links. Rather than pulling everything out
+ * of the RFCOMM sources and then spinning in print() until the UART has drained, data
+ * is only taken out of a source as far as the UART can accept it. The rest is held
+ * back in the source, where RFCOMM credit flow control throttles the remote device,
+ * until MESSAGE_MORE_SPACE from the UART sink.
+ *
+ * Links are served round robin, a bounded quantum per link per round, with a round
+ * being one MSG_RX_ROUND message. So a busy link can't monopolise the UART, and other
+ * messages are handled between rounds.
+ */
+
+#include <sink.h>
+#include <source.h>
+#include <stream.h>
+
+#include "rfcomm_multi_slave.h"
+
+/*************************************************************************
+NAME
+    rx_allowance
+
+DESCRIPTION
+    Work out how much the UART can take for a link, keeping below the
+    global and per-link high water marks.
+
+RETURNS
+    Number of bytes.
+*/
+static uint16 rx_allowance(MAIN_APP_T *app, uint16 link_id)
+{
+    uint16 used = app->uart_size - SinkSlack(StreamUartSink());
+    uint16 hwm = app->uart_hwm;
+
+    if (app->connection[link_id].rx_hwm < hwm)
+        hwm = app->connection[link_id].rx_hwm;
+
+    return (used < hwm) ? hwm - used : 0;
+}
+
+/*************************************************************************
+NAME
+    rx_stall
+
+DESCRIPTION
+    Count a link having to wait for the UART.
+
+RETURNS
+
+*/
+static void rx_stall(MAIN_APP_T *app, CONN_STATE_T *conn)
+{
+    if (!conn->rx_stalled)
+    {
+        conn->rx_stalled = TRUE;
+        conn->rx_stalls += 1;
+        app->rx_stalls += 1;
+    }
+}
+
+/*************************************************************************
+NAME
+    rx_service
+
+DESCRIPTION
+    Output up to one quantum of a link's Rx data.
+
+RETURNS
+    TRUE if the link has more data that the UART could take.
+*/
+static bool rx_service(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+    Source src = StreamSourceFromSink(conn->sink);
+    uint16 len = SourceSize(src);
+    uint16 quantum = RX_QUANTUM * conn->rx_weight;
+    uint16 allowance;
+    const uint8 *data;
+
+    if (!len || !(data = SourceMap(src)))
+    {
+        conn->rx_pending = FALSE;
+        conn->rx_stalled = FALSE;
+        return FALSE;
+    }
+
+    allowance = print_rx_max(link_id, rx_allowance(app, link_id));
+
+    if (!allowance)
+    {
+        rx_stall(app, conn);
+        return FALSE;
+    }
+
+    if (len > quantum)
+        len = quantum;
+
+    if (len > allowance)
+        len = allowance;
+
+    print_rx(link_id, data, len);
+    SourceDrop(src, len);
+
+    if (!SourceSize(src))
+    {
+        conn->rx_pending = FALSE;
+        conn->rx_stalled = FALSE;
+        return FALSE;
+    }
+
+    if (!print_rx_max(link_id, rx_allowance(app, link_id)))
+    {
+        rx_stall(app, conn);
+        return FALSE;
+    }
+
+    conn->rx_stalled = FALSE;
+    return TRUE;
+}
+
+/*************************************************************************
+NAME
+    rx_queue_round
+
+DESCRIPTION
+    Queue MSG_RX_ROUND, unless it is already queued.
+
+RETURNS
+
+*/
+static void rx_queue_round(MAIN_APP_T *app)
+{
+    if (!app->rx_round)
+    {
+        app->rx_round = TRUE;
+        MessageSend(&app->task, MSG_RX_ROUND, 0);
+    }
+}
+
+void rx_schedule(MAIN_APP_T *app, uint16 link_id)
+{
+    app->connection[link_id].rx_pending = TRUE;
+    rx_queue_round(app);
+}
+
+void rx_round(MAIN_APP_T *app)
+{
+    bool more = FALSE;
+    uint16 link_id;
+    uint16 i;
+
+    app->rx_round = FALSE;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        link_id = (app->rx_next + i) % MAX_CONNECTIONS;
+
+        /* In multiplexer mode the host can stop a link with flow control. */
+        if (
+            app->connection[link_id].rx_pending &&
+            !app->connection[link_id].rx_fc &&
+            app->connection[link_id].state == STATE_CONNECTED
+            )
+        {
+            if (rx_service(app, link_id))
+                more = TRUE;
+        }
+    }
+
+    /* A different link goes first next time. */
+    app->rx_next = (app->rx_next + 1) % MAX_CONNECTIONS;
+
+    /* Links held back by the UART carry on from rx_resume(). */
+    if (more)
+        rx_queue_round(app);
+}
+
+void rx_resume(MAIN_APP_T *app)
+{
+    uint16 i;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        if (
+            app->connection[i].rx_stalled &&
+            app->connection[i].state == STATE_CONNECTED
+            )
+        {
+            rx_queue_round(app);
+            return;
+        }
+    }
+}
+
+/* End-of-File */
@@ -0,0 +1,240 @@
+/*!
+ * @file script.c
+ *
+ * @brief Command scripts, stored in PS.
+ *
+ * A script is a named command line, its commands separated by ';', kept in a user PS
+ * key so that it survives a reset. 'run <name>' runs it as if the line had been typed,
+ * and the script named 'boot' is run once initialisation is complete, so a module can
+ * be provisioned without a command line round trip per setting.
+ *
+ * PS keys hold 16-bit words, so the text "<name> <commands>" is stored two characters
+ * to a word, after a word with its length.
+ */
+
+#include <ps.h>
+#include <stream.h>
+
+#include "rfcomm_multi_slave.h"
+
+/* Returned by script_find() when there is no such script. */
+#define SCRIPT_NONE     0xFFFF
+
+/* Words of a PS key holding SCRIPT_MAX_LEN characters. */
+#define SCRIPT_WORDS    (1 + (SCRIPT_MAX_LEN + 1) / 2)
+
+/* C defines blank as space, \f, \n, \r, and \t, but space is enough for now */
+#define isblank(c)      (c == ' ')
+
+typedef struct
+{
+    uint16  words[SCRIPT_WORDS];    /* As stored in PS. */
+    uint8   text[SCRIPT_MAX_LEN];   /* Unpacked. */
+    uint16  len;                    /* Characters in text. */
+} SCRIPT_BUF_T;
+
+/* A script is running, scripts can not run scripts. */
+static NODE_LOCAL bool script_running = FALSE;
+
+/*************************************************************************
+NAME
+    script_load
+
+DESCRIPTION
+    Read a script from PS and unpack it.
+
+RETURNS
+    TRUE if the slot holds a script.
+*/
+static bool script_load(uint16 slot, SCRIPT_BUF_T *b)
+{
+    uint16 words = PsRetrieve(PS_KEY_SCRIPT + slot, b->words, SCRIPT_WORDS);
+    uint16 i;
+
+    b->len = 0;
+
+    if (!words || !b->words[0] || b->words[0] > SCRIPT_MAX_LEN ||
+        1 + (b->words[0] + 1) / 2 > words)
+    {
+        return FALSE;
+    }
+
+    b->len = b->words[0];
+
+    for (i=0; i<b->len; i++)
+        b->text[i] = (b->words[1 + i/2] >> ((i & 1) ? 8 : 0)) & 0xFF;
+
+    return TRUE;
+}
+
+/*************************************************************************
+NAME
+    script_name_len
+
+DESCRIPTION
+    Get the length of the name at the start of a loaded script.
+
+RETURNS
+    Number of characters.
+*/
+static uint16 script_name_len(const SCRIPT_BUF_T *b)
+{
+    uint16 i;
+
+    for (i=0; i<b->len && !isblank(b->text[i]); i++)
+        ;
+    return i;
+}
+
+/*************************************************************************
+NAME
+    script_find
+
+DESCRIPTION
+    Find a script by name, leaving it loaded in the buffer.
+
+RETURNS
+    The slot of the script, or SCRIPT_NONE with *free_slot set to a slot
+    that is not used (SCRIPT_NONE if they all are).
+*/
+static uint16 script_find(SCRIPT_BUF_T *b,
+                          const uint8 *name,
+                          uint16 len,
+                          uint16 *free_slot)
+{
+    uint16 slot;
+    uint16 i;
+
+    *free_slot = SCRIPT_NONE;
+
+    for (slot=0; slot<SCRIPT_SLOTS; slot++)
+    {
+        if (!script_load(slot, b))
+        {
+            if (*free_slot == SCRIPT_NONE)
+                *free_slot = slot;
+            continue;
+        }
+
+        if (script_name_len(b) != len)
+            continue;
+
+        for (i=0; i<len && b->text[i] == name[i]; i++)
+            ;
+
+        if (i == len)
+            return slot;
+    }
+    return SCRIPT_NONE;
+}
+
+void script_list(void)
+{
+    SCRIPT_BUF_T *b = (SCRIPT_BUF_T *)pool_alloc(sizeof(SCRIPT_BUF_T));
+    uint16 slot;
+
+    for (slot=0; slot<SCRIPT_SLOTS; slot++)
+    {
+        if (script_load(slot, b))
+        {
+            print("Script ");
+            print_text(b->text, b->len);
+            print("\r\n");
+        }
+    }
+    pool_free(b);
+}
+
+bool script_store(const uint8 *name, uint16 name_len, const uint8 *cmds, uint16 len)
+{
+    SCRIPT_BUF_T *b = (SCRIPT_BUF_T *)pool_alloc(sizeof(SCRIPT_BUF_T));
+    uint16 free_slot;
+    uint16 slot = script_find(b, name, name_len, &free_slot);
+    uint16 i;
+    bool rc = TRUE;
+
+    /* No commands deletes the script. */
+    if (!len)
+    {
+        if (slot != SCRIPT_NONE)
+            PsStore(PS_KEY_SCRIPT + slot, NULL, 0);
+    }
+    else if (slot == SCRIPT_NONE && free_slot == SCRIPT_NONE)
+    {
+        rc = FALSE;
+    }
+    else
+    {
+        if (slot == SCRIPT_NONE)
+            slot = free_slot;
+
+        b->len = 0;
+        for (i=0; i<name_len; i++)
+            b->text[b->len++] = name[i];
+        b->text[b->len++] = ' ';
+        for (i=0; i<len; i++)
+            b->text[b->len++] = cmds[i];
+
+        b->words[0] = b->len;
+        for (i=0; i<b->len; i+=2)
+        {
+            b->words[1 + i/2] = b->text[i] & 0xFF;
+            if (i + 1 < b->len)
+                b->words[1 + i/2] |= (uint16)(b->text[i+1] & 0xFF) << 8;
+        }
+
+        rc = PsStore(PS_KEY_SCRIPT + slot, b->words, 1 + (b->len + 1) / 2) != 0;
+    }
+
+    pool_free(b);
+    return rc;
+}
+
+bool script_run(MAIN_APP_T *app, const uint8 *name, uint16 len, Sink out)
+{
+    SCRIPT_BUF_T *b;
+    CMD_CONTEXT_T ctx;
+    uint16 free_slot;
+    uint16 name_len;
+
+    if (script_running)
+    {
+        print_error(RESULT_NOT_ALLOWED, "Scripts can not run scripts.\r\n");
+        return TRUE;
+    }
+
+    b = (SCRIPT_BUF_T *)pool_alloc(sizeof(SCRIPT_BUF_T));
+
+    if (script_find(b, name, len, &free_slot) == SCRIPT_NONE)
+    {
+        pool_free(b);
+        return FALSE;
+    }
+
+    name_len = script_name_len(b);
+
+    ctx.buf = b->text + name_len;
+    ctx.end = b->text + b->len;
+    ctx.pos = 0;
+    ctx.discard = FALSE;
+    ctx.out = out;
+    ctx.echo = FALSE;
+
+    script_running = TRUE;
+    command_parse(app, &ctx);
+    script_running = FALSE;
+
+    pool_free(b);
+    return TRUE;
+}
+
+void script_boot(MAIN_APP_T *app)
+{
+    static const uint8 boot[] = { 'b', 'o', 'o', 't' };
+
+    if (app->debug) print("DBG: script_boot\r\n");
+
+    script_run(app, boot, sizeof(boot), StreamUartSink());
+}
+
+/* End-of-File */
@@ -0,0 +1,176 @@
+/*!
+ * @file sniff.c
+ *
+ * @brief Sniff mode for links without traffic.
+ *
+ * In active mode the master polls a slave in every other slot, whether there is data
+ * or not. That is air time the busy links could have used, and a slave that has to
+ * listen all the time runs its battery down. A link that has had no data for
+ * sniff_idle ms is put into sniff: master and slave only meet every sniff interval,
+ * and the slave can sleep in between.
+ *
+ * Every link keeps the time of its last data. MSG_SNIFF_CHECK comes when the link
+ * that has been quiet the longest is due to go to sniff, so the check only runs
+ * while there are active links, and no more often than links can go idle. Data to
+ * send, data received, or the host asking for it takes a link out of sniff at once,
+ * with a link policy for active mode, rather than waiting for the next sniff anchor.
+ *
+ * A slave that echoes its data does not see it, so it never puts its link into
+ * sniff. Its master does, when there is no data to echo.
+ */
+
+#include <bdaddr.h>
+#include <connection.h>
+#include <message.h>
+#include <vm.h>
+
+#include "rfcomm_multi_slave.h"
+
+/* Link policy of a link with data. */
+static const lp_power_table sniff_active[] =
+{
+    { lp_active, 0, 0, 0, 0, 0 }
+};
+
+/*************************************************************************
+NAME
+    sniff_schedule
+
+DESCRIPTION
+    Queue MSG_SNIFF_CHECK to come after the given time, unless it is
+    queued already or sniff is off.
+
+RETURNS
+
+*/
+static void sniff_schedule(MAIN_APP_T *app, uint16 delay)
+{
+    if (app->sniff_idle && !app->sniff_check)
+    {
+        app->sniff_check = TRUE;
+        MessageSendLater(&app->task, MSG_SNIFF_CHECK, 0, delay);
+    }
+}
+
+/*************************************************************************
+NAME
+    sniff_policy
+
+DESCRIPTION
+    Set the link policy of a link, for sniff or for active mode.
+
+RETURNS
+
+*/
+static void sniff_policy(MAIN_APP_T *app, uint16 link_id, bool sniff)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+
+    if (app->debug) print("DBG: Link %d to %s\r\n", link_id, (sniff) ? "sniff" : "active");
+
+    conn->sniff = sniff;
+    ConnectionSetLinkPolicy(conn->sink, 1, (sniff) ? &app->sniff_table : sniff_active);
+}
+
+void sniff_link_up(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+
+    conn->mode = lp_active;
+    conn->interval = 0;
+    conn->sniff = FALSE;
+    conn->last_active = VmGetClock();
+    sniff_schedule(app, app->sniff_idle);
+}
+
+void sniff_activity(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+
+    conn->last_active = VmGetClock();
+
+    if (conn->sniff)
+        sniff_policy(app, link_id, FALSE);
+
+    sniff_schedule(app, app->sniff_idle);
+}
+
+void sniff_check(MAIN_APP_T *app)
+{
+    uint32 now = VmGetClock();
+    uint16 next = 0;
+    uint16 i;
+
+    app->sniff_check = FALSE;
+
+    if (!app->sniff_idle || (app->role == ROLE_SLAVE && app->echo))
+        return;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        CONN_STATE_T *conn = &app->connection[i];
+        uint32 idle = now - conn->last_active;
+
+        if (conn->state != STATE_CONNECTED || conn->sniff)
+            continue;
+
+        if (idle >= app->sniff_idle)
+            sniff_policy(app, i, TRUE);
+        else if (!next || app->sniff_idle - (uint16)idle < next)
+            next = app->sniff_idle - (uint16)idle;
+    }
+
+    /* Until the next active link is due to go. */
+    if (next)
+        sniff_schedule(app, next);
+}
+
+void sniff_set(MAIN_APP_T *app, uint16 idle, uint16 min_interval, uint16 max_interval)
+{
+    uint16 i;
+
+    app->sniff_idle = idle;
+    app->sniff_table.state = lp_sniff;
+    app->sniff_table.min_interval = min_interval;
+    app->sniff_table.max_interval = max_interval;
+    app->sniff_table.attempt = SNIFF_ATTEMPT;
+    app->sniff_table.timeout = SNIFF_TIMEOUT;
+    app->sniff_table.time = 0;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        CONN_STATE_T *conn = &app->connection[i];
+
+        if (conn->state != STATE_CONNECTED)
+            continue;
+
+        /* Wake every link, so that new intervals apply when it goes to sniff again. */
+        if (conn->sniff)
+            sniff_policy(app, i, FALSE);
+        conn->last_active = VmGetClock();
+    }
+
+    MessageCancelAll(&app->task, MSG_SNIFF_CHECK);
+    app->sniff_check = FALSE;
+    sniff_schedule(app, idle);
+}
+
+void sniff_mode_change(MAIN_APP_T *app, const CL_DM_MODE_CHANGE_EVENT_T *m)
+{
+    uint16 i;
+
+    for (i=0; i<MAX_CONNECTIONS; i++)
+    {
+        CONN_STATE_T *conn = &app->connection[i];
+
+        if (conn->state == STATE_CONNECTED && BdaddrIsSame(&m->bd_addr, &conn->addr))
+        {
+            if (app->debug) print("DBG: Link %d in %s mode, interval %d\r\n", i,
+                                  (m->mode == lp_sniff) ? "sniff" : "active", m->interval);
+            conn->mode = m->mode;
+            conn->interval = m->interval;
+        }
+    }
+}
+
+/* End-of-File */
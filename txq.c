@@ -0,0 +1,124 @@
+/*!
+ * @file txq.c
+ *
+ * @brief Per-link transmit queues.
+ *
+ * Data from a 'tx' command is parsed once into a reference counted buffer, which is
+ * then queued on every target link. Each link copies the buffer into its own sink as
+ * space becomes available, so a stalled slave never delays delivery to the others.
+ */
+
+#include <sink.h>
+#include <string.h>
+
+#include "rfcomm_multi_slave.h"
+
+TX_BUFFER_T *tx_buffer_new(uint16 len)
+{
+    TX_BUFFER_T *buf = (TX_BUFFER_T *)pool_alloc(sizeof(TX_BUFFER_T) + len);
+
+    buf->refs = 1;
+    buf->len = len;
+    return buf;
+}
+
+void tx_buffer_release(TX_BUFFER_T *buf)
+{
+    if (--buf->refs == 0)
+        pool_free(buf);
+}
+
+bool tx_queue(MAIN_APP_T *app, uint16 link_id, TX_BUFFER_T *buf)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+
+    if (conn->tx_count == TX_QUEUE_DEPTH)
+        return FALSE;
+
+    buf->refs += 1;
+    conn->tx_queue[(conn->tx_head + conn->tx_count) % TX_QUEUE_DEPTH] = buf;
+    conn->tx_count += 1;
+
+    tx_drain(app, link_id);
+
+    /* In multiplexer mode ask the host to wait until there is room again. */
+    if (app->mux && conn->tx_count == TX_QUEUE_DEPTH && !conn->tx_fc)
+    {
+        conn->tx_fc = TRUE;
+        mux_flow(link_id, TRUE);
+    }
+    return TRUE;
+}
+
+void tx_drain(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+    TX_BUFFER_T *buf;
+    uint16 len;
+    uint16 offs;
+    uint8 *data;
+
+    while (conn->tx_count)
+    {
+        buf = conn->tx_queue[conn->tx_head];
+
+        len = buf->len - conn->tx_offs;
+        if (len > SinkSlack(conn->sink))
+            len = SinkSlack(conn->sink);
+
+        /* Wait for MESSAGE_MORE_SPACE. */
+        if (!len)
+            return;
+
+        if (
+            (offs = SinkClaim(conn->sink, len)) == 0xffff ||
+            !(data = SinkMap(conn->sink))
+            )
+        {
+            if (app->debug) print("DBG: Tx SinkClaim or SinkMap failed!\r\n");
+            return;
+        }
+
+        memmove(data + offs, buf->data + conn->tx_offs, len);
+        SinkFlush(conn->sink, len);
+        sniff_activity(app, link_id);
+        conn->tx_offs += len;
+
+        if (conn->tx_offs == buf->len)
+        {
+            tx_buffer_release(buf);
+            conn->tx_head = (conn->tx_head + 1) % TX_QUEUE_DEPTH;
+            conn->tx_count -= 1;
+            conn->tx_offs = 0;
+
+            if (conn->tx_fc)
+            {
+                conn->tx_fc = FALSE;
+                mux_flow(link_id, FALSE);
+            }
+        }
+    }
+}
+
+void tx_flush_queue(MAIN_APP_T *app, uint16 link_id)
+{
+    CONN_STATE_T *conn = &app->connection[link_id];
+
+    while (conn->tx_count)
+    {
+        tx_buffer_release(conn->tx_queue[conn->tx_head]);
+        conn->tx_head = (conn->tx_head + 1) % TX_QUEUE_DEPTH;
+        conn->tx_count -= 1;
+    }
+
+    conn->tx_head = 0;
+    conn->tx_offs = 0;
+
+    if (conn->tx_fc)
+    {
+        conn->tx_fc = FALSE;
+        mux_flow(link_id, FALSE);
+    }
+}
+
+/* End-of-File */
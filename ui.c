@@ -2,6 +2,22 @@
  * @file ui.c
  * 
  * @brief  User interface (UART) handling.
+ *
+ * In multiplexer mode all UART traffic is framed, in the style of the 3GPP TS 07.10
+ * basic option, so the host can treat every link as its own serial port:
+ *
+ *     F9 | address | control | length | info | FCS | F9
+ *
+ * - address is DLCI << 2 | C/R << 1 | EA. DLCI 0 is the command line, DLCI n is
+ *   link n-1.
+ * - control is UIH (0xEF) for data and the command line, UI (0x03) for multiplexer
+ *   control messages on DLCI 0.
+ * - length is info length << 1 | EA, so info is at most 127 bytes.
+ * - FCS is the 07.10 CRC-8 over address, control and length.
+ *
+ * Frames are length delimited, so data is binary transparent. Per channel flow
+ * control uses 07.10 MSC messages with the FC bit. A CLD message goes back to
+ * text mode.
  */
 
 #include <stdio.h>
@@ -12,39 +28,265 @@
 #include <string.h>
 
 #include "rfcomm_multi_slave.h"
+#include "codec.h"
+
+#define MUX_FLAG        0xF9
+#define MUX_EA          0x01    /* Extension bit, set in the last octet of a field. */
+#define MUX_CR          0x02    /* Command/response bit. */
+#define MUX_PF          0x10    /* Poll/final bit of the control field. */
+#define MUX_UIH         0xEF    /* Data and command line frames. */
+#define MUX_UI          0x03    /* Multiplexer control message frames. */
+#define MUX_MAX_INFO    127     /* Longest info field with a single length octet. */
+#define MUX_OVERHEAD    6       /* Flag, address, control, length, FCS and flag. */
+#define MUX_GOOD_FCS    0xCF    /* CRC over the checked octets and a correct FCS. */
+
+#define MUX_MSC_CMD     0xE3    /* Modem status command. */
+#define MUX_MSC_RSP     0xE1    /* Modem status response. */
+#define MUX_CLD_CMD     0xC3    /* Multiplexer close down command. */
+#define MUX_CLD_RSP     0xC1    /* Multiplexer close down response. */
+#define MUX_V24_FC      0x02    /* Flow control bit of the MSC V.24 signals. */
 
-const uint8 *uart_end = NULL;
 static const char *hex = "0123456789abcdef";
 
+/* Command line output waiting to be sent on DLCI 0 in multiplexer mode. */
+static NODE_LOCAL uint8 mux_text[MUX_MAX_INFO];
+static NODE_LOCAL uint16 mux_text_len = 0;
+
+/* Nothing has been output on the current command line output line yet. */
+static NODE_LOCAL bool line_start = TRUE;
+
+/* Sink print() output goes to instead of the UART, see print_sink(). */
+static NODE_LOCAL Sink out_sink = 0;
+
+/* Command line input from the UART. */
+static NODE_LOCAL CMD_CONTEXT_T uart_ctx;
+
 /*************************************************************************
 NAME    
-    uart_copy
+    sink_space
     
 DESCRIPTION
-    Copy a string into the UART sink.
+    Claim space in a sink. For the UART wait for it if need be, other
+    sinks are not waited for.
 
 RETURNS
-    Number of bytes copied
+    Where to write the data, NULL on failure.
 */
-static uint16 uart_copy(const char *s, uint16 len)
+static uint8 *sink_space(Sink sink, uint16 len)
 {
     uint16 offs;
     uint8 *data;
     
-    while ( (SinkSlack(StreamUartSink())) < len )  
+    while ( sink == StreamUartSink() && (SinkSlack(sink)) < len )  
     {
-        SinkFlush(StreamUartSink(), 1);
+        SinkFlush(sink, 1);
     }
     
-    if ((offs = SinkClaim(StreamUartSink(), len)) != 0xffff &&
-        (data = SinkMap(StreamUartSink())))
+    if ((offs = SinkClaim(sink, len)) != 0xffff &&
+        (data = SinkMap(sink)))
     {
-        memmove(data + offs, s, len);
+        return data + offs;
+    }
+    return NULL;
+}
+
+/*************************************************************************
+NAME    
+    uart_raw
+    
+DESCRIPTION
+    Copy a string into the UART sink.
+
+RETURNS
+    Number of bytes copied
+*/
+static uint16 uart_raw(const char *s, uint16 len)
+{
+    uint8 *data = sink_space(StreamUartSink(), len);
+    
+    if (data)
+    {
+        memmove(data, s, len);
         return len;
     }
     return 0;
 }
 
+/*************************************************************************
+NAME    
+    mux_crc
+    
+DESCRIPTION
+    Run the 07.10 CRC-8 (reversed polynomial 0xE0) over some octets.
+
+RETURNS
+    The updated CRC, start with 0xFF.
+*/
+static uint8 mux_crc(uint8 crc, const uint8 *p, uint16 len)
+{
+    uint16 i;
+
+    while (len--)
+    {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xE0) : (crc >> 1);
+    }
+    return crc & 0xFF;
+}
+
+/*************************************************************************
+NAME    
+    mux_frame
+    
+DESCRIPTION
+    Copy a multiplexer frame into the UART sink.
+
+RETURNS
+    
+*/
+static void mux_frame(uint16 dlci, uint8 ctrl, const uint8 *info, uint16 len)
+{
+    uint8 head[4];
+    uint8 tail[2];
+
+    /* We are the responder, so C/R is clear. */
+    head[0] = MUX_FLAG;
+    head[1] = (uint8)((dlci << 2) | MUX_EA);
+    head[2] = ctrl;
+    head[3] = (uint8)((len << 1) | MUX_EA);
+
+    tail[0] = 0xFF - mux_crc(0xFF, &head[1], 3);
+    tail[1] = MUX_FLAG;
+
+    uart_raw((const char *)head, 4);
+    uart_raw((const char *)info, len);
+    uart_raw((const char *)tail, 2);
+}
+
+/*************************************************************************
+NAME    
+    mux_text_flush
+    
+DESCRIPTION
+    Send pending command line output as a frame on DLCI 0.
+
+RETURNS
+    
+*/
+static void mux_text_flush(void)
+{
+    if (mux_text_len)
+    {
+        mux_frame(0, MUX_UIH, mux_text, mux_text_len);
+        mux_text_len = 0;
+    }
+}
+
+/*************************************************************************
+NAME    
+    uart_text
+    
+DESCRIPTION
+    Copy a string into the UART sink, or into the DLCI 0 frame in
+    multiplexer mode, or into the sink output has been redirected to.
+
+RETURNS
+    Number of bytes copied
+*/
+static uint16 uart_text(const char *s, uint16 len)
+{
+    uint16 done;
+    uint16 n;
+    uint8 *data;
+
+    if (out_sink)
+    {
+        /* Output that does not fit is lost, rather than block on a link. */
+        if (!(data = sink_space(out_sink, len)))
+            return 0;
+        memmove(data, s, len);
+        return len;
+    }
+
+    if (!app.mux)
+        return uart_raw(s, len);
+
+    for (done = 0; done < len; done += n)
+    {
+        n = len - done;
+        if (n > MUX_MAX_INFO - mux_text_len)
+            n = MUX_MAX_INFO - mux_text_len;
+
+        memmove(&mux_text[mux_text_len], s + done, n);
+        mux_text_len += n;
+
+        if (mux_text_len == MUX_MAX_INFO)
+            mux_text_flush();
+    }
+    return len;
+}
+
+/*************************************************************************
+NAME    
+    tag_to_uart
+    
+DESCRIPTION
+    Output the '#tag ' prefix of a line.
+
+RETURNS
+
+*/
+static void tag_to_uart(uint16 tag)
+{
+    char buf[7]; /* '#', up to 5 digits and ' ' */
+    char *p = &buf[7];
+
+    *(--p) = ' ';
+    do
+    {
+        *(--p) = '0' + (tag % 10);
+        tag /= 10;
+    } while (tag);
+    *(--p) = '#';
+
+    uart_text(p, 7 - (p - buf));
+}
+
+/*************************************************************************
+NAME    
+    uart_copy
+    
+DESCRIPTION
+    Copy command line output, starting every line with the tag of the
+    command it belongs to, if that command had one.
+
+RETURNS
+    Number of bytes copied
+*/
+static uint16 uart_copy(const char *s, uint16 len)
+{
+    uint16 done;
+    uint16 n;
+
+    for (done = 0; done < len; done += n)
+    {
+        if (line_start && app.tag != NO_TAG)
+            tag_to_uart(app.tag);
+
+        /* Up to and including the next new line. */
+        for (n = 0; done + n < len; )
+        {
+            if (s[done + n++] == '\n')
+                break;
+        }
+
+        uart_text(s + done, n);
+        line_start = (s[done + n - 1] == '\n');
+    }
+    return len;
+}
+
 /*************************************************************************
 NAME    
     u8_to_uart
@@ -127,6 +369,30 @@ static void i16_to_uart(int16 num)
     uart_copy(p, 6 - (p - buf));
 }
 
+/*************************************************************************
+NAME    
+    u32_to_uart
+    
+DESCRIPTION
+    Convert uint32 to a decimal string and copy it into the UART sink
+
+RETURNS
+
+*/
+static void u32_to_uart(uint32 num)
+{
+    char buf[10]; /* maximum length for an unsigned 32 bit decimal */
+    char *p = &buf[10];
+
+    do
+    {
+        *(--p) = '0' + (num % 10);
+        num /= 10;
+    } while (num);
+
+    uart_copy(p, 10 - (p - buf));
+}
+
 /*************************************************************************
 NAME    
     passkey_to_uart
@@ -191,10 +457,36 @@ static void addr_to_uart(bdaddr *addr)
 
 /*************************************************************************
 NAME    
-    print
+    print_flush
+    
+DESCRIPTION
+    Send what print() has output so far.
+
+RETURNS
+    
+*/
+static void print_flush(void)
+{
+    if (out_sink)
+    {
+        SinkFlush(out_sink, SinkClaim(out_sink, 0));
+        return;
+    }
+
+    if (app.mux)
+        mux_text_flush();
+
+    /* flush the sink */
+    SinkFlush(StreamUartSink(), SinkClaim(StreamUartSink(), 0));
+}
+
+/*************************************************************************
+NAME    
+    vprint
     
 DESCRIPTION
-    Simple formatting print command outputting to UART.
+    Simple formatting print command outputting to UART, with the arguments
+    in a va_list.
 
     This is to avoid having buffer for vsprintf.
 
@@ -204,6 +496,7 @@ DESCRIPTION
     %B print typed_bdaddr
     %c print character
     %d print signed 16-bit number in decimal
+    %l print unsigned 32-bit number in decimal
     %s print null terminated string
     %U print UUID
     %x print unsigned 16-bit number in hex (4 digits)
@@ -212,13 +505,11 @@ DESCRIPTION
 RETURNS
     
 */
-void print(const char *fmt, ...)
+static void vprint(const char *fmt, va_list ap)
 {
-    va_list ap;
     const char *str;
     void *p;
 
-    va_start(ap, fmt);
     str = fmt;
     
     while (*fmt)
@@ -252,6 +543,10 @@ void print(const char *fmt, ...)
                     uart_copy(p, strlen(p));
                     break;
 
+                case 'l':
+                    u32_to_uart(va_arg(ap, uint32));
+                    break;
+                    
                 case 'P':
                     passkey_to_uart(va_arg(ap, unsigned long));
                     break;
@@ -271,7 +566,236 @@ void print(const char *fmt, ...)
 
     uart_copy(str, fmt - str);
 
-    /* flush the sink */
+    print_flush();
+}
+
+
+/*************************************************************************
+NAME    
+    print
+    
+DESCRIPTION
+    Formatted output, see vprint().
+
+RETURNS
+    
+*/
+void print(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vprint(fmt, ap);
+    va_end(ap);
+}
+
+/*************************************************************************
+NAME    
+    print_error
+    
+DESCRIPTION
+    Output an error message, or only its code in machine mode.
+
+RETURNS
+    
+*/
+void print_error(RESULT_ENUM_T code, const char *fmt, ...)
+{
+    va_list ap;
+
+    app.result = code;
+
+    if (app.machine)
+    {
+        print("E%d\r\n", code);
+        return;
+    }
+
+    print("ERROR: ");
+    va_start(ap, fmt);
+    vprint(fmt, ap);
+    va_end(ap);
+}
+
+/*************************************************************************
+NAME    
+    print_completion
+    
+DESCRIPTION
+    Output the progress of a connection, terse in machine mode.
+
+RETURNS
+    
+*/
+void print_completion(COMPLETION_ENUM_T code, uint16 link_id, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (app.machine)
+    {
+        print("C%d %d\r\n", code, link_id);
+        return;
+    }
+
+    va_start(ap, fmt);
+    vprint(fmt, ap);
+    va_end(ap);
+}
+
+/*************************************************************************
+NAME    
+    print_ready
+    
+DESCRIPTION
+    Output the 'Ready.' banner for people.
+
+RETURNS
+    
+*/
+void print_ready(void)
+{
+    if (!app.machine)
+        print("Ready.\r\n");
+}
+
+/*************************************************************************
+NAME    
+    print_text
+    
+DESCRIPTION
+    Output text that is not NULL terminated.
+
+RETURNS
+    
+*/
+void print_text(const uint8 *s, uint16 len)
+{
+    uart_copy((const char *)s, len);
+    print_flush();
+}
+
+/*************************************************************************
+NAME    
+    print_sink
+    
+DESCRIPTION
+    Redirect print() output to another sink.
+
+RETURNS
+    The sink output was going to before.
+*/
+Sink print_sink(Sink sink)
+{
+    Sink old = (out_sink) ? out_sink : StreamUartSink();
+
+    out_sink = (sink == StreamUartSink()) ? 0 : sink;
+    return old;
+}
+
+/*************************************************************************
+NAME    
+    print_rx
+    
+DESCRIPTION
+    Output data received on a link, either as an 'Rx' line or as a frame
+    on the DLCI of the link in multiplexer mode.
+
+RETURNS
+    
+*/
+void print_rx(uint16 link_id, const uint8 *data, uint16 len)
+{
+    if (app.mux)
+    {
+        mux_frame(link_id + 1, MUX_UIH, data, len);
+        SinkFlush(StreamUartSink(), SinkClaim(StreamUartSink(), 0));
+    }
+    else if (app.connection[link_id].rx_enc == RX_ENC_HEX)
+    {
+        uint8 *p;
+
+        print("Rx %d h:", link_id);
+        if ((p = sink_space(StreamUartSink(), CODEC_HEX_LEN(len))) != NULL)
+            codec_hex_encode(data, len, p);
+        print("\r\n");
+    }
+    else if (app.connection[link_id].rx_enc == RX_ENC_BASE64)
+    {
+        uint8 *p;
+
+        print("Rx %d b:", link_id);
+        if ((p = sink_space(StreamUartSink(), CODEC_BASE64_LEN(len))) != NULL)
+            codec_base64_encode(data, len, p);
+        print("\r\n");
+    }
+    else
+    {
+        print("Rx %d \"", link_id);
+        uart_raw((const char *)data, len);
+        print("\"\r\n");
+    }
+}
+
+/*************************************************************************
+NAME    
+    print_rx_max
+    
+DESCRIPTION
+    Work out how much received data print_rx() can output in a given
+    amount of UART space.
+
+RETURNS
+    Number of bytes, 0 if there is not enough space.
+*/
+uint16 print_rx_max(uint16 link_id, uint16 space)
+{
+    if (app.mux)
+    {
+        if (space <= MUX_OVERHEAD)
+            return 0;
+        space -= MUX_OVERHEAD;
+        return (space > MUX_MAX_INFO) ? MUX_MAX_INFO : space;
+    }
+
+    if (space <= RX_OVERHEAD)
+        return 0;
+    space -= RX_OVERHEAD;
+
+    switch (app.connection[link_id].rx_enc)
+    {
+        case RX_ENC_HEX:
+            return space / 2;
+        case RX_ENC_BASE64:
+            return space / 4 * 3;
+        default:
+            return space;
+    }
+}
+
+/*************************************************************************
+NAME    
+    mux_flow
+    
+DESCRIPTION
+    Ask the host to stop or resume sending data for a link, with an MSC
+    message.
+
+RETURNS
+    
+*/
+void mux_flow(uint16 link_id, bool stop)
+{
+    uint8 msc[4];
+
+    if (!app.mux)
+        return;
+
+    msc[0] = MUX_MSC_CMD;
+    msc[1] = (2 << 1) | MUX_EA;
+    msc[2] = (uint8)(((link_id + 1) << 2) | MUX_CR | MUX_EA);
+    msc[3] = (stop) ? (MUX_V24_FC | MUX_EA) : MUX_EA;
+
+    mux_frame(0, MUX_UI, msc, 4);
     SinkFlush(StreamUartSink(), SinkClaim(StreamUartSink(), 0));
 }
 
@@ -341,61 +865,364 @@ void fancy_print(const uint8 *p, uint16 len)
 
 /*************************************************************************
 NAME    
-    ui_parser
+    mux_control
     
 DESCRIPTION
-    Handle reading UART source and dispatch command handlers.
+    Handle a multiplexer control message from the host.
 
 RETURNS
 
 */
-void ui_parser(MAIN_APP_T *app, Source src)
+static void mux_control(MAIN_APP_T *app, const uint8 *info, uint16 len)
+{
+    uint8 rsp[4];
+    uint16 dlci;
+
+    if (len < 2)
+        return;
+
+    switch (info[0])
+    {
+        case MUX_MSC_CMD:
+            if (len < 4)
+                return;
+
+            dlci = info[2] >> 2;
+            if (dlci > 0 && dlci <= MAX_CONNECTIONS)
+            {
+                app->connection[dlci - 1].rx_fc = (info[3] & MUX_V24_FC) ? TRUE : FALSE;
+
+                if (
+                    !app->connection[dlci - 1].rx_fc &&
+                    app->connection[dlci - 1].state == STATE_CONNECTED
+                    )
+                {
+                    rx_schedule(app, dlci - 1);
+                }
+            }
+
+            memmove(rsp, info, 4);
+            rsp[0] = MUX_MSC_RSP;
+            mux_frame(0, MUX_UI, rsp, 4);
+            SinkFlush(StreamUartSink(), SinkClaim(StreamUartSink(), 0));
+            break;
+
+        case MUX_CLD_CMD:
+            rsp[0] = MUX_CLD_RSP;
+            rsp[1] = MUX_EA;
+            mux_frame(0, MUX_UI, rsp, 2);
+
+            app->mux = FALSE;
+            print("Multiplexer mode off.\r\n");
+            break;
+
+        default:
+            if (app->debug) print("DBG: Unhandled mux control 0x%X\r\n", info[0]);
+            break;
+    }
+}
+
+/*************************************************************************
+NAME    
+    mux_input
+    
+DESCRIPTION
+    Dispatch a frame from the host.
+
+RETURNS
+
+*/
+static void mux_input(MAIN_APP_T *app,
+                      uint16 dlci,
+                      uint8 ctrl,
+                      const uint8 *info,
+                      uint16 len)
+{
+    TX_BUFFER_T *buf;
+
+    if (dlci == 0 && ctrl == MUX_UI)
+    {
+        mux_control(app, info, len);
+    }
+    else if (dlci == 0)
+    {
+        CMD_CONTEXT_T ctx;
+
+        /* Command line, the line ending is optional. */
+        while (len && (info[len - 1] == '\r' || info[len - 1] == '\n'))
+            len--;
+
+        ctx.buf = info;
+        ctx.end = info + len;
+        ctx.pos = 0;
+        ctx.discard = FALSE;
+        ctx.out = StreamUartSink();
+        ctx.echo = FALSE;
+        command_parse(app, &ctx);
+    }
+    else if (
+        dlci <= MAX_CONNECTIONS &&
+        app->connection[dlci - 1].state == STATE_CONNECTED &&
+        len
+        )
+    {
+        buf = tx_buffer_new(len);
+        memmove(buf->data, info, len);
+
+        /* The host should have stopped on the MSC, so this is lost. */
+        if (!tx_queue(app, dlci - 1, buf))
+            if (app->debug) print("DBG: Link %d tx queue full\r\n", dlci - 1);
+
+        tx_buffer_release(buf);
+    }
+}
+
+/*************************************************************************
+NAME    
+    ui_frame
+    
+DESCRIPTION
+    Handle one multiplexer frame from the UART source.
+
+RETURNS
+    TRUE if anything was taken from the source.
+*/
+static bool ui_frame(MAIN_APP_T *app, Source src)
+{
+    const uint8 *data = SourceMap(src);
+    uint16 len = SourceSize(src);
+    uint16 info_len;
+    uint16 i;
+
+    if (!data || !len)
+        return FALSE;
+
+    /* Hunt for the opening flag. */
+    if (data[0] != MUX_FLAG)
+    {
+        for (i = 1; i < len && data[i] != MUX_FLAG; i++)
+            ;
+        SourceDrop(src, i);
+        return TRUE;
+    }
+
+    /* The closing flag of a frame can also be the opening flag of the next. */
+    if (len > 1 && data[1] == MUX_FLAG)
+    {
+        SourceDrop(src, 1);
+        return TRUE;
+    }
+
+    if (len < MUX_OVERHEAD)
+        return FALSE;
+
+    /* Only single octet address and length fields are used. */
+    if (!(data[1] & MUX_EA) || !(data[3] & MUX_EA))
+    {
+        SourceDrop(src, 1);
+        return TRUE;
+    }
+
+    info_len = data[3] >> 1;
+    if (len < MUX_OVERHEAD + info_len)
+        return FALSE;
+
+    if (
+        data[5 + info_len] != MUX_FLAG ||
+        mux_crc(mux_crc(0xFF, &data[1], 3), &data[4 + info_len], 1) != MUX_GOOD_FCS
+        )
+    {
+        if (app->debug) print("DBG: Bad mux frame\r\n");
+        SourceDrop(src, 1);
+        return TRUE;
+    }
+
+    mux_input(app, data[1] >> 2, data[2] & ~MUX_PF, &data[4], info_len);
+
+    /* Keep the closing flag, unless back in text mode. */
+    SourceDrop(src, (app->mux) ? 5 + info_len : 6 + info_len);
+    return TRUE;
+}
+
+/*************************************************************************
+NAME    
+    ui_line_end
+    
+DESCRIPTION
+    Find the first line ending in data from i.
+
+    A byte at a time: on the XAP every byte of a mapped source is a word of
+    its own, so there is no word of several bytes to test at once.
+
+RETURNS
+    Index of the line ending, or len if there is none.
+*/
+static uint16 ui_line_end(const uint8 *data, uint16 i, uint16 len)
+{
+    for (; i < len; i++)
+    {
+        if (data[i] == '\r' || data[i] == '\n')
+            return i;
+    }
+    return len;
+}
+
+/*************************************************************************
+NAME    
+    ui_line_drop
+    
+DESCRIPTION
+    Drop a line from a source, with its \r, \n or \r\n ending.
+
+RETURNS
+    
+*/
+static void ui_line_drop(Source src, const uint8 *data, uint16 i, uint16 len)
+{
+    if (i + 1 < len && data[i] == '\r' && data[i + 1] == '\n')
+        SourceDrop(src, i + 2); /* drop \r\n */
+    else
+        SourceDrop(src, i + 1); /* drop \r */
+}
+
+/*************************************************************************
+NAME    
+    ui_line_too_long
+    
+DESCRIPTION
+    Report a command line longer than MAX_LINE_LEN.
+
+RETURNS
+    
+*/
+static void ui_line_too_long(CMD_CONTEXT_T *ctx)
+{
+    Sink out = print_sink(ctx->out);
+
+    if (ctx->echo)
+        print("\r\n");
+    print_error(RESULT_LINE_TOO_LONG, "Line longer than %d characters.\r\n", MAX_LINE_LEN);
+    print_sink(out);
+}
+
+/*************************************************************************
+NAME    
+    ui_line
+    
+DESCRIPTION
+    Echo command line input and run the command once the line is
+    complete.
+
+    A line that grows past MAX_LINE_LEN is dropped as it arrives, up to
+    and including its line ending, so line noise or a runaway 'tx' cannot
+    fill the source and stall the input.
+
+RETURNS
+    TRUE if a command line was taken from the source.
+*/
+static bool ui_line(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, Source src)
 {
-    static uint16 pos = 0;
     const uint8 *data;
     uint16 len;
     uint16 i;
-    bool cmd = FALSE;
 
-    if (!(data = SourceMap(src))) return;
+    if (!(data = SourceMap(src)) || (len = SourceSize(src)) <= ctx->pos) return FALSE;
+
+    /* search for line ending */
+    i = ui_line_end(data, ctx->pos, len);
 
-    while ((len = SourceSize(src)) > pos)
+    /* the rest of a line that was too long */
+    if (ctx->discard)
     {
-        /* search for line ending */
-        for (i = pos; i < len; i++)
+        if (i == len)
         {
-            if (data[i] == '\r' || data[i] == '\n')
-            {
-                cmd = TRUE;
-                break;
-            }
+            SourceDrop(src, len);
+            return FALSE;
         }
+        ctx->discard = FALSE;
+        ui_line_drop(src, data, i, len);
+        return TRUE;
+    }
 
-        /* echo */
-        uart_copy((char*)&data[pos], i - pos);
-
+    /* echo, not past the limit */
+    if (ctx->echo && ctx->pos < MAX_LINE_LEN)
+    {
+        uart_copy((char*)&data[ctx->pos], ((i < MAX_LINE_LEN) ? i : MAX_LINE_LEN) - ctx->pos);
         SinkFlush(StreamUartSink(), SinkClaim(StreamUartSink(), 0));
-        pos = i;
+    }
+    ctx->pos = i;
 
-        /* check for command */
-        if (cmd)
-        {
-            print("\r\n");
+    if (i > MAX_LINE_LEN)
+    {
+        ui_line_too_long(ctx);
+        
+        /* drop what there is, and the rest of the line as it comes */
+        ctx->discard = (i == len);
+        if (ctx->discard)
+            SourceDrop(src, len);
+        else
+            ui_line_drop(src, data, i, len);
+        ctx->pos = 0;
+        return TRUE;
+    }
 
-            /* set end mark */
-            uart_end = data + pos;
+    /* check for command */
+    if (i == len)
+        return FALSE;
 
-            /* run command parser */
-            command_parse(app, data);
-            
-            if (pos + 1 < len && data[pos + 1] == '\n')
-                SourceDrop(src, pos + 2); /* drop \r\n */
-            else
-                SourceDrop(src, pos + 1); /* drop \r */
-                
-            cmd = pos = 0;
-        }
-    }
+    if (ctx->echo)
+        print("\r\n");
+
+    /* set start and end marks */
+    ctx->buf = data;
+    ctx->end = data + ctx->pos;
+
+    /* run command parser */
+    command_parse(app, ctx);
+    
+    ui_line_drop(src, data, ctx->pos, len);
+    ctx->pos = 0;
+    return TRUE;
+}
+
+/*************************************************************************
+NAME    
+    ui_source
+    
+DESCRIPTION
+    Run the command lines from a source other than the UART.
+
+RETURNS
+
+*/
+void ui_source(MAIN_APP_T *app, CMD_CONTEXT_T *ctx, Source src)
+{
+    while (ui_line(app, ctx, src))
+        ;
+}
+
+/*************************************************************************
+NAME    
+    ui_parser
+    
+DESCRIPTION
+    Handle reading UART source and dispatch command handlers.
+
+RETURNS
+
+*/
+void ui_parser(MAIN_APP_T *app, Source src)
+{
+    /* First input from the UART. */
+    if (!uart_ctx.out)
+        uart_ctx.out = StreamUartSink();
+    
+    /* A host program does not need its commands back. */
+    uart_ctx.echo = !app->machine;
+    
+    /* A command can switch between text and multiplexer mode. */
+    while ((app->mux) ? ui_frame(app, src) : ui_line(app, &uart_ctx, src))
+        ;
 }
 
 /* End-of-File */